@@ -0,0 +1,514 @@
+// End-to-end benchmark over a generated tree. Builds a synthetic source tree
+// of the requested shape, then times each stage on it:
+//   load_gitignore  LoadGitignoreSpec() on every directory with a .gitignore
+//   is_ignored      IsIgnored() on every entry, through the nested scopes
+//   walk            WalkTree() over the whole tree
+//   dump            the gitdump binary itself, dumping the tree to a file
+// and reports items/s, MB/s and, for the dump, the child's peak RSS and (on
+// Linux, from a separate traced run) how many system calls it made. Results
+// are printed and, with --json, written as one JSON object per run so they
+// can be compared across commits.
+//
+//   gitdump_bench [--depth N] [--fanout N] [--files N]
+//                 [--size-dist fixed|uniform|lognormal] [--mean-size BYTES]
+//                 [--max-size BYTES] [--binary-ratio R] [--patterns N]
+//                 [--nested-ratio R] [--nested-patterns N] [--seed N]
+//                 [--repeat N] [--jobs N] [--dir DIR] [--keep]
+//                 [--gitdump PATH] [--json FILE] [-- extra gitdump args]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <csignal>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <sys/ptrace.h>
+#endif
+
+#include "gitignore.h"
+#include "walk.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+struct Shape {
+  int depth = 4;
+  int fanout = 4;
+  int files = 16;
+  std::string size_dist = "lognormal";
+  uint64_t mean_size = 4096;
+  uint64_t max_size = uint64_t{1} << 20;
+  double binary_ratio = 0.05;
+  int patterns = 50;
+  double nested_ratio = 0.1;
+  int nested_patterns = 5;
+  uint32_t seed = 1;
+};
+
+struct Config {
+  Shape shape;
+  int repeat = 3;
+  unsigned jobs = 1;
+  fs::path dir;
+  bool keep = false;
+  std::string gitdump;
+  std::string json;
+  std::vector<std::string> dump_args;
+};
+
+// What was generated, for the in-process stages.
+struct Tree {
+  struct Dir {
+    std::string rel;
+    int parent = -1;
+    bool has_gitignore = false;
+  };
+  struct Entry {
+    std::string rel;
+    int dir = 0;  // index into `dirs` of the containing directory
+    bool is_dir = false;
+  };
+  std::vector<Dir> dirs;
+  std::vector<Entry> entries;
+  uint64_t files = 0;
+  uint64_t bytes = 0;
+};
+
+struct Result {
+  std::string name;
+  double seconds = 0;  // best of --repeat
+  uint64_t items = 0;
+  uint64_t bytes = 0;
+  long peak_rss_kb = -1;
+  long long syscalls = -1;
+};
+
+const char* const kExtensions[] = {"c", "h", "cpp", "py", "js", "md", "txt", "o", "log", "tmp"};
+
+// A mix of the pattern kinds real ignore files have: extensions, bare
+// names, directory-only names, anchored paths, globs and negations.
+std::string MakePattern(std::mt19937& rng, int depth) {
+  std::uniform_int_distribution<int> kind(0, 7), small(0, 9), level(0, std::max(0, depth - 1));
+  switch (kind(rng)) {
+    case 0: return "*." + std::string(kExtensions[small(rng)]);
+    case 1: return "f" + std::to_string(small(rng)) + ".tmp";
+    case 2: return "cache" + std::to_string(small(rng)) + "/";
+    case 3: {
+      // Anchored at least two levels down, so one line prunes one subtree.
+      std::string p;
+      for (int i = 0, n = level(rng) + 2; i < n; ++i) p += "/d" + std::to_string(small(rng));
+      return p + "/";
+    }
+    case 4: return "d" + std::to_string(small(rng)) + "/**/f" + std::to_string(small(rng)) + "." +
+                   kExtensions[small(rng)];
+    case 5: return "**/cache*/*." + std::string(kExtensions[small(rng)]);
+    case 6: return "!f" + std::to_string(small(rng)) + "." + kExtensions[small(rng)];
+    default: return "f*[0-9]" + std::to_string(small(rng)) + ".log";
+  }
+}
+
+uint64_t FileSize(std::mt19937& rng, const Shape& s) {
+  double v = static_cast<double>(s.mean_size);
+  if (s.size_dist == "uniform") {
+    v = std::uniform_real_distribution<double>(0, 2.0 * static_cast<double>(s.mean_size))(rng);
+  } else if (s.size_dist == "lognormal") {
+    const double sigma = 1.0;
+    const double mu = std::log(std::max<double>(1, static_cast<double>(s.mean_size))) - sigma * sigma / 2;
+    v = std::lognormal_distribution<double>(mu, sigma)(rng);
+  }
+  return std::min<uint64_t>(static_cast<uint64_t>(v), s.max_size);
+}
+
+bool WriteFile(const fs::path& p, const char* data, size_t n) {
+  std::ofstream out(p, std::ios::binary | std::ios::trunc);
+  out.write(data, static_cast<std::streamsize>(n));
+  return static_cast<bool>(out);
+}
+
+bool Generate(const Shape& s, const fs::path& root, Tree& tree) {
+  std::mt19937 rng(s.seed);
+  std::bernoulli_distribution binary(s.binary_ratio), nested(s.nested_ratio);
+  std::uniform_int_distribution<int> ext(0, static_cast<int>(std::size(kExtensions)) - 1);
+
+  // Contents are cut from two buffers: text lines, and bytes with NULs in
+  // them so --skip-binary has something to skip.
+  std::string text, bin;
+  for (size_t i = 0; text.size() < s.max_size; ++i) text += "line " + std::to_string(i) + " of generated text\n";
+  bin.resize(static_cast<size_t>(s.max_size));
+  for (char& c : bin) c = static_cast<char>(rng() & 0xff);
+  for (size_t i = 0; i < bin.size(); i += 64) bin[i] = '\0';
+
+  struct Pending {
+    int index;
+    int level;
+  };
+  tree.dirs.push_back({"", -1, false});
+  std::vector<Pending> todo{{0, 0}};
+  while (!todo.empty()) {
+    Pending at = todo.back();
+    todo.pop_back();
+    const std::string rel = tree.dirs[at.index].rel;
+    const fs::path dir = rel.empty() ? root : root / fs::path(rel);
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+    if (ec) return false;
+    auto join = [&](const std::string& name) { return rel.empty() ? name : rel + "/" + name; };
+
+    const int lines = at.index == 0 ? s.patterns : nested(rng) ? s.nested_patterns : 0;
+    if (lines > 0) {
+      std::string body;
+      for (int i = 0; i < lines; ++i) body += MakePattern(rng, s.depth) + "\n";
+      if (!WriteFile(dir / ".gitignore", body.data(), body.size())) return false;
+      tree.dirs[at.index].has_gitignore = true;
+      tree.entries.push_back({join(".gitignore"), at.index, false});
+    }
+    for (int i = 0; i < s.files; ++i) {
+      const std::string name = "f" + std::to_string(i) + "." + kExtensions[ext(rng)];
+      const uint64_t size = FileSize(rng, s);
+      const std::string& src = binary(rng) ? bin : text;
+      if (!WriteFile(dir / name, src.data(), static_cast<size_t>(size))) return false;
+      tree.entries.push_back({join(name), at.index, false});
+      ++tree.files;
+      tree.bytes += size;
+    }
+    if (at.level >= s.depth) continue;
+    for (int i = 0; i < s.fanout; ++i) {
+      const std::string name = (i % 5 == 4 ? "cache" : "d") + std::to_string(i);
+      tree.entries.push_back({join(name), at.index, true});
+      tree.dirs.push_back({join(name), at.index, false});
+      todo.push_back({static_cast<int>(tree.dirs.size()) - 1, at.level + 1});
+    }
+  }
+  return true;
+}
+
+template <typename F>
+double BestOf(int repeat, F&& run) {
+  double best = 0;
+  for (int i = 0; i < repeat; ++i) {
+    auto t0 = std::chrono::steady_clock::now();
+    run();
+    double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    if (i == 0 || s < best) best = s;
+  }
+  return best;
+}
+
+#if !defined(_WIN32)
+
+// The dump's own progress line would interleave with the report.
+void QuietChild() {
+  int null = ::open("/dev/null", O_WRONLY);
+  if (null >= 0) ::dup2(null, STDOUT_FILENO);
+}
+
+std::vector<char*> Argv(std::vector<std::string>& args) {
+  std::vector<char*> argv;
+  for (std::string& a : args) argv.push_back(&a[0]);
+  argv.push_back(nullptr);
+  return argv;
+}
+
+// Runs the command to completion; fills its peak RSS. Returns false if it
+// could not be run or failed.
+bool RunChild(std::vector<std::string> args, long& peak_rss_kb) {
+  std::vector<char*> argv = Argv(args);
+  pid_t pid = ::fork();
+  if (pid < 0) return false;
+  if (pid == 0) {
+    QuietChild();
+    ::execv(argv[0], argv.data());
+    ::_exit(127);
+  }
+  int status = 0;
+  struct rusage ru;
+  if (::wait4(pid, &status, 0, &ru) != pid) return false;
+  peak_rss_kb = ru.ru_maxrss;
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+#endif
+
+#if defined(__linux__)
+
+// Counts the system calls the command makes, in all of its threads, by
+// stopping it at every entry and exit. Slow, so it is a run of its own.
+long long CountSyscalls(std::vector<std::string> args) {
+  std::vector<char*> argv = Argv(args);
+  pid_t pid = ::fork();
+  if (pid < 0) return -1;
+  if (pid == 0) {
+    QuietChild();
+    if (::ptrace(PTRACE_TRACEME, 0, nullptr, nullptr) != 0) ::_exit(126);
+    ::raise(SIGSTOP);
+    ::execv(argv[0], argv.data());
+    ::_exit(127);
+  }
+  int status = 0;
+  if (::waitpid(pid, &status, 0) != pid || !WIFSTOPPED(status)) return -1;
+  ::ptrace(PTRACE_SETOPTIONS, pid, nullptr,
+           reinterpret_cast<void*>(static_cast<long>(PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_EXITKILL)));
+  ::ptrace(PTRACE_SYSCALL, pid, nullptr, nullptr);
+  long long stops = 0;
+  bool ok = true;
+  for (;;) {
+    pid_t tid = ::waitpid(-1, &status, __WALL);
+    if (tid < 0) break;  // no tracees left
+    if (!WIFSTOPPED(status)) {
+      if (tid == pid) ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+      continue;
+    }
+    int sig = WSTOPSIG(status);
+    if (sig == (SIGTRAP | 0x80)) ++stops;
+    // Tracing stops and new threads' initial SIGSTOP aren't the program's.
+    if (sig == (SIGTRAP | 0x80) || sig == SIGTRAP || sig == SIGSTOP) sig = 0;
+    ::ptrace(PTRACE_SYSCALL, tid, nullptr, reinterpret_cast<void*>(static_cast<long>(sig)));
+  }
+  // One stop on the way in and one on the way out of each call.
+  return ok ? (stops + 1) / 2 : -1;
+}
+
+#endif
+
+std::string JsonString(const std::string& s) {
+  std::string out = "\"";
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char buf[8];
+      std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+      out += buf;
+    } else {
+      out += c;
+    }
+  }
+  return out + "\"";
+}
+
+std::string ToJson(const Config& cfg, const Tree& tree, const std::vector<Result>& results) {
+  const Shape& s = cfg.shape;
+  std::ostringstream o;
+  o << "{\n  \"shape\": {\"depth\": " << s.depth << ", \"fanout\": " << s.fanout << ", \"files\": " << s.files
+    << ", \"size_dist\": " << JsonString(s.size_dist) << ", \"mean_size\": " << s.mean_size
+    << ", \"max_size\": " << s.max_size << ", \"binary_ratio\": " << s.binary_ratio
+    << ", \"patterns\": " << s.patterns << ", \"nested_ratio\": " << s.nested_ratio
+    << ", \"nested_patterns\": " << s.nested_patterns << ", \"seed\": " << s.seed << "},\n";
+  o << "  \"tree\": {\"dirs\": " << tree.dirs.size() << ", \"files\": " << tree.files << ", \"bytes\": " << tree.bytes
+    << "},\n";
+  o << "  \"jobs\": " << cfg.jobs << ",\n  \"repeat\": " << cfg.repeat << ",\n  \"dump_args\": [";
+  for (size_t i = 0; i < cfg.dump_args.size(); ++i) o << (i ? ", " : "") << JsonString(cfg.dump_args[i]);
+  o << "],\n  \"results\": [\n";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const Result& r = results[i];
+    const double per_s = r.seconds > 0 ? static_cast<double>(r.items) / r.seconds : 0;
+    const double mb_s = r.seconds > 0 ? static_cast<double>(r.bytes) / r.seconds / 1e6 : 0;
+    o << "    {\"name\": " << JsonString(r.name) << ", \"seconds\": " << r.seconds << ", \"items\": " << r.items
+      << ", \"items_per_s\": " << per_s << ", \"bytes\": " << r.bytes << ", \"mb_per_s\": " << mb_s
+      << ", \"peak_rss_kb\": ";
+    if (r.peak_rss_kb >= 0) o << r.peak_rss_kb; else o << "null";
+    o << ", \"syscalls\": ";
+    if (r.syscalls >= 0) o << r.syscalls; else o << "null";
+    o << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+  }
+  o << "  ]\n}\n";
+  return o.str();
+}
+
+void Usage() {
+  std::cerr << "usage: gitdump_bench [--depth N] [--fanout N] [--files N] [--size-dist fixed|uniform|lognormal]\n"
+               "                     [--mean-size BYTES] [--max-size BYTES] [--binary-ratio R] [--patterns N]\n"
+               "                     [--nested-ratio R] [--nested-patterns N] [--seed N] [--repeat N] [--jobs N]\n"
+               "                     [--dir DIR] [--keep] [--gitdump PATH] [--json FILE] [-- gitdump args]\n";
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Config cfg;
+#if defined(GITDUMP_EXE)
+  cfg.gitdump = GITDUMP_EXE;
+#endif
+  Shape& s = cfg.shape;
+  for (int i = 1; i < argc; ++i) {
+    std::string a = argv[i];
+    auto value = [&]() -> std::string {
+      if (i + 1 >= argc) {
+        std::cerr << "Error: missing value for " << a << "\n";
+        std::exit(1);
+      }
+      return argv[++i];
+    };
+    if (a == "--depth") s.depth = std::atoi(value().c_str());
+    else if (a == "--fanout") s.fanout = std::atoi(value().c_str());
+    else if (a == "--files") s.files = std::atoi(value().c_str());
+    else if (a == "--size-dist") s.size_dist = value();
+    else if (a == "--mean-size") s.mean_size = std::strtoull(value().c_str(), nullptr, 10);
+    else if (a == "--max-size") s.max_size = std::strtoull(value().c_str(), nullptr, 10);
+    else if (a == "--binary-ratio") s.binary_ratio = std::atof(value().c_str());
+    else if (a == "--patterns") s.patterns = std::atoi(value().c_str());
+    else if (a == "--nested-ratio") s.nested_ratio = std::atof(value().c_str());
+    else if (a == "--nested-patterns") s.nested_patterns = std::atoi(value().c_str());
+    else if (a == "--seed") s.seed = static_cast<uint32_t>(std::strtoul(value().c_str(), nullptr, 10));
+    else if (a == "--repeat") cfg.repeat = std::max(1, std::atoi(value().c_str()));
+    else if (a == "--jobs") cfg.jobs = static_cast<unsigned>(std::max(1, std::atoi(value().c_str())));
+    else if (a == "--dir") cfg.dir = value();
+    else if (a == "--keep") cfg.keep = true;
+    else if (a == "--gitdump") cfg.gitdump = value();
+    else if (a == "--json") cfg.json = value();
+    else if (a == "--") {
+      for (++i; i < argc; ++i) cfg.dump_args.push_back(argv[i]);
+    } else {
+      Usage();
+      return 1;
+    }
+  }
+  if (s.depth < 0 || s.fanout < 0 || s.files < 0 || s.max_size == 0 ||
+      (s.size_dist != "fixed" && s.size_dist != "uniform" && s.size_dist != "lognormal")) {
+    Usage();
+    return 1;
+  }
+
+  // The tree goes under DIR/tree. A previous tree is only replaced if the
+  // marker left next to it says this tool made it.
+  std::error_code ec;
+  const bool own_dir = cfg.dir.empty();
+  if (own_dir) cfg.dir = fs::temp_directory_path(ec) / ("gitdump-bench-" + std::to_string(s.seed));
+  const fs::path root = cfg.dir / "tree";
+  const fs::path marker = cfg.dir / ".gitdump-bench";
+  if (fs::exists(root, ec)) {
+    if (!fs::exists(marker, ec)) {
+      std::cerr << "Error: '" << root.string() << "' exists and was not made by gitdump_bench\n";
+      return 1;
+    }
+    fs::remove_all(root, ec);
+  }
+  fs::create_directories(cfg.dir, ec);
+  std::ofstream(marker).put('\n');
+  Tree tree;
+  if (!Generate(s, root, tree)) {
+    std::cerr << "Error: could not generate the tree under '" << cfg.dir.string() << "'\n";
+    return 1;
+  }
+  const fs::path root_abs = fs::canonical(root, ec);
+  std::cout << "tree: " << tree.dirs.size() << " dirs, " << tree.files << " files, " << tree.bytes << " bytes in "
+            << root_abs.string() << "\n";
+
+  std::vector<Result> results;
+
+  auto dir_path = [&](const Tree::Dir& d) { return d.rel.empty() ? root_abs : root_abs / fs::path(d.rel); };
+
+  // Stage results are summed into `sink` and printed, so nothing can be
+  // optimised away.
+  uint64_t sink = 0;
+  {
+    Result r{"load_gitignore"};
+    for (const Tree::Dir& d : tree.dirs) r.items += d.has_gitignore ? 1 : 0;
+    r.seconds = BestOf(cfg.repeat, [&] {
+      for (const Tree::Dir& d : tree.dirs) {
+        if (d.has_gitignore) sink += LoadGitignoreSpec(dir_path(d)).patterns.size();
+      }
+    });
+    results.push_back(r);
+  }
+
+  {
+    // The scope chain the walk would build, one per directory.
+    std::vector<IgnoreScopePtr> scopes(tree.dirs.size());
+    for (size_t i = 0; i < tree.dirs.size(); ++i) {
+      const Tree::Dir& d = tree.dirs[i];
+      IgnoreScopePtr parent = d.parent < 0 ? nullptr : scopes[static_cast<size_t>(d.parent)];
+      scopes[i] = d.has_gitignore ? PushScope(parent, d.rel, LoadGitignoreSpec(dir_path(d))) : parent;
+    }
+    Result r{"is_ignored"};
+    r.seconds = BestOf(cfg.repeat, [&] {
+      for (const Tree::Entry& e : tree.entries) {
+        sink += IsIgnored(scopes[static_cast<size_t>(e.dir)].get(), e.rel, e.is_dir) ? 1 : 0;
+      }
+    });
+    r.items = tree.entries.size();
+    results.push_back(r);
+  }
+
+  uint64_t walked = 0;
+  {
+    Result r{"walk"};
+    WalkOptions opts;
+    opts.jobs = cfg.jobs;
+    uint64_t files = 0;
+    r.seconds = BestOf(cfg.repeat, [&] {
+      files = 0;
+      WalkTree(root_abs, nullptr, opts, [&](const WalkFile&) { ++files; });
+    });
+    r.items = walked = files;
+    sink += files;
+    results.push_back(r);
+  }
+
+#if !defined(_WIN32)
+  if (!cfg.gitdump.empty()) {
+    const fs::path out = cfg.dir / "dump.md";
+    std::vector<std::string> args = {cfg.gitdump, "-p", root_abs.string(), "--out", out.string(),
+                                     "-j", std::to_string(cfg.jobs)};
+    args.insert(args.end(), cfg.dump_args.begin(), cfg.dump_args.end());
+    Result r{"dump"};
+    bool ok = true;
+    r.seconds = BestOf(cfg.repeat, [&] {
+      long rss = 0;
+      ok = RunChild(args, rss) && ok;
+      r.peak_rss_kb = std::max(r.peak_rss_kb, rss);
+    });
+    if (!ok) {
+      std::cerr << "Error: '" << cfg.gitdump << "' failed\n";
+      return 1;
+    }
+    r.items = walked;
+    r.bytes = fs::file_size(out, ec);
+#if defined(__linux__)
+    r.syscalls = CountSyscalls(args);
+#endif
+    results.push_back(r);
+  }
+#endif
+
+  std::cout << "checksum: " << sink << "\n";
+  for (const Result& r : results) {
+    std::cout << r.name << ": " << r.seconds * 1e3 << " ms, "
+              << (r.seconds > 0 ? static_cast<double>(r.items) / r.seconds : 0) << " items/s";
+    if (r.bytes) std::cout << ", " << static_cast<double>(r.bytes) / r.seconds / 1e6 << " MB/s";
+    if (r.peak_rss_kb >= 0) std::cout << ", peak RSS " << r.peak_rss_kb << " KiB";
+    if (r.syscalls >= 0) std::cout << ", " << r.syscalls << " syscalls";
+    std::cout << "\n";
+  }
+  if (!cfg.json.empty()) {
+    std::ofstream json(cfg.json, std::ios::trunc);
+    json << ToJson(cfg, tree, results);
+    if (!json) {
+      std::cerr << "Error: could not write '" << cfg.json << "'\n";
+      return 1;
+    }
+  }
+  if (own_dir && !cfg.keep) fs::remove_all(cfg.dir, ec);
+  return 0;
+}
@@ -0,0 +1,102 @@
+// Adversarial workloads for the gitignore matcher. Each case used to be
+// exponential under the old recursive '**' backtracking; the run fails if any
+// single match takes longer than --max-us so the regression can't come back.
+//
+//   gitdump_matcher_bench [--iters N] [--max-us US]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gitignore.h"
+
+struct Case {
+  std::string name;
+  std::vector<std::string> patterns;
+  std::string path;
+  bool is_dir = false;
+};
+
+static std::string Repeat(const std::string& piece, int n, char sep = '/') {
+  std::string out;
+  for (int i = 0; i < n; ++i) {
+    if (i) out.push_back(sep);
+    out += piece;
+  }
+  return out;
+}
+
+static std::vector<Case> MakeCases() {
+  std::vector<Case> cases;
+  cases.push_back({"double-star chain, no match",
+                   {"**/a/**/b/**/c/**/d"},
+                   Repeat("a", 24) + "/" + Repeat("b", 24) + "/" + Repeat("x", 24) + "/d"});
+  cases.push_back({"stacked double-star, no match",
+                   {"**/**/**/**/**/**/**/**/lib/index.js"},
+                   Repeat("node_modules/pkg", 32) + "/index.js"});
+  cases.push_back({"anchored double-star chain",
+                   {"/src/**/a/**/a/**/a/**/b"},
+                   "src/" + Repeat("a", 2) + "/" + Repeat("x", 60) + "/b"});
+  cases.push_back({"segment star backtracking",
+                   {"*a*a*a*a*a*a*a*b"},
+                   std::string(256, 'a')});
+  cases.push_back({"realistic extension",
+                   {"*.o"},
+                   "third_party/llvm/lib/Transforms/Utils/Local.cpp"});
+  cases.push_back({"realistic directory",
+                   {"node_modules/"},
+                   "web/app/node_modules", true});
+
+  // A wide, monorepo-sized spec: the prefilter index should keep this close to
+  // the cost of a single pattern.
+  std::vector<std::string> wide;
+  for (int i = 0; i < 100; ++i) {
+    wide.push_back("*.gen" + std::to_string(i));
+    wide.push_back("cache" + std::to_string(i) + "/");
+    wide.push_back("/out/target" + std::to_string(i) + "/**");
+    wide.push_back("!keep" + std::to_string(i) + ".txt");
+  }
+  cases.push_back({"400 indexed patterns", wide, "services/api/src/handlers/user.go"});
+  return cases;
+}
+
+int main(int argc, char** argv) {
+  long iters = 2000;
+  double max_us = 500.0;
+  for (int i = 1; i < argc; ++i) {
+    std::string a = argv[i];
+    if (a == "--iters" && i + 1 < argc) {
+      iters = std::atol(argv[++i]);
+    } else if (a == "--max-us" && i + 1 < argc) {
+      max_us = std::atof(argv[++i]);
+    } else {
+      std::cerr << "Unknown argument: " << a << "\n";
+      return 1;
+    }
+  }
+  if (iters < 1) iters = 1;
+
+  bool ok = true;
+  for (const Case& c : MakeCases()) {
+    std::vector<Pattern> list;
+    for (const std::string& line : c.patterns) {
+      if (auto p = ParseGitignoreLine(line)) list.push_back(std::move(*p));
+    }
+    GitignoreSpec patterns = MakeGitignoreSpec(std::move(list));
+    long matched = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (long i = 0; i < iters; ++i) {
+      matched += IsIgnored(patterns, c.path, c.is_dir) ? 1 : 0;
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    double us = std::chrono::duration<double, std::micro>(t1 - t0).count() / static_cast<double>(iters);
+    bool slow = us > max_us;
+    ok = ok && !slow;
+    std::cout << (slow ? "SLOW " : "ok   ") << c.name << ": " << us << " us/match ("
+              << (matched ? "match" : "no match") << ")\n";
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,151 @@
+// The byte-scanning kernels against their plain loops, on paths shaped like
+// a real tree's: 2 to 10 components of 2 to 14 bytes. Fails if any kernel
+// disagrees with its loop.
+//
+//   gitdump_scan_bench [--paths FILE] [--rounds N]
+//
+// --paths reads the paths from a file instead, one per line (the output of
+// `git ls-files`, say).
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "bytescan.h"
+#include "gitignore.h"
+
+static std::vector<std::string> MakePaths(size_t count) {
+  static const char* const kWords[] = {"src", "lib", "include", "test", "internal", "vendor", "cmd", "pkg",
+                                       "components", "ui", "a", "utils", "handlers", "v2", "generated",
+                                       "node_modules", "third_party", "docs", "core", "io"};
+  static const char* const kExts[] = {".cpp", ".h", ".go", ".ts", ".py", ".md", ".json", ""};
+  uint64_t state = 0x9e3779b97f4a7c15ull;
+  auto next = [&](uint64_t n) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state % n;
+  };
+  std::vector<std::string> paths;
+  paths.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    std::string p;
+    const size_t depth = 1 + next(9);
+    for (size_t d = 0; d < depth; ++d) {
+      p += kWords[next(sizeof(kWords) / sizeof(kWords[0]))];
+      p += '/';
+    }
+    p += "file_" + std::to_string(next(100000));
+    p += kExts[next(sizeof(kExts) / sizeof(kExts[0]))];
+    paths.push_back(std::move(p));
+  }
+  return paths;
+}
+
+template <typename Fn>
+static double NsPerPath(const std::vector<std::string>& paths, long rounds, Fn fn) {
+  auto t0 = std::chrono::steady_clock::now();
+  for (long r = 0; r < rounds; ++r) {
+    for (const std::string& p : paths) fn(p);
+  }
+  auto t1 = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(t1 - t0).count() / static_cast<double>(rounds * paths.size());
+}
+
+int main(int argc, char** argv) {
+  long rounds = 50;
+  std::string paths_file;
+  for (int i = 1; i < argc; ++i) {
+    std::string a = argv[i];
+    if (a == "--rounds" && i + 1 < argc) {
+      rounds = std::atol(argv[++i]);
+    } else if (a == "--paths" && i + 1 < argc) {
+      paths_file = argv[++i];
+    } else {
+      std::cerr << "Unknown argument: " << a << "\n";
+      return 1;
+    }
+  }
+  if (rounds < 1) rounds = 1;
+
+  std::vector<std::string> paths;
+  if (paths_file.empty()) {
+    paths = MakePaths(100000);
+  } else {
+    std::ifstream in(paths_file);
+    for (std::string line; std::getline(in, line);) {
+      if (!line.empty()) paths.push_back(line);
+    }
+    if (paths.empty()) {
+      std::cerr << "Error: no paths in '" << paths_file << "'\n";
+      return 1;
+    }
+  }
+  size_t bytes = 0;
+  for (const std::string& p : paths) bytes += p.size();
+  std::cout << paths.size() << " paths, " << bytes / paths.size() << " bytes on average; kernels: " << ByteScanIsa()
+            << "\n";
+
+  bool ok = true;
+  std::vector<std::string_view> a, b;
+  std::string x, y;
+  for (const std::string& p : paths) {
+    a.clear();
+    b.clear();
+    SplitBytes(p, '/', a);
+    SplitBytesScalar(p, '/', b);
+    x = y = p;
+    ReplaceBytes(x.data(), x.size(), '/', '\\');
+    ReplaceBytesScalar(y.data(), y.size(), '/', '\\');
+    if (a != b || x != y) {
+      std::cerr << "MISMATCH on '" << p << "'\n";
+      ok = false;
+      break;
+    }
+  }
+
+  std::vector<std::string_view> parts;
+  size_t sink = 0;
+  auto report = [](const char* name, double scalar, double vector) {
+    std::cout << name << ": " << scalar << " -> " << vector << " ns/path (" << scalar / vector << "x)\n";
+  };
+  report("split  ", NsPerPath(paths, rounds, [&](const std::string& p) {
+           parts.clear();
+           SplitBytesScalar(p, '/', parts);
+           sink += parts.size();
+         }),
+         NsPerPath(paths, rounds, [&](const std::string& p) {
+           parts.clear();
+           SplitBytes(p, '/', parts);
+           sink += parts.size();
+         }));
+  report("replace", NsPerPath(paths, rounds, [&](const std::string& p) {
+           x = p;
+           ReplaceBytesScalar(x.data(), x.size(), '\\', '/');
+           sink += x.size();
+         }),
+         NsPerPath(paths, rounds, [&](const std::string& p) {
+           x = p;
+           ReplaceBytes(x.data(), x.size(), '\\', '/');
+           sink += x.size();
+         }));
+
+  // What the matcher pays per entry, end to end.
+  std::vector<Pattern> list;
+  for (const char* line : {"*.o", "build/", "/dist/**", "node_modules/", "docs/**/*.md", "!keep.md", "*~"}) {
+    if (auto p = ParseGitignoreLine(line)) list.push_back(std::move(*p));
+  }
+  GitignoreSpec spec = MakeGitignoreSpec(std::move(list));
+  std::cout << "match  : " << NsPerPath(paths, rounds, [&](const std::string& p) {
+    sink += IsIgnored(spec, p, false);
+  }) << " ns/path\n";
+
+  volatile size_t keep = sink;  // so none of the loops above is optimised away
+  (void)keep;
+  return ok ? 0 : 1;
+}
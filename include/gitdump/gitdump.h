@@ -0,0 +1,102 @@
+#pragma once
+
+// gitdump as a library, for programs that dump trees over and over (an
+// indexing service, say) and would rather not spawn the CLI and parse its
+// output each time. Link against gitdump::gitdump.
+//
+// An IgnoreMatcher compiles a tree's ignore rules once and keeps them, so a
+// long-lived process pays for each .gitignore only until it changes. Scan()
+// visits the files the rules let through; Dump() writes them as the CLI
+// would, into any ContentSink.
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace gitdump {
+
+// git's ignore rules for one tree. Copies share the compiled rules, and
+// every method may be called from any number of threads at once.
+class IgnoreMatcher {
+ public:
+  // The rules git applies under `root`: core.excludesFile (when
+  // `global_excludes` is set), .git/info/exclude and every .gitignore in the
+  // tree. A .gitignore is compiled the first time a path below it is asked
+  // about or scanned, and again only once it has changed on disk.
+  static IgnoreMatcher ForTree(const std::filesystem::path& root, bool global_excludes = true);
+
+  // Just `rules`, as the text of a single .gitignore; no files are read.
+  // Such a matcher has no tree to Scan() or Dump().
+  static IgnoreMatcher FromText(std::string_view rules);
+
+  // Whether `rel`, a '/'-separated path relative to the root, is ignored,
+  // either itself or because a directory it is in is.
+  bool IsIgnored(std::string_view rel, bool is_dir) const;
+
+  // The root, canonical; empty for FromText().
+  const std::filesystem::path& root() const;
+
+  struct State;
+  const std::shared_ptr<State>& state() const { return state_; }
+
+ private:
+  explicit IgnoreMatcher(std::shared_ptr<State> state) : state_(std::move(state)) {}
+
+  std::shared_ptr<State> state_;
+};
+
+// A file a scan came across. The references are only good during the call.
+struct Entry {
+  const std::filesystem::path& path;       // to open the file with
+  const std::filesystem::path& canonical;  // with symlinks resolved
+  std::string_view rel;                    // '/'-separated, relative to the root
+};
+
+struct ScanOptions {
+  unsigned jobs = 1;  // threads listing directories; 1 lists on the caller's
+  bool sort = false;  // byte order of the paths instead of listing order
+  // Like the CLI's --include, --exclude and --ext: gitignore-syntax globs
+  // relative to the root, and extensions with or without the dot. Checked
+  // during the walk, so directories nothing could be kept from aren't listed.
+  std::vector<std::string> include, exclude, extensions;
+};
+
+// Called on the caller's thread for each file in dump order; returning false
+// ends the scan without listing the rest of the tree.
+using Visitor = std::function<bool(const Entry&)>;
+
+// Returns false if `visit` ended the scan early.
+bool Scan(const IgnoreMatcher& tree, const ScanOptions& opts, const Visitor& visit);
+
+// Where Dump() writes. Write() is only ever called from one thread at a time.
+class ContentSink {
+ public:
+  virtual ~ContentSink() = default;
+
+  virtual void Write(std::string_view data) = 0;
+  // The end of one file's block.
+  virtual void EndBlock() {}
+  virtual void Flush() {}
+};
+
+struct DumpOptions {
+  ScanOptions scan;
+  unsigned readers = 0;  // threads loading files; 0 loads on the caller's
+  std::optional<uint64_t> max_file_size;  // longer files are truncated...
+  bool skip_oversize = false;             // ...or left out
+  bool skip_binary = false;               // binary files get a placeholder
+  bool dedup = false;                     // repeats refer back to the first copy
+  std::optional<uint64_t> budget_bytes;   // only dump what fits
+};
+
+// Writes every file Scan() would visit into `sink` as fenced blocks, like
+// the CLI's output, and flushes it. Problems with single files are reported
+// in the dump; false means the tree itself couldn't be read.
+bool Dump(const IgnoreMatcher& tree, const DumpOptions& opts, ContentSink& sink);
+
+}  // namespace gitdump
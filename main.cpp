@@ -1,13 +1,15 @@
 #include <algorithm>
-#include <cctype>
+#include <chrono>
 #include <cstdio>
-#include <fstream>
+#include <cstdlib>
+#include <functional>
+#include <map>
 #include <iostream>
+#include <memory>
 #include <optional>
-#include <set>
-#include <stack>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <utility>
 #include <vector>
 #if defined(_WIN32)
@@ -16,50 +18,99 @@
 #endif
 #include <filesystem>
 
+#include "budget.h"
+#include "compress.h"
+#include "dedup.h"
+#include "dump.h"
+#include "dumpindex.h"
+#include "fileio.h"
+#include "output.h"
+#include "scancache.h"
+#include "serve.h"
+#include "shard.h"
+#include "strutil.h"
+#include "watch.h"
+
 namespace fs = std::filesystem;
 
 struct Args {
-  std::string path = ".";
+  std::vector<std::string> paths;  // "." unless given
   std::optional<std::string> out;
+  unsigned jobs = 1;
+  unsigned readers = 0;
+  size_t queue_depth = 64;
+  size_t memory_budget = size_t{256} << 20;
+  size_t out_buffer = kDefaultOutputBuffer;
+  size_t chunk_size = kDefaultCopyChunk;
+  std::optional<uint64_t> max_file_size;
+  OversizePolicy oversize = OversizePolicy::kTruncate;
+  bool skip_binary = false;
+  bool global_excludes = true;
+  FileSource source = FileSource::kWalk;
+  bool include_untracked = false;
+  std::optional<std::string> cache;
+  bool watch = false;
+  bool io_uring = false;
+  bool sort = false;
+  bool stats = false;
+  std::optional<std::string> stats_json;  // "" for stderr
+  size_t stats_top = 10;
+  std::optional<BudgetOptions> budget;
+  bool dedup = false;
+  std::optional<CompressOptions> compress;
+  std::optional<std::string> index;  // "" for next to --out
+  std::optional<std::string> server;  // socket of a gitdump serve to ask
+  PathFilter filter;
+  std::optional<ShardPlan> shard;
 };
 
-static inline std::string ToLower(std::string s) {
-  for (char& c : s) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
-  return s;
-}
-
-static inline bool StartsWith(std::string_view s, std::string_view prefix) {
-  return s.size() >= prefix.size() && s.substr(0, prefix.size()) == prefix;
-}
-
-static inline bool EndsWith(std::string_view s, std::string_view suffix) {
-  return s.size() >= suffix.size() && s.substr(s.size() - suffix.size()) == suffix;
-}
-
-static inline std::string Trim(std::string s) {
-  size_t i = 0;
-  while (i < s.size() && (s[i] == ' ' || s[i] == '\t' || s[i] == '\r' || s[i] == '\n')) ++i;
-  size_t j = s.size();
-  while (j > i && (s[j - 1] == ' ' || s[j - 1] == '\t' || s[j - 1] == '\r' || s[j - 1] == '\n')) --j;
-  return s.substr(i, j - i);
+static std::string NextValue(int argc, char** argv, int& i, const std::string& flag) {
+  if (i + 1 >= argc) {
+    std::cerr << "Error: missing value for " << flag << "\n";
+    std::exit(1);
+  }
+  return argv[++i];
 }
 
-static inline std::string PathToPosix(const fs::path& p) {
-  return p.generic_string();
+static unsigned long ParseCount(const std::string& flag, const std::string& v, unsigned long max) {
+  char* end = nullptr;
+  unsigned long n = std::strtoul(v.c_str(), &end, 10);
+  if (v.empty() || v[0] == '-' || *end != '\0' || n > max) {
+    std::cerr << "Error: invalid value for " << flag << ": " << v << "\n";
+    std::exit(1);
+  }
+  return n;
 }
 
-static inline std::string NormalizeSlashes(std::string s) {
-  for (char& c : s) if (c == '\\') c = '/';
-  return s;
+// Accepts a byte count with an optional K/M/G suffix (powers of 1024).
+static size_t ParseSize(const std::string& flag, const std::string& v) {
+  char* end = nullptr;
+  unsigned long long n = std::strtoull(v.c_str(), &end, 10);
+  unsigned shift = 0;
+  if (*end == 'k' || *end == 'K') shift = 10;
+  else if (*end == 'm' || *end == 'M') shift = 20;
+  else if (*end == 'g' || *end == 'G') shift = 30;
+  if (shift) ++end;
+  if (v.empty() || v[0] == '-' || end == v.c_str() || *end != '\0' || n > (~0ull >> shift)) {
+    std::cerr << "Error: invalid value for " << flag << ": " << v << "\n";
+    std::exit(1);
+  }
+  return static_cast<size_t>(n << shift);
 }
 
 static Args ParseArguments(int argc, char** argv) {
   Args args;
+  BudgetOptions budget;
+  bool budgeted = false;
+  CompressOptions compress;
+  compress.threads = std::max(1u, std::thread::hardware_concurrency());
+  bool compressed = false;
+  std::optional<std::string> shard_sizes;
   for (int i = 1; i < argc; ++i) {
     std::string a = argv[i];
     if (a == "-p" || a == "--path") {
       if (i + 1 < argc) {
-        args.path = argv[++i];
+        args.paths.push_back(argv[++i]);
       } else {
         std::cerr << "Error: missing value for " << a << "\n";
         std::exit(1);
@@ -71,214 +122,545 @@ static Args ParseArguments(int argc, char** argv) {
         std::cerr << "Error: missing value for --out\n";
         std::exit(1);
       }
+    } else if (a == "-j" || a == "--jobs") {
+      unsigned long n = ParseCount(a, NextValue(argc, argv, i, a), 1024);
+      args.jobs = n == 0 ? std::max(1u, std::thread::hardware_concurrency()) : static_cast<unsigned>(n);
+    } else if (a == "--readers") {
+      args.readers = static_cast<unsigned>(ParseCount(a, NextValue(argc, argv, i, a), 1024));
+    } else if (a == "--queue-depth") {
+      args.queue_depth = ParseCount(a, NextValue(argc, argv, i, a), 1u << 20);
+    } else if (a == "--memory-budget") {
+      args.memory_budget = ParseSize(a, NextValue(argc, argv, i, a));
+    } else if (a == "--out-buffer") {
+      args.out_buffer = ParseSize(a, NextValue(argc, argv, i, a));
+    } else if (a == "--chunk-size") {
+      args.chunk_size = std::max<size_t>(ParseSize(a, NextValue(argc, argv, i, a)), 4096);
+    } else if (a == "--max-file-size") {
+      args.max_file_size = ParseSize(a, NextValue(argc, argv, i, a));
+    } else if (a == "--oversize") {
+      std::string v = NextValue(argc, argv, i, a);
+      if (v == "truncate") {
+        args.oversize = OversizePolicy::kTruncate;
+      } else if (v == "skip") {
+        args.oversize = OversizePolicy::kSkip;
+      } else {
+        std::cerr << "Error: invalid value for " << a << ": " << v << " (expected truncate or skip)\n";
+        std::exit(1);
+      }
+    } else if (a == "--skip-binary") {
+      args.skip_binary = true;
+    } else if (a == "--no-global-excludes") {
+      args.global_excludes = false;
+    } else if (a == "--source" || a.rfind("--source=", 0) == 0) {
+      std::string v = a == "--source" ? NextValue(argc, argv, i, a) : a.substr(9);
+      if (v == "walk") {
+        args.source = FileSource::kWalk;
+      } else if (v == "index") {
+        args.source = FileSource::kIndex;
+      } else {
+        std::cerr << "Error: invalid value for --source: " << v << " (expected walk or index)\n";
+        std::exit(1);
+      }
+    } else if (a == "--include-untracked") {
+      args.include_untracked = true;
+    } else if (a == "--cache") {
+      args.cache = NextValue(argc, argv, i, a);
+    } else if (a == "--watch") {
+      args.watch = true;
+    } else if (a == "--io-uring") {
+      args.io_uring = true;
+    } else if (a == "--sort") {
+      args.sort = true;
+    } else if (a == "--stats") {
+      args.stats = true;
+    } else if (a == "--stats-json" || a.rfind("--stats-json=", 0) == 0) {
+      args.stats_json = a == "--stats-json" ? std::string() : a.substr(13);
+    } else if (a == "--stats-top") {
+      args.stats_top = ParseCount(a, NextValue(argc, argv, i, a), 1u << 20);
+    } else if (a == "--compress" || a.rfind("--compress=", 0) == 0) {
+      std::string v = a == "--compress" ? NextValue(argc, argv, i, a) : a.substr(11);
+      std::string error;
+      if (!ParseCompressSpec(v, compress, error)) {
+        std::cerr << "Error: invalid value for --compress: " << error << "\n";
+        std::exit(1);
+      }
+      compressed = true;
+    } else if (a == "--compress-threads") {
+      unsigned long n = ParseCount(a, NextValue(argc, argv, i, a), 1024);
+      compress.threads = n == 0 ? std::max(1u, std::thread::hardware_concurrency()) : static_cast<unsigned>(n);
+    } else if (a == "--compress-frame") {
+      compress.frame_bytes = ParseSize(a, NextValue(argc, argv, i, a));
+    } else if (a == "--index" || a.rfind("--index=", 0) == 0) {
+      args.index = a == "--index" ? std::string() : a.substr(8);
+    } else if (a == "--dedup") {
+      args.dedup = true;
+    } else if (a == "--include") {
+      args.filter.AddInclude(NextValue(argc, argv, i, a));
+    } else if (a == "--exclude") {
+      args.filter.AddExclude(NextValue(argc, argv, i, a));
+    } else if (a == "--ext") {
+      args.filter.AddExtensions(NextValue(argc, argv, i, a));
+    } else if (a == "--shard") {
+      std::string v = NextValue(argc, argv, i, a);
+      unsigned index = 0, count = 0;
+      if (!ParseShard(v, index, count)) {
+        std::cerr << "Error: invalid value for " << a << ": " << v << " (expected I/N, with I from 1 to N)\n";
+        std::exit(1);
+      }
+      args.shard.emplace(index, count);
+    } else if (a == "--shard-sizes") {
+      shard_sizes = NextValue(argc, argv, i, a);
+    } else if (a == "--server") {
+      args.server = NextValue(argc, argv, i, a);
+    } else if (a == "--budget-bytes") {
+      budget.bytes = ParseSize(a, NextValue(argc, argv, i, a));
+      budgeted = true;
+    } else if (a == "--budget-tokens") {
+      std::string v = NextValue(argc, argv, i, a);
+      budget.bytes = ParseSize(a, v) * kBytesPerToken;
+      budgeted = true;
+    } else if (a == "--budget-order") {
+      std::string v = NextValue(argc, argv, i, a);
+      if (!ParseBudgetOrder(v, budget.order)) {
+        std::cerr << "Error: invalid value for " << a << ": " << v << " (expected a list of size, depth, recent)\n";
+        std::exit(1);
+      }
+    } else if (a == "--budget-weight") {
+      std::string v = NextValue(argc, argv, i, a);
+      BudgetWeight w;
+      if (!ParseBudgetWeight(v, w)) {
+        std::cerr << "Error: invalid value for " << a << ": " << v << " (expected PATTERN=WEIGHT)\n";
+        std::exit(1);
+      }
+      budget.weights.push_back(std::move(w));
     } else {
       std::cerr << "Unknown argument: " << a << "\n";
       std::exit(1);
     }
   }
+  if (compressed) args.compress = compress;
+  args.filter.Build();
+  if (args.paths.empty()) args.paths.push_back(".");
+  if (shard_sizes) {
+    std::string error;
+    if (!args.shard) {
+      std::cerr << "Error: --shard-sizes requires --shard\n";
+      std::exit(1);
+    }
+    if (!args.shard->LoadSizes(*shard_sizes, error)) {
+      std::cerr << "Error: " << error << "\n";
+      std::exit(1);
+    }
+  }
+  if (budgeted) {
+    args.budget = std::move(budget);
+  } else if (!budget.weights.empty()) {
+    std::cerr << "Error: --budget-weight requires --budget-bytes or --budget-tokens\n";
+    std::exit(1);
+  }
   return args;
 }
 
-struct Pattern {
-  std::string pattern;
-  bool negated = false;
-  bool dir_only = false;
-  bool anchored = false;
-};
 
-static std::vector<std::string> Split(const std::string& s, char delim) {
-  std::vector<std::string> out;
-  std::string cur;
-  for (char c : s) {
-    if (c == delim) {
-      out.push_back(cur);
-      cur.clear();
-    } else {
-      cur.push_back(c);
-    }
-  }
-  out.push_back(cur);
-  return out;
+// Puts the --compress encoder in front of `sink`, telling `index` where its
+// frames start.
+static std::unique_ptr<OutputSink> WrapSink(std::unique_ptr<OutputSink> sink, const Args& args,
+                                            DumpIndexWriter* index, CompressSink*& compress) {
+  compress = nullptr;
+  if (!args.compress) return sink;
+  auto c = std::make_unique<CompressSink>(std::move(sink), *args.compress);
+  if (index) c->set_on_frame([index](uint64_t raw, uint64_t packed) { index->AddFrame(raw, packed); });
+  compress = c.get();
+  return c;
 }
 
-static bool SegmentMatch(const std::string& pat, const std::string& text) {
-  size_t pi = 0, ti = 0;
-  size_t star_pi = std::string::npos, star_ti = std::string::npos;
-  while (ti < text.size()) {
-    if (pi < pat.size() && (pat[pi] == '?' || pat[pi] == text[ti])) {
-      ++pi; ++ti;
-    } else if (pi < pat.size() && pat[pi] == '*') {
-      star_pi = ++pi;
-      star_ti = ti;
-    } else if (star_pi != std::string::npos) {
-      pi = star_pi;
-      ti = ++star_ti;
-    } else {
-      return false;
-    }
+// Writes the --index sidecar of a dump of `dump_size` bytes as stored.
+static bool SaveIndex(const std::string& path, DumpIndexWriter& index, const Args& args, uint64_t dump_size) {
+  DumpIndex::Codec codec = DumpIndex::Codec::kNone;
+  if (args.compress) codec = args.compress->codec == Codec::kGzip ? DumpIndex::Codec::kGzip : DumpIndex::Codec::kZstd;
+  if (!DumpIndexWriter::Save(path, index.Serialize(codec, dump_size))) {
+    std::cerr << "Error writing index '" << path << "'\n";
+    return false;
   }
-  while (pi < pat.size() && pat[pi] == '*') ++pi;
-  return pi == pat.size();
+  return true;
 }
 
-static bool TokensMatch(const std::vector<std::string>& ptokens,
-                        const std::vector<std::string>& stokens,
-                        size_t pi, size_t si) {
-  if (pi == ptokens.size()) return si == stokens.size();
-  if (ptokens[pi] == "**") {
-    for (size_t k = si; k <= stokens.size(); ++k) {
-      if (TokensMatch(ptokens, stokens, pi + 1, k)) return true;
-    }
-    return false;
+// Every --path root in turn into the same sink; several trees dump as the
+// concatenation of their dumps.
+static bool DumpRoots(const Args& args, OutputSink& sink, const fs::path& self_path, const DumpOptions& opts) {
+  for (const std::string& root : args.paths) {
+    if (!DumpTree(root, sink, self_path, opts)) return false;
   }
-  if (si == stokens.size()) return false;
-  if (!SegmentMatch(ptokens[pi], stokens[si])) return false;
-  return TokensMatch(ptokens, stokens, pi + 1, si + 1);
+  return true;
 }
 
-static bool WildMatchPath(const std::string& pattern, const std::string& path) {
-  auto ptokens = Split(pattern, '/');
-  auto stokens = Split(path, '/');
-  return TokensMatch(ptokens, stokens, 0, 0);
-}
+// What --watch carries from one round to the next.
+struct WatchRound {
+  std::string cache_image;     // the scan cache, kept in memory
+  std::vector<fs::path> dirs;  // every directory the round looked at
+};
 
-static bool GitWildMatch(const Pattern& p, const std::string& rel_path, bool is_dir) {
-  if (p.dir_only && !is_dir) return false;
-  std::string path = rel_path;
-  if (EndsWith(path, "/")) {
-    if (!p.dir_only) path.pop_back();
-  }
-  if (p.anchored) {
-    return WildMatchPath(p.pattern, path);
-  }
-  if (WildMatchPath(p.pattern, path)) return true;
-  for (size_t i = 0; i < path.size(); ++i) {
-    if (path[i] == '/' && i + 1 < path.size()) {
-      if (WildMatchPath(p.pattern, path.substr(i + 1))) return true;
+// Dumps into --out. With --cache, or on every --watch round, the output is
+// rebuilt incrementally from the previous one.
+static bool DumpToFile(const Args& args, DumpOptions opts, const fs::path& self_path, WatchRound* round) {
+  const std::string& target = args.out.value();
+  std::string write_path = target;
+  std::unique_ptr<ScanCache> cache;
+  std::unique_ptr<ScanCacheWriter> cache_out;
+  uint64_t fingerprint = 0;
+  const bool incremental = args.cache || round;
+  if (incremental) {
+    fingerprint = CacheFingerprint(args.paths.front(), opts);
+    cache = std::make_unique<ScanCache>();
+    if (round && !round->cache_image.empty()) {
+      cache->Load(std::move(round->cache_image), fingerprint, target);
+    } else if (args.cache) {
+      cache->Load(fs::path(*args.cache), fingerprint, target);
     }
+    // Anything touched in the last couple of seconds may still change in
+    // the same mtime tick, so it is left for the next run to look at.
+    auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch());
+    cache_out = std::make_unique<ScanCacheWriter>(now.count() - int64_t{2000000000});
+    opts.cache = opts.walk.cache = cache.get();
+    opts.cache_out = opts.walk.record = cache_out.get();
+    // Unchanged blocks are read from the previous output while the new one
+    // is written, so the new one is built beside it and renamed over it.
+    write_path += ".tmp";
+  }
+  if (round) {
+    round->dirs.clear();
+    opts.walk.on_dir = [round](const fs::path& d) { round->dirs.push_back(d); };
   }
-  return false;
-}
 
-static std::vector<Pattern> LoadGitignoreSpec(const fs::path& root) {
-  std::vector<Pattern> res;
-  fs::path gitignore = root / ".gitignore";
-  if (!fs::exists(gitignore) || !fs::is_regular_file(gitignore)) return res;
-  std::ifstream in(gitignore);
-  if (!in) return res;
-  std::string line;
-  while (std::getline(in, line)) {
-    line = Trim(line);
-    if (line.empty()) continue;
-    if (!line.empty() && line[0] == '#') continue;
-    bool neg = false;
-    if (!line.empty() && line[0] == '!') {
-      neg = true;
-      line.erase(line.begin());
-      line = Trim(line);
-      if (line.empty()) continue;
-    }
-    bool dir_only = false;
-    if (EndsWith(line, "/")) {
-      dir_only = true;
-      line.pop_back();
+  DumpIndexWriter index;
+  if (args.index) opts.index_out = &index;
+  CompressSink* compress = nullptr;
+  std::unique_ptr<OutputSink> sink = OpenFileSink(write_path, args.out_buffer);
+  if (!sink) {
+    std::cerr << "Error writing to '" << target << "': unable to open file\n";
+    return false;
+  }
+  sink = WrapSink(std::move(sink), args, opts.index_out, compress);
+  bool ok = DumpRoots(args, *sink, self_path, opts);
+  sink->Flush();
+  if (!ok) return false;
+  if (sink->failed()) {
+    std::cerr << "Error writing to '" << target << "': write failed\n";
+    return false;
+  }
+  const uint64_t dump_size = compress ? compress->packed_size() : sink->position();
+  if (incremental) {
+    sink.reset();
+    cache.reset();
+    std::error_code ec;
+    fs::rename(write_path, target, ec);
+    if (ec) {
+      std::cerr << "Error writing to '" << target << "': " << ec.message() << "\n";
+      return false;
     }
-    bool anchored = false;
-    if (StartsWith(line, "/")) {
-      anchored = true;
-      while (!line.empty() && line[0] == '/') line.erase(line.begin());
+    FileStamp out_stamp;
+    std::string image;
+    if (StampOf(target, out_stamp)) image = cache_out->Serialize(fingerprint, out_stamp);
+    if (args.cache && (image.empty() || !ScanCacheWriter::Save(*args.cache, image))) {
+      std::cerr << "Warning: could not write cache '" << *args.cache << "'\n";
     }
-    line = NormalizeSlashes(line);
-    if (line == "**") dir_only = false;
-    res.push_back(Pattern{line, neg, dir_only, anchored});
+    if (round) round->cache_image = std::move(image);
   }
-  return res;
-}
-
-static bool IsIgnored(const std::vector<Pattern>& patterns,
-                      const std::string& rel_posix, bool is_dir) {
-  bool matched = false;
-  for (const auto& p : patterns) {
-    if (GitWildMatch(p, rel_posix, is_dir)) {
-      matched = !p.negated;
-    }
+  if (args.index && !SaveIndex(args.index->empty() ? target + ".idx" : *args.index, index, args, dump_size)) {
+    return false;
   }
-  return matched;
+  return true;
 }
 
-static void PrintFile(std::ostream& out, const fs::path& p) {
-  out << fs::weakly_canonical(p).string() << "\n";
-  out << "```" << "\n";
-  std::ifstream in(p, std::ios::in | std::ios::binary);
-  std::string buf;
-  if (in) {
-    in.seekg(0, std::ios::end);
-    std::streampos len = in.tellg();
-    in.seekg(0, std::ios::beg);
-    buf.resize(static_cast<size_t>(std::max<std::streampos>(0, len)));
-    if (!buf.empty()) in.read(&buf[0], static_cast<std::streamsize>(buf.size()));
-  }
-  out << buf;
-  if (!buf.empty() && buf.back() != '\n') out << "\n";
-  out << "```" << "\n\n";
-}
+// Rebuilds --out whenever something under the tree changes, until killed.
+static int WatchAndDump(const Args& args, const DumpOptions& opts, const fs::path& self_path) {
+  // Our own files may sit inside the tree; writing them is not a change.
+  std::vector<fs::path> own;
+  for (std::string p : {args.out.value(), args.out.value() + ".tmp"}) own.push_back(p);
+  if (args.cache) {
+    own.push_back(*args.cache);
+    own.push_back(*args.cache + ".tmp");
+  }
+  for (fs::path& p : own) {
+    std::error_code ec;
+    fs::path abs = fs::weakly_canonical(p, ec);
+    if (!ec) p = abs;
+  }
 
-static void PrintError(std::ostream& out, const std::string& msg) {
-  std::cerr << msg << "\n";
-  out << msg << "\n\n";
+  TreeWatcher watcher;
+  WatchRound round;
+  std::vector<fs::path> watched;  // sorted
+  bool watching = false;          // every one of them
+  bool warned = false;
+  for (;;) {
+    auto start = std::chrono::steady_clock::now();
+    if (DumpToFile(args, opts, self_path, &round)) {
+      auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+      std::cout << "Output successfully written to: " << args.out.value() << " (" << ms.count() << " ms)"
+                << std::endl;
+    }
+    // A change during the round is only certain to be seen in a directory
+    // that was watched before it started. A round that reached others, the
+    // first one included, is run again once they are watched too.
+    std::vector<fs::path> dirs = round.dirs;
+    std::sort(dirs.begin(), dirs.end());
+    dirs.erase(std::unique(dirs.begin(), dirs.end()), dirs.end());
+    const bool covered = watching && std::includes(watched.begin(), watched.end(), dirs.begin(), dirs.end());
+    watching = watcher.Sync(dirs);
+    watched = std::move(dirs);
+    if (!watching && !warned) {
+      warned = true;
+      std::cerr << "Warning: not every directory could be watched; changes in some may be missed\n";
+    }
+    if (!covered && watching) {
+      // What is pending predates the round about to start, which sees it.
+      bool pending = false;
+      watcher.Poll(own, pending);
+      continue;
+    }
+    if (!watcher.Wait(own, std::chrono::milliseconds(30))) {
+      std::cerr << "Error: cannot watch '" << args.paths.front() << "' for changes\n";
+      return 1;
+    }
+  }
 }
 
-static void FindAndPrintFiles(const fs::path& root, std::ostream& out, const fs::path& self_path) {
-  auto patterns = LoadGitignoreSpec(root);
-  std::error_code ec;
-  fs::path root_abs = fs::weakly_canonical(root, ec);
-  if (ec) root_abs = root;
-
-  std::stack<fs::path> dirs;
-  dirs.push(root_abs);
-
-  while (!dirs.empty()) {
-    fs::path cur = dirs.top();
-    dirs.pop();
-
-    for (auto it = fs::directory_iterator(cur, fs::directory_options::skip_permission_denied, ec);
-         !ec && it != fs::end(it); it.increment(ec)) {
-      if (ec) break;
-      const fs::directory_entry& entry = *it;
-      fs::path p = entry.path();
-      fs::path rel = fs::relative(p, root_abs, ec);
-      if (ec) rel = p.lexically_relative(root_abs);
-      std::string rel_posix = PathToPosix(rel);
+// gitdump extract DUMP PATH... [--index FILE]: prints the blocks of the given
+// files straight out of a dump written with --index, looking each one up in
+// the mapped index and decompressing only the frames it lies in.
+static int Extract(int argc, char** argv) {
+  std::optional<std::string> dump_path, index_path;
+  std::vector<std::string> paths;
+  for (int i = 2; i < argc; ++i) {
+    std::string a = argv[i];
+    if (a == "--index") {
+      index_path = NextValue(argc, argv, i, a);
+    } else if (!dump_path) {
+      dump_path = a;
+    } else {
+      paths.push_back(a);
+    }
+  }
+  if (!dump_path || paths.empty()) {
+    std::cerr << "Usage: gitdump extract DUMP PATH... [--index FILE]\n";
+    return 1;
+  }
 
-      bool is_dir = entry.is_directory(ec) && !ec;
-      bool is_reg = entry.is_regular_file(ec) && !ec;
+  MappedFile dump;
+  if (!dump.Open(*dump_path)) {
+    std::cerr << "Error: cannot read '" << *dump_path << "'\n";
+    return 1;
+  }
+  DumpIndex index;
+  std::string error;
+  if (!index.Load(index_path ? *index_path : *dump_path + ".idx", dump.size(), error)) {
+    std::cerr << "Error: " << error << "\n";
+    return 1;
+  }
 
-      if (IsIgnored(patterns, rel_posix, is_dir)) {
-        if (is_dir) continue;
-        if (!is_reg) continue;
-        if (is_reg) continue;
+  auto out = OpenStdoutSink(kDefaultOutputBuffer);
+  const std::string_view data(dump.data(), dump.size());
+  int status = 0;
+  for (std::string rel : paths) {
+    while (StartsWith(rel, "./")) rel.erase(0, 2);
+    DumpIndex::Block block;
+    if (!index.Find(rel, block)) {
+      std::cerr << "Error: '" << rel << "' is not in the dump\n";
+      status = 1;
+      continue;
+    }
+    std::string decoded;
+    std::string_view bytes;
+    if (index.codec() == DumpIndex::Codec::kNone) {
+      if (block.offset <= data.size() && block.length <= data.size() - block.offset) {
+        bytes = data.substr(static_cast<size_t>(block.offset), static_cast<size_t>(block.length));
+      }
+    } else {
+      const Codec codec = index.codec() == DumpIndex::Codec::kGzip ? Codec::kGzip : Codec::kZstd;
+      DumpIndex::Frame frame;
+      if (!CodecAvailable(codec)) {
+        std::cerr << "Error: this build has no " << CodecName(codec) << " support\n";
+        return 1;
+      }
+      if (index.FrameAt(block.offset, frame) && frame.packed_offset <= data.size() &&
+          DecompressRange(codec, data.substr(static_cast<size_t>(frame.packed_offset)),
+                          block.offset - frame.raw_offset, block.length, decoded)) {
+        bytes = decoded;
       }
+    }
+    if (bytes.size() != block.length || HashBytes(bytes) != block.hash) {
+      std::cerr << "Error: the block of '" << rel << "' doesn't match the index\n";
+      status = 1;
+      continue;
+    }
+    out->Write(bytes);
+  }
+  out->Flush();
+  return out->failed() ? 1 : status;
+}
 
-      if (is_dir) {
-        dirs.push(p);
-        continue;
+// gitdump merge SHARD... --out FILE [--index[=FILE]] [--compress SPEC]
+// [--shard-sizes FILE]: puts the dumps of the --shard runs over a tree, each
+// written with --index, back together into the dump one run would have
+// written, and its index. Their blocks are laid out again in path order,
+// which is the order every shard wrote its own in. --shard-sizes saves how
+// many bytes each top-level entry took, for the next sharded run to balance
+// on.
+static int Merge(int argc, char** argv) {
+  Args args;
+  std::optional<std::string> sizes_path;
+  std::vector<std::string> shards;
+  for (int i = 2; i < argc; ++i) {
+    std::string a = argv[i];
+    if (a == "--out") {
+      args.out = NextValue(argc, argv, i, a);
+    } else if (a == "--index" || a.rfind("--index=", 0) == 0) {
+      args.index = a == "--index" ? std::string() : a.substr(8);
+    } else if (a == "--compress" || a.rfind("--compress=", 0) == 0) {
+      std::string v = a == "--compress" ? NextValue(argc, argv, i, a) : a.substr(11);
+      CompressOptions compress;
+      compress.threads = std::max(1u, std::thread::hardware_concurrency());
+      std::string error;
+      if (!ParseCompressSpec(v, compress, error)) {
+        std::cerr << "Error: invalid value for --compress: " << error << "\n";
+        return 1;
       }
+      args.compress = compress;
+    } else if (a == "--shard-sizes") {
+      sizes_path = NextValue(argc, argv, i, a);
+    } else if (!StartsWith(a, "-")) {
+      shards.push_back(a);
+    } else {
+      std::cerr << "Unknown argument: " << a << "\n";
+      return 1;
+    }
+  }
+  if (!args.out || shards.empty()) {
+    std::cerr << "Usage: gitdump merge SHARD... --out FILE [--index[=FILE]] [--compress SPEC] "
+                 "[--shard-sizes FILE]\n";
+    return 1;
+  }
 
-      if (!is_reg) continue;
+  struct Shard {
+    MappedFile dump;
+    DumpIndex index;
+  };
+  struct Piece {
+    std::string_view rel;
+    const Shard* shard;
+    DumpIndex::Block block;
+  };
+  std::vector<std::unique_ptr<Shard>> loaded;
+  std::vector<Piece> pieces;
+  for (const std::string& path : shards) {
+    auto shard = std::make_unique<Shard>();
+    std::string error;
+    if (!shard->dump.Open(path)) {
+      std::cerr << "Error: cannot read '" << path << "'\n";
+      return 1;
+    }
+    if (!shard->index.Load(path + ".idx", shard->dump.size(), error)) {
+      std::cerr << "Error: " << error << "\n";
+      return 1;
+    }
+    if (shard->index.codec() != DumpIndex::Codec::kNone) {
+      std::cerr << "Error: '" << path << "' is compressed; merge reads uncompressed shards\n";
+      return 1;
+    }
+    // A shard is its blocks end to end, in path order; anything else wasn't
+    // written by a sharded run.
+    uint64_t end = 0;
+    for (uint64_t i = 0; i < shard->index.block_count(); ++i) {
+      Piece p{{}, shard.get(), {}};
+      p.rel = shard->index.BlockAt(i, p.block);
+      if (p.block.offset != end) break;
+      end += p.block.length;
+      pieces.push_back(p);
+    }
+    if (end != shard->dump.size()) {
+      std::cerr << "Error: '" << path << "' is not in path order; dump shards with --sort or --source index\n";
+      return 1;
+    }
+    loaded.push_back(std::move(shard));
+  }
+  std::stable_sort(pieces.begin(), pieces.end(), [](const Piece& a, const Piece& b) { return a.rel < b.rel; });
+  for (size_t i = 1; i < pieces.size(); ++i) {
+    if (pieces[i].rel == pieces[i - 1].rel) {
+      std::cerr << "Error: '" << pieces[i].rel << "' is in more than one shard\n";
+      return 1;
+    }
+  }
 
-      fs::path can_p = fs::weakly_canonical(p, ec);
-      fs::path can_self = fs::weakly_canonical(self_path, ec);
-      if (!ec && !can_self.empty() && can_p == can_self) continue;
+  DumpIndexWriter index;
+  CompressSink* compress = nullptr;
+  std::unique_ptr<OutputSink> sink = OpenFileSink(*args.out, args.out_buffer);
+  if (!sink) {
+    std::cerr << "Error writing to '" << *args.out << "': unable to open file\n";
+    return 1;
+  }
+  sink = WrapSink(std::move(sink), args, args.index ? &index : nullptr, compress);
+  std::map<std::string, uint64_t> sizes;
+  for (const Piece& p : pieces) {
+    if (args.index) index.AddBlock(std::string(p.rel), sink->position(), p.block.length, p.block.hash);
+    if (sizes_path) sizes[std::string(p.rel.substr(0, p.rel.find('/')))] += p.block.length;
+    sink->Write(std::string_view(p.shard->dump.data() + p.block.offset, static_cast<size_t>(p.block.length)));
+    sink->EndBlock();
+  }
+  sink->Flush();
+  if (sink->failed()) {
+    std::cerr << "Error writing to '" << *args.out << "': write failed\n";
+    return 1;
+  }
+  const uint64_t dump_size = compress ? compress->packed_size() : sink->position();
+  if (args.index && !SaveIndex(args.index->empty() ? *args.out + ".idx" : *args.index, index, args, dump_size)) {
+    return 1;
+  }
+  if (sizes_path && !SaveShardSizes(*sizes_path, sizes)) {
+    std::cerr << "Warning: could not write shard sizes '" << *sizes_path << "'\n";
+  }
+  std::cout << "Output successfully written to: " << *args.out << "\n";
+  return 0;
+}
 
-      std::ifstream in(p, std::ios::in | std::ios::binary);
-      if (!in) {
-        PrintError(out, std::string("Failed to read file ") + p.string() + ": open error");
-        continue;
-      }
-      in.close();
-      PrintFile(out, p);
+// gitdump serve SOCKET [-j N] [--readers N] [--workers N] [--cache-size SIZE]
+// [--no-keep-output]: answers dump requests (gitdump --server SOCKET ...)
+// until killed, keeping every tree it has dumped warm. A request can name
+// any tree the server can read, so only the server's own user (and root) is
+// answered, and the socket is created with no access for anyone else.
+static int ServeCommand(int argc, char** argv) {
+  ServeOptions opts;
+  opts.workers = std::max(4u, std::thread::hardware_concurrency());
+  std::optional<std::string> socket;
+  for (int i = 2; i < argc; ++i) {
+    std::string a = argv[i];
+    if (a == "-j" || a == "--jobs") {
+      unsigned long n = ParseCount(a, NextValue(argc, argv, i, a), 1024);
+      opts.dump.walk.jobs = n == 0 ? std::max(1u, std::thread::hardware_concurrency()) : static_cast<unsigned>(n);
+    } else if (a == "--readers") {
+      opts.dump.pipeline.readers = static_cast<unsigned>(ParseCount(a, NextValue(argc, argv, i, a), 1024));
+    } else if (a == "--workers") {
+      opts.workers = static_cast<unsigned>(std::max(1ul, ParseCount(a, NextValue(argc, argv, i, a), 1024)));
+    } else if (a == "--cache-size") {
+      opts.cache_bytes = ParseSize(a, NextValue(argc, argv, i, a));
+    } else if (a == "--no-keep-output") {
+      opts.keep_output = false;
+    } else if (!socket && !StartsWith(a, "-")) {
+      socket = a;
+    } else {
+      std::cerr << "Unknown argument: " << a << "\n";
+      return 1;
     }
   }
+  if (!socket) {
+    std::cerr << "Usage: gitdump serve SOCKET [-j N] [--readers N] [--workers N] [--cache-size SIZE] "
+                 "[--no-keep-output]\n"
+                 "Any tree the server can read can be dumped through SOCKET, so it is created with no\n"
+                 "group or other access and only requests from the server's own user, or root, are answered.\n";
+    return 1;
+  }
+  opts.socket = *socket;
+  return Serve(opts);
 }
 
 int main(int argc, char** argv) {
@@ -287,13 +669,88 @@ int main(int argc, char** argv) {
   _setmode(_fileno(stderr), _O_BINARY);
 #endif
 
+  if (argc > 1 && std::string_view(argv[1]) == "extract") return Extract(argc, argv);
+  if (argc > 1 && std::string_view(argv[1]) == "serve") return ServeCommand(argc, argv);
+  if (argc > 1 && std::string_view(argv[1]) == "merge") return Merge(argc, argv);
+
   Args args = ParseArguments(argc, argv);
-  fs::path start_directory = args.path;
-  std::error_code ec;
-  if (!fs::exists(start_directory, ec) || !fs::is_directory(start_directory, ec)) {
-    std::cerr << "Error: directory '" << start_directory.string() << "' not found.\n";
+  if (args.cache && !args.out) {
+    std::cerr << "Error: --cache requires --out\n";
     return 1;
   }
+  if (args.watch && !args.out) {
+    std::cerr << "Error: --watch requires --out\n";
+    return 1;
+  }
+  if (args.index && args.index->empty() && !args.out) {
+    std::cerr << "Error: --index needs a file name (--index=FILE) when the dump goes to stdout\n";
+    return 1;
+  }
+  // Incremental runs copy unchanged blocks out of the previous output, which
+  // has to be plain text for that.
+  if (args.compress && (args.cache || args.watch)) {
+    std::cerr << "Error: --compress can't be combined with --cache or --watch\n";
+    return 1;
+  }
+  // The server dumps in its own process, with its own settings; only what
+  // shapes the dump's content travels with the request.
+  if (args.server && (args.cache || args.watch || args.index || args.compress || args.stats || args.stats_json ||
+                      args.budget)) {
+    std::cerr << "Error: --server can't be combined with --cache, --watch, --index, --compress, --stats or "
+                 "--budget-*\n";
+    return 1;
+  }
+  // The cache, the index and the server each describe one tree, and a
+  // budget is spent across a whole tree.
+  if (args.paths.size() > 1 && (args.cache || args.watch || args.index || args.server || args.budget || args.shard)) {
+    std::cerr << "Error: several --path roots can't be combined with --cache, --watch, --index, --server, "
+                 "--budget-* or --shard\n";
+    return 1;
+  }
+  // Which files a budget keeps and which copy --dedup keeps whole depend on
+  // all of the tree, which no shard sees.
+  if (args.shard && (args.budget || args.dedup || args.server)) {
+    std::cerr << "Error: --shard can't be combined with --budget-*, --dedup or --server\n";
+    return 1;
+  }
+  // Shards are merged back by path, which is the order of a sorted walk and
+  // of the git index.
+  if (args.shard && args.source == FileSource::kWalk && !args.sort) {
+    std::cerr << "Error: --shard requires --sort (or --source index)\n";
+    return 1;
+  }
+  for (const std::string& root : args.paths) {
+    std::error_code ec;
+    if (!fs::exists(root, ec) || !fs::is_directory(root, ec)) {
+      std::cerr << "Error: directory '" << root << "' not found.\n";
+      return 1;
+    }
+  }
+  const fs::path start_directory = args.paths.front();
+
+  DumpOptions opts;
+  opts.walk.jobs = args.jobs;
+  opts.walk.sort = args.sort;
+  if (!args.filter.empty()) opts.walk.filter = &args.filter;
+  if (args.shard) opts.walk.shard = &*args.shard;
+  opts.pipeline.readers = args.readers;
+  opts.pipeline.queue_depth = args.queue_depth;
+  opts.pipeline.memory_budget = args.memory_budget;
+  opts.chunk_size = args.chunk_size;
+  opts.max_file_size = args.max_file_size;
+  opts.oversize = args.oversize;
+  opts.skip_binary = args.skip_binary;
+  opts.global_excludes = args.global_excludes;
+  opts.source = args.source;
+  opts.include_untracked = args.include_untracked;
+  opts.io_uring = args.io_uring;
+  opts.stats = args.stats;
+  opts.stats_json = args.stats_json;
+  opts.stats_top = args.stats_top;
+  opts.budget = args.budget;
+  opts.dedup = args.dedup;
+  // A batch per ring submission, as deep as the pipeline's window.
+  if (args.io_uring) opts.pipeline.batch = args.queue_depth;
 
   fs::path self_path;
   try {
@@ -302,19 +759,43 @@ int main(int argc, char** argv) {
     self_path = argv[0];
   }
 
-  if (args.out.has_value()) {
-    std::ofstream outfile(args.out.value(), std::ios::out | std::ios::binary);
-    if (!outfile) {
-      std::cerr << "Error writing to '" << args.out.value() << "': unable to open file\n";
+  if (args.watch) {
+    return WatchAndDump(args, opts, self_path);
+  }
+  if (args.server) {
+    std::unique_ptr<OutputSink> sink =
+        args.out ? OpenFileSink(*args.out, args.out_buffer) : OpenStdoutSink(args.out_buffer);
+    if (!sink) {
+      std::cerr << "Error writing to '" << *args.out << "': unable to open file\n";
+      return 1;
+    }
+    std::string error;
+    if (!RequestDump(*args.server, start_directory, opts, *sink, error)) {
+      std::cerr << "Error: " << error << "\n";
       return 1;
     }
-    FindAndPrintFiles(start_directory, outfile, self_path);
+    sink->Flush();
+    if (sink->failed()) return 1;
+    if (args.out) std::cout << "Output successfully written to: " << *args.out << "\n";
+    return 0;
+  }
+  if (args.out.has_value()) {
+    if (!DumpToFile(args, opts, self_path, nullptr)) return 1;
     std::cout << "Output successfully written to: " << args.out.value() << "\n";
   } else {
 #if defined(_WIN32)
     std::setlocale(LC_ALL, ".UTF-8");
 #endif
-    FindAndPrintFiles(start_directory, std::cout, self_path);
+    DumpIndexWriter index;
+    if (args.index) opts.index_out = &index;
+    CompressSink* compress = nullptr;
+    std::unique_ptr<OutputSink> sink = WrapSink(OpenStdoutSink(args.out_buffer), args, opts.index_out, compress);
+    bool ok = DumpRoots(args, *sink, self_path, opts);
+    sink->Flush();
+    if (!ok || sink->failed()) return 1;
+    if (args.index && !SaveIndex(*args.index, index, args, compress ? compress->packed_size() : sink->position())) {
+      return 1;
+    }
   }
   return 0;
 }
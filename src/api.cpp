@@ -0,0 +1,135 @@
+#include "gitdump/gitdump.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "dump.h"
+#include "filter.h"
+#include "gitignore.h"
+#include "scopecache.h"
+#include "walk.h"
+
+namespace fs = std::filesystem;
+
+namespace gitdump {
+
+// The compiled rules: the layers above the tree, and the scope of every
+// directory that has been looked at.
+struct IgnoreMatcher::State {
+  fs::path root;
+  bool tree = false;  // nested .gitignore files are read
+  IgnoreScopePtr base;
+  ScopeCache scopes;
+};
+
+namespace {
+
+// A ContentSink seen as the OutputSink the dump writes to.
+class ContentOutput : public OutputSink {
+ public:
+  explicit ContentOutput(ContentSink& sink) : sink_(sink) {}
+
+  void Write(std::string_view data) override {
+    position_ += data.size();
+    sink_.Write(data);
+  }
+  void EndBlock() override { sink_.EndBlock(); }
+  void Flush() override { sink_.Flush(); }
+
+ private:
+  ContentSink& sink_;
+};
+
+// The filter has to outlive the walk that points at it.
+WalkOptions MakeWalkOptions(const IgnoreMatcher& tree, const ScanOptions& opts, PathFilter& filter) {
+  for (const std::string& g : opts.include) filter.AddInclude(g);
+  for (const std::string& g : opts.exclude) filter.AddExclude(g);
+  for (const std::string& e : opts.extensions) filter.AddExtensions(e);
+  filter.Build();
+  WalkOptions walk;
+  if (!filter.empty()) walk.filter = &filter;
+  walk.jobs = opts.jobs ? opts.jobs : 1;
+  walk.sort = opts.sort;
+  std::shared_ptr<IgnoreMatcher::State> state = tree.state();
+  walk.load_scope = [state](IgnoreScopePtr parent, const std::string& rel, const fs::path& file) {
+    return state->scopes.ScopeFor(parent, rel, file);
+  };
+  return walk;
+}
+
+}  // namespace
+
+IgnoreMatcher IgnoreMatcher::ForTree(const fs::path& root, bool global_excludes) {
+  auto state = std::make_shared<State>();
+  std::error_code ec;
+  state->root = fs::weakly_canonical(root, ec);
+  if (ec) state->root = root;
+  state->tree = true;
+  state->base = LoadRepoExcludes(state->root, global_excludes);
+  return IgnoreMatcher(std::move(state));
+}
+
+IgnoreMatcher IgnoreMatcher::FromText(std::string_view rules) {
+  std::vector<Pattern> patterns;
+  while (!rules.empty()) {
+    size_t nl = rules.find('\n');
+    std::string_view line = rules.substr(0, nl);
+    rules.remove_prefix(nl == std::string_view::npos ? rules.size() : nl + 1);
+    if (auto p = ParseGitignoreLine(std::string(line))) patterns.push_back(std::move(*p));
+  }
+  auto state = std::make_shared<State>();
+  state->base = PushScope(nullptr, "", MakeGitignoreSpec(std::move(patterns)));
+  return IgnoreMatcher(std::move(state));
+}
+
+bool IgnoreMatcher::IsIgnored(std::string_view rel, bool is_dir) const {
+  State& s = *state_;
+  IgnoreScopePtr scope = s.base;
+  std::string dir;
+  if (s.tree) scope = s.scopes.ScopeFor(scope, dir, s.root / ".gitignore");
+  // Like the walk, which never enters an ignored directory: each directory
+  // on the way is matched before its .gitignore is consulted.
+  for (size_t slash = rel.find('/'); slash != std::string_view::npos; slash = rel.find('/', slash + 1)) {
+    dir.assign(rel.substr(0, slash));
+    if (::IsIgnored(scope.get(), dir, true)) return true;
+    if (s.tree) scope = s.scopes.ScopeFor(scope, dir, s.root / dir / ".gitignore");
+  }
+  return ::IsIgnored(scope.get(), rel, is_dir);
+}
+
+const fs::path& IgnoreMatcher::root() const {
+  return state_->root;
+}
+
+bool Scan(const IgnoreMatcher& tree, const ScanOptions& opts, const Visitor& visit) {
+  const IgnoreMatcher::State& s = *tree.state();
+  if (!s.tree) return true;
+  PathFilter filter;
+  return VisitTree(s.root, s.base, MakeWalkOptions(tree, opts, filter), [&](const WalkFile& f) {
+    return visit(Entry{f.path, f.canonical, f.rel});
+  });
+}
+
+bool Dump(const IgnoreMatcher& tree, const DumpOptions& opts, ContentSink& sink) {
+  const IgnoreMatcher::State& s = *tree.state();
+  if (!s.tree) return false;
+  PathFilter filter;
+  ::DumpOptions dump;
+  dump.walk = MakeWalkOptions(tree, opts.scan, filter);
+  dump.excludes = s.base;
+  dump.pipeline.readers = opts.readers;
+  dump.max_file_size = opts.max_file_size;
+  dump.oversize = opts.skip_oversize ? OversizePolicy::kSkip : OversizePolicy::kTruncate;
+  dump.skip_binary = opts.skip_binary;
+  dump.dedup = opts.dedup;
+  if (opts.budget_bytes) {
+    BudgetOptions budget;
+    budget.bytes = *opts.budget_bytes;
+    dump.budget = std::move(budget);
+  }
+  ContentOutput out(sink);
+  return DumpTree(s.root, out, fs::path(), dump);
+}
+
+}  // namespace gitdump
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+// Bump allocator for strings that are created and dropped together, such as
+// the names in one directory listing. Copy() hands out views that stay valid
+// until Clear() or destruction; Clear() keeps the largest block, so an arena
+// reused for one directory after another stops allocating once it has seen
+// the biggest listing.
+class Arena {
+ public:
+  explicit Arena(size_t block_size = size_t{16} << 10) : block_size_(block_size) {}
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+  Arena(Arena&&) noexcept = default;
+  Arena& operator=(Arena&&) noexcept = default;
+
+  std::string_view Copy(std::string_view s) {
+    if (s.empty()) return {};
+    if (s.size() > left_) Grow(s.size());
+    char* p = cur_;
+    std::memcpy(p, s.data(), s.size());
+    cur_ += s.size();
+    left_ -= s.size();
+    return std::string_view(p, s.size());
+  }
+
+  void Clear() {
+    if (blocks_.empty()) return;
+    if (blocks_.size() > 1) {
+      // Keep only the newest block; it is also the largest.
+      std::unique_ptr<char[]> keep = std::move(blocks_.back());
+      blocks_.clear();
+      blocks_.push_back(std::move(keep));
+    }
+    cur_ = blocks_.back().get();
+    left_ = sizes_.back();
+    size_t keep_size = sizes_.back();
+    sizes_.assign(1, keep_size);
+  }
+
+ private:
+  void Grow(size_t at_least) {
+    size_t size = std::max(at_least, blocks_.empty() ? block_size_ : sizes_.back() * 2);
+    blocks_.push_back(std::make_unique<char[]>(size));
+    sizes_.push_back(size);
+    cur_ = blocks_.back().get();
+    left_ = size;
+  }
+
+  size_t block_size_;
+  std::vector<std::unique_ptr<char[]>> blocks_;
+  std::vector<size_t> sizes_;
+  char* cur_ = nullptr;
+  size_t left_ = 0;
+};
@@ -0,0 +1,294 @@
+#include "batchread.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+#if defined(__linux__)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <sys/uio.h>
+#include <unistd.h>
+// IORING_FEAT_FAST_POLL arrived with 5.7, after every opcode used here.
+#if defined(__NR_io_uring_setup) && defined(IORING_FEAT_FAST_POLL) && defined(STATX_BASIC_STATS)
+#define GITDUMP_HAVE_IO_URING 1
+#endif
+#endif
+#endif
+
+#if defined(GITDUMP_HAVE_IO_URING)
+
+namespace {
+
+// What a completion is for, in the top half of its user_data.
+enum Op : uint64_t { kOpen = 1, kStatx, kRead, kClose };
+
+uint64_t Tag(Op op, size_t i) {
+  return (static_cast<uint64_t>(op) << 32) | static_cast<uint64_t>(i);
+}
+
+}  // namespace
+
+// The shared rings, mapped from the io_uring fd. The kernel consumes the
+// submission ring from sq_head and fills the completion ring up to cq_tail;
+// we own the other two indices.
+struct BatchReader::Ring {
+  int fd = -1;
+  void* sq_map = MAP_FAILED;
+  size_t sq_map_len = 0;
+  void* cq_map = MAP_FAILED;
+  size_t cq_map_len = 0;
+  io_uring_sqe* sqes = nullptr;
+  size_t sqes_len = 0;
+
+  unsigned* sq_head = nullptr;
+  unsigned* sq_tail = nullptr;
+  unsigned* sq_array = nullptr;
+  unsigned sq_mask = 0;
+  unsigned sq_entries = 0;
+  unsigned* cq_head = nullptr;
+  unsigned* cq_tail = nullptr;
+  io_uring_cqe* cqes = nullptr;
+  unsigned cq_mask = 0;
+
+  unsigned tail = 0;     // next free submission slot
+  unsigned queued = 0;   // filled but not yet handed to the kernel
+  bool broken = false;   // a submission failed; results can't be trusted
+
+  std::unique_ptr<char[]> buffers;  // one head_bytes slot per file
+  bool fixed = false;               // `buffers` registered with the kernel
+  std::vector<struct statx> stats;
+
+  ~Ring() {
+    if (sqes) ::munmap(sqes, sqes_len);
+    if (cq_map != MAP_FAILED && cq_map != sq_map) ::munmap(cq_map, cq_map_len);
+    if (sq_map != MAP_FAILED) ::munmap(sq_map, sq_map_len);
+    if (fd >= 0) ::close(fd);
+  }
+
+  bool Setup(unsigned entries) {
+    io_uring_params p;
+    std::memset(&p, 0, sizeof(p));
+    fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &p));
+    if (fd < 0 || !(p.features & IORING_FEAT_FAST_POLL)) return false;
+
+    sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    const bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single) sq_map_len = cq_map_len = std::max(sq_map_len, cq_map_len);
+    sq_map = ::mmap(nullptr, sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq_map == MAP_FAILED) return false;
+    cq_map = single ? sq_map
+                    : ::mmap(nullptr, cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                             IORING_OFF_CQ_RING);
+    if (cq_map == MAP_FAILED) return false;
+    sqes_len = p.sq_entries * sizeof(io_uring_sqe);
+    void* s = ::mmap(nullptr, sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (s == MAP_FAILED) return false;
+    sqes = static_cast<io_uring_sqe*>(s);
+
+    char* sq = static_cast<char*>(sq_map);
+    sq_head = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+    sq_array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+    sq_mask = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+    sq_entries = p.sq_entries;
+    char* cq = static_cast<char*>(cq_map);
+    cq_head = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+    cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+    cq_mask = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+    tail = *sq_tail;
+    return true;
+  }
+
+  // Registration pins the pages, which may exceed RLIMIT_MEMLOCK on older
+  // kernels; plain reads into the same buffers work without it.
+  void AllocateBuffers(size_t bytes) {
+    buffers = std::make_unique<char[]>(bytes);
+    struct iovec iov = {buffers.get(), bytes};
+    fixed = ::syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+  }
+
+  unsigned Free() const { return sq_entries - (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE)); }
+
+  io_uring_sqe* Next() {
+    if (Free() == 0) return nullptr;
+    unsigned slot = tail & sq_mask;
+    io_uring_sqe* sqe = &sqes[slot];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sq_array[slot] = slot;
+    ++tail;
+    ++queued;
+    return sqe;
+  }
+
+  // Hands the queued entries to the kernel and calls on_cqe(user_data, res)
+  // for `expected` completions.
+  template <typename F>
+  bool Run(unsigned expected, F&& on_cqe) {
+    __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+    unsigned seen = 0;
+    while (seen < expected) {
+      unsigned head = *cq_head;
+      unsigned ready = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+      if (head == ready || queued > 0) {
+        long r = ::syscall(__NR_io_uring_enter, fd, queued, expected - seen, IORING_ENTER_GETEVENTS, nullptr, 0);
+        if (r < 0) {
+          if (errno == EINTR) continue;
+          broken = true;
+          return false;
+        }
+        queued -= std::min<unsigned>(queued, static_cast<unsigned>(r));
+        ready = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+      }
+      for (; head != ready; ++head) {
+        const io_uring_cqe& cqe = cqes[head & cq_mask];
+        on_cqe(cqe.user_data, cqe.res);
+        ++seen;
+      }
+      __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    }
+    return true;
+  }
+};
+
+std::unique_ptr<BatchReader> BatchReader::Create(size_t depth, size_t head_bytes) {
+  depth = std::max<size_t>(1, std::min<size_t>(depth, 4096));
+  head_bytes = std::max<size_t>(1, head_bytes);
+  auto ring = std::make_unique<Ring>();
+  // Big enough for a batch of statx+read pairs, or of opens plus the last
+  // batch's closes.
+  if (!ring->Setup(static_cast<unsigned>(depth * 2))) return nullptr;
+  ring->AllocateBuffers(depth * head_bytes);
+  ring->stats.resize(depth);
+  return std::unique_ptr<BatchReader>(new BatchReader(std::move(ring), depth, head_bytes));
+}
+
+BatchReader::~BatchReader() {
+  for (int fd : pending_close_) ::close(fd);
+}
+
+void BatchReader::Read(const std::vector<const std::filesystem::path*>& paths, std::vector<BatchRead>& out) {
+  const size_t n = std::min(paths.size(), depth_);
+  out.clear();
+  out.resize(paths.size());
+  Ring& ring = *ring_;
+  if (ring.broken || n == 0) return;
+
+  // 1. Open everything, closing what the previous batch finished with.
+  std::vector<int> fds(n, -1);
+  unsigned expected = 0;
+  for (int fd : pending_close_) {
+    io_uring_sqe* sqe = ring.Next();
+    if (!sqe) {
+      ::close(fd);
+      continue;
+    }
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = fd;
+    sqe->user_data = Tag(kClose, 0);
+    ++expected;
+  }
+  pending_close_.clear();
+  for (size_t i = 0; i < n; ++i) {
+    io_uring_sqe* sqe = ring.Next();
+    if (!sqe) break;
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = reinterpret_cast<uint64_t>(paths[i]->c_str());
+    sqe->open_flags = O_RDONLY | O_CLOEXEC;
+    sqe->user_data = Tag(kOpen, i);
+    ++expected;
+  }
+  ring.Run(expected, [&](uint64_t tag, int res) {
+    if (tag >> 32 == kOpen && res >= 0) fds[tag & 0xffffffffu] = res;
+  });
+
+  // 2. Stat each open file and read its head; the read only runs if the
+  // statx succeeded.
+  static const char kEmptyPath[] = "";
+  std::vector<int> stat_res(n, -1), read_res(n, -1);
+  expected = 0;
+  for (size_t i = 0; i < n && !ring.broken; ++i) {
+    // The ring holds two entries per file, so this only guards against a
+    // kernel that gave us less than we asked for.
+    if (fds[i] < 0 || ring.Free() < 2) continue;
+    io_uring_sqe* st = ring.Next();
+    io_uring_sqe* rd = ring.Next();
+    st->opcode = IORING_OP_STATX;
+    st->flags = IOSQE_IO_LINK;
+    st->fd = fds[i];
+    st->addr = reinterpret_cast<uint64_t>(kEmptyPath);
+    st->len = STATX_BASIC_STATS;
+    st->off = reinterpret_cast<uint64_t>(&ring.stats[i]);
+    st->statx_flags = AT_EMPTY_PATH;
+    st->user_data = Tag(kStatx, i);
+
+    rd->opcode = ring.fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    rd->fd = fds[i];
+    rd->addr = reinterpret_cast<uint64_t>(ring.buffers.get() + i * head_bytes_);
+    rd->len = static_cast<uint32_t>(head_bytes_);
+    rd->off = 0;
+    rd->buf_index = 0;
+    rd->user_data = Tag(kRead, i);
+    expected += 2;
+  }
+  ring.Run(expected, [&](uint64_t tag, int res) {
+    size_t i = tag & 0xffffffffu;
+    if (tag >> 32 == kStatx) stat_res[i] = res;
+    if (tag >> 32 == kRead) read_res[i] = res;
+  });
+
+  // 3. Hand out the results. A file read to its end is closed with the next
+  // batch; one that is bigger than its head stays open for the rest.
+  for (size_t i = 0; i < n; ++i) {
+    if (fds[i] < 0) continue;
+    if (ring.broken || stat_res[i] < 0 || read_res[i] < 0) {
+      pending_close_.push_back(fds[i]);
+      continue;
+    }
+    const struct statx& sx = ring.stats[i];
+    BatchRead& r = out[i];
+    r.stamp.size = sx.stx_size;
+    r.stamp.mtime_ns = static_cast<int64_t>(sx.stx_mtime.tv_sec) * 1000000000 + sx.stx_mtime.tv_nsec;
+    r.stamp.id.dev = static_cast<uint64_t>(makedev(sx.stx_dev_major, sx.stx_dev_minor));
+    r.stamp.id.ino = sx.stx_ino;
+    // A file that grew after the statx is cut to the size it was stamped at.
+    size_t got = static_cast<size_t>(std::min<uint64_t>(static_cast<uint64_t>(read_res[i]), sx.stx_size));
+    r.head.assign(ring.buffers.get() + i * head_bytes_, got);
+    r.ok = true;
+    if (got == sx.stx_size) {
+      pending_close_.push_back(fds[i]);
+    } else {
+      r.file.Adopt(fds[i]);
+    }
+  }
+}
+
+#else
+
+struct BatchReader::Ring {};
+
+std::unique_ptr<BatchReader> BatchReader::Create(size_t, size_t) {
+  return nullptr;
+}
+
+BatchReader::~BatchReader() = default;
+
+void BatchReader::Read(const std::vector<const std::filesystem::path*>& paths, std::vector<BatchRead>& out) {
+  out.clear();
+  out.resize(paths.size());
+}
+
+#endif
+
+BatchReader::BatchReader(std::unique_ptr<Ring> ring, size_t depth, size_t head_bytes)
+    : ring_(std::move(ring)), depth_(depth), head_bytes_(head_bytes) {}
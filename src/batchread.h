@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "fileio.h"
+
+// What BatchReader found out about one file.
+struct BatchRead {
+  bool ok = false;   // false: nothing usable, load the file the usual way
+  SourceFile file;   // left open unless `head` already is the whole file
+  FileStamp stamp;   // taken from the open file
+  std::string head;  // the first min(size, head limit) bytes
+};
+
+// Opens, stats and reads the start of many files with a few system calls
+// per batch instead of four per file, through an io_uring driven by raw
+// syscalls (no liburing):
+//  1. one openat per file;
+//  2. per opened file a statx linked to a read into a registered buffer;
+//  3. the files read whole are closed, batched into the next submission.
+// Only available on Linux 5.7 and later; elsewhere, or where io_uring is
+// disabled, Create() returns null. One instance per thread.
+class BatchReader {
+ public:
+  // `depth` is the most files per Read(); `head_bytes` how much of each is
+  // read ahead.
+  static std::unique_ptr<BatchReader> Create(size_t depth, size_t head_bytes);
+  ~BatchReader();
+  BatchReader(const BatchReader&) = delete;
+  BatchReader& operator=(const BatchReader&) = delete;
+
+  size_t depth() const { return depth_; }
+
+  // Fills out[i] for paths[i]; at most depth() paths.
+  void Read(const std::vector<const std::filesystem::path*>& paths, std::vector<BatchRead>& out);
+
+ private:
+  struct Ring;
+
+  BatchReader(std::unique_ptr<Ring> ring, size_t depth, size_t head_bytes);
+
+  std::unique_ptr<Ring> ring_;
+  size_t depth_;
+  size_t head_bytes_;
+  std::vector<int> pending_close_;  // fds to close with the next submission
+};
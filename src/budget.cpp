@@ -0,0 +1,98 @@
+#include "budget.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <numeric>
+#include <utility>
+
+bool ParseBudgetOrder(std::string_view list, std::vector<BudgetKey>& out) {
+  out.clear();
+  while (!list.empty()) {
+    size_t comma = list.find(',');
+    std::string_view key = list.substr(0, comma);
+    if (key == "size") {
+      out.push_back(BudgetKey::kSize);
+    } else if (key == "depth") {
+      out.push_back(BudgetKey::kDepth);
+    } else if (key == "recent") {
+      out.push_back(BudgetKey::kRecent);
+    } else {
+      return false;
+    }
+    if (comma == std::string_view::npos) break;
+    list.remove_prefix(comma + 1);
+  }
+  return !out.empty();
+}
+
+bool ParseBudgetWeight(std::string_view spec, BudgetWeight& out) {
+  size_t eq = spec.rfind('=');
+  if (eq == std::string_view::npos || eq == 0) return false;
+  std::string weight(spec.substr(eq + 1));
+  char* end = nullptr;
+  long w = std::strtol(weight.c_str(), &end, 10);
+  if (weight.empty() || *end != '\0' || w < -1000000 || w > 1000000) return false;
+  auto p = ParseGitignoreLine(std::string(spec.substr(0, eq)));
+  if (!p || p->negated) return false;
+  out.pattern = std::move(*p);
+  out.weight = static_cast<int>(w);
+  return true;
+}
+
+// Whether `p` takes in the file at `path`: it matches the file itself or, as
+// git excludes a whole directory, one of the directories above it.
+static bool WeightMatches(const Pattern& p, const PathSegments& path, PathSegments& dir) {
+  if (GitWildMatch(p, path, false)) return true;
+  dir.parts.clear();
+  for (size_t i = 0; i + 1 < path.parts.size(); ++i) {
+    dir.parts.push_back(path.parts[i]);
+    if (GitWildMatch(p, dir, true)) return true;
+  }
+  return false;
+}
+
+std::vector<bool> SelectWithinBudget(const std::vector<BudgetItem>& items, const BudgetOptions& opts) {
+  struct Key {
+    int weight = 0;
+    size_t depth = 0;
+  };
+  std::vector<Key> keys(items.size());
+  PathSegments path, dir;
+  for (size_t i = 0; i < items.size(); ++i) {
+    keys[i].depth = static_cast<size_t>(std::count(items[i].rel.begin(), items[i].rel.end(), '/'));
+    if (opts.weights.empty()) continue;
+    path.Assign(items[i].rel);
+    for (const BudgetWeight& w : opts.weights) {
+      if (WeightMatches(w.pattern, path, dir)) keys[i].weight = w.weight;
+    }
+  }
+
+  std::vector<size_t> order(items.size());
+  std::iota(order.begin(), order.end(), size_t{0});
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    if (keys[a].weight != keys[b].weight) return keys[a].weight > keys[b].weight;
+    for (BudgetKey k : opts.order) {
+      switch (k) {
+        case BudgetKey::kSize:
+          if (items[a].cost != items[b].cost) return items[a].cost < items[b].cost;
+          break;
+        case BudgetKey::kDepth:
+          if (keys[a].depth != keys[b].depth) return keys[a].depth < keys[b].depth;
+          break;
+        case BudgetKey::kRecent:
+          if (items[a].mtime_ns != items[b].mtime_ns) return items[a].mtime_ns > items[b].mtime_ns;
+          break;
+      }
+    }
+    return false;
+  });
+
+  std::vector<bool> keep(items.size(), false);
+  uint64_t left = opts.bytes;
+  for (size_t i : order) {
+    if (items[i].cost > left) continue;
+    left -= items[i].cost;
+    keep[i] = true;
+  }
+  return keep;
+}
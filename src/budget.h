@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "gitignore.h"
+
+// What --budget-tokens assumes a token costs. Source code runs at three to
+// four bytes a token; four keeps the estimate a plain shift.
+constexpr uint64_t kBytesPerToken = 4;
+
+inline uint64_t EstimateTokens(uint64_t bytes) {
+  return (bytes + kBytesPerToken - 1) / kBytesPerToken;
+}
+
+// The orderings --budget-order can chain.
+enum class BudgetKey {
+  kSize,    // smaller files first
+  kDepth,   // files nearer the root first
+  kRecent,  // most recently modified first
+};
+
+// --budget-weight: files matching `pattern` (gitignore syntax, relative to
+// the root) are considered before, or with a negative weight after, the
+// rest. A pattern matching a directory, `docs` or `docs/`, weights every
+// file below it. The last matching weight wins.
+struct BudgetWeight {
+  Pattern pattern;
+  int weight = 0;
+};
+
+struct BudgetOptions {
+  uint64_t bytes = 0;  // output size to stay within
+  std::vector<BudgetWeight> weights;
+  // Ties between equal weights, then the walk order.
+  std::vector<BudgetKey> order{BudgetKey::kDepth, BudgetKey::kSize};
+};
+
+// Parses a comma-separated list of "size", "depth" and "recent".
+bool ParseBudgetOrder(std::string_view list, std::vector<BudgetKey>& out);
+
+// Parses "PATTERN=WEIGHT".
+bool ParseBudgetWeight(std::string_view spec, BudgetWeight& out);
+
+// One file as the pre-pass saw it: `cost` is the size of its block in the
+// output, estimated from its stat size.
+struct BudgetItem {
+  std::string_view rel;
+  uint64_t cost = 0;
+  int64_t mtime_ns = 0;
+};
+
+// Goes through `items` in priority order and keeps every file that still
+// fits, so one big file doesn't shut out the small ones behind it. Returns
+// a flag per item, in the order given.
+std::vector<bool> SelectWithinBudget(const std::vector<BudgetItem>& items, const BudgetOptions& opts);
@@ -0,0 +1,210 @@
+#include "bytescan.h"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define GITDUMP_SCAN_SSE2 1
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define GITDUMP_SCAN_NEON 1
+#endif
+
+// AVX2 is used when the build targets it, and otherwise picked at run time
+// on x86 CPUs that have it, where the compiler can build single functions
+// for it (GCC and Clang).
+#if defined(GITDUMP_SCAN_SSE2) && (defined(__AVX2__) || defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define GITDUMP_SCAN_AVX2 1
+#if defined(__AVX2__)
+#define GITDUMP_AVX2_TARGET
+#define GITDUMP_AVX2_KERNEL
+#else
+// The kernels are flattened so the comparisons, built for AVX2 too, are
+// inlined into them rather than called once per vector.
+#define GITDUMP_AVX2_TARGET __attribute__((target("avx2")))
+#define GITDUMP_AVX2_KERNEL __attribute__((target("avx2"), flatten))
+#define GITDUMP_SCAN_DISPATCH 1
+#endif
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace {
+
+#if defined(GITDUMP_SCAN_SSE2) || defined(GITDUMP_SCAN_NEON)
+#define GITDUMP_SCAN_VECTOR 1
+
+// One vector's worth of comparisons: Matches() sets a group of
+// kBitsPerByte bits for every byte of p[0, kWidth) equal to c.
+#if defined(GITDUMP_SCAN_SSE2)
+struct Lanes {
+  static constexpr size_t kWidth = 16;
+  static constexpr unsigned kBitsPerByte = 1;
+  using Mask = uint32_t;
+
+  static Mask Matches(const char* p, char c) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    return static_cast<Mask>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(c))));
+  }
+};
+#else
+struct Lanes {
+  static constexpr size_t kWidth = 16;
+  static constexpr unsigned kBitsPerByte = 4;
+  using Mask = uint64_t;
+
+  // NEON has no movemask: narrowing each 16-bit lane by 4 leaves one nibble
+  // per byte, which is as good once the bit index is divided by 4.
+  static Mask Matches(const char* p, char c) {
+    uint8x16_t eq = vceqq_u8(vld1q_u8(reinterpret_cast<const uint8_t*>(p)), vdupq_n_u8(static_cast<uint8_t>(c)));
+    uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(eq), 4);
+    return vget_lane_u64(vreinterpret_u64_u8(nibbles), 0) & 0x8888888888888888ull;
+  }
+};
+#endif
+
+#if defined(GITDUMP_SCAN_AVX2)
+struct Avx2Lanes {
+  static constexpr size_t kWidth = 32;
+  static constexpr unsigned kBitsPerByte = 1;
+  using Mask = uint32_t;
+
+  GITDUMP_AVX2_TARGET static Mask Matches(const char* p, char c) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    return static_cast<Mask>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(c))));
+  }
+};
+#endif
+
+template <typename Mask>
+inline unsigned LowestBit(Mask m) {
+#if defined(_MSC_VER) && !defined(__clang__)
+  unsigned long i;
+  if constexpr (sizeof(Mask) == 8) {
+    _BitScanForward64(&i, m);
+  } else {
+    _BitScanForward(&i, m);
+  }
+  return static_cast<unsigned>(i);
+#else
+  return sizeof(Mask) == 8 ? static_cast<unsigned>(__builtin_ctzll(m)) : static_cast<unsigned>(__builtin_ctz(m));
+#endif
+}
+
+// Calls `hit(i)` for every i with p[i] == c, in order. The last partial
+// vector is copied out and padded with a byte that is not `c`, so nothing
+// past the end is read.
+template <typename L, typename Hit>
+inline void ForEachMatch(const char* p, size_t n, char c, Hit hit) {
+  size_t base = 0;
+  for (; base + L::kWidth <= n; base += L::kWidth) {
+    for (typename L::Mask m = L::Matches(p + base, c); m; m &= m - 1) hit(base + LowestBit(m) / L::kBitsPerByte);
+  }
+  if (base == n) return;
+  char tail[L::kWidth];
+  std::memset(tail, c == '\0' ? 1 : 0, sizeof(tail));
+  std::memcpy(tail, p + base, n - base);
+  for (typename L::Mask m = L::Matches(tail, c); m; m &= m - 1) hit(base + LowestBit(m) / L::kBitsPerByte);
+}
+
+template <typename L>
+inline void SplitWith(std::string_view s, char sep, std::vector<std::string_view>& parts) {
+  size_t begin = 0;
+  ForEachMatch<L>(s.data(), s.size(), sep, [&](size_t i) {
+    parts.push_back(s.substr(begin, i - begin));
+    begin = i + 1;
+  });
+  parts.push_back(s.substr(begin));
+}
+
+template <typename L>
+inline void ReplaceWith(char* p, size_t n, char from, char to) {
+  ForEachMatch<L>(p, n, from, [&](size_t i) { p[i] = to; });
+}
+
+#if !defined(GITDUMP_SCAN_AVX2) || defined(GITDUMP_SCAN_DISPATCH)
+void SplitVector(std::string_view s, char sep, std::vector<std::string_view>& parts) {
+  SplitWith<Lanes>(s, sep, parts);
+}
+
+void ReplaceVector(char* p, size_t n, char from, char to) {
+  ReplaceWith<Lanes>(p, n, from, to);
+}
+#endif
+
+#if defined(GITDUMP_SCAN_AVX2)
+GITDUMP_AVX2_KERNEL void SplitAvx2(std::string_view s, char sep, std::vector<std::string_view>& parts) {
+  SplitWith<Avx2Lanes>(s, sep, parts);
+}
+
+GITDUMP_AVX2_KERNEL void ReplaceAvx2(char* p, size_t n, char from, char to) {
+  ReplaceWith<Avx2Lanes>(p, n, from, to);
+}
+#endif
+
+#endif
+
+// The kernels in use, picked on first use.
+struct Kernels {
+  void (*split)(std::string_view, char, std::vector<std::string_view>&);
+  void (*replace)(char*, size_t, char, char);
+  const char* isa;
+};
+
+Kernels PickKernels() {
+#if defined(GITDUMP_SCAN_AVX2) && !defined(GITDUMP_SCAN_DISPATCH)
+  return Kernels{SplitAvx2, ReplaceAvx2, "avx2"};
+#else
+#if defined(GITDUMP_SCAN_DISPATCH)
+  if (__builtin_cpu_supports("avx2")) return Kernels{SplitAvx2, ReplaceAvx2, "avx2"};
+#endif
+#if defined(GITDUMP_SCAN_SSE2)
+  return Kernels{SplitVector, ReplaceVector, "sse2"};
+#elif defined(GITDUMP_SCAN_NEON)
+  return Kernels{SplitVector, ReplaceVector, "neon"};
+#else
+  return Kernels{SplitBytesScalar, ReplaceBytesScalar, "scalar"};
+#endif
+#endif
+}
+
+// Behind a function so calls during static initialisation find them too.
+const Kernels& Active() {
+  static const Kernels kernels = PickKernels();
+  return kernels;
+}
+
+}  // namespace
+
+void SplitBytesScalar(std::string_view s, char sep, std::vector<std::string_view>& parts) {
+  size_t begin = 0;
+  for (size_t i = 0; i < s.size(); ++i) {
+    if (s[i] == sep) {
+      parts.push_back(s.substr(begin, i - begin));
+      begin = i + 1;
+    }
+  }
+  parts.push_back(s.substr(begin));
+}
+
+void ReplaceBytesScalar(char* p, size_t n, char from, char to) {
+  for (size_t i = 0; i < n; ++i) {
+    if (p[i] == from) p[i] = to;
+  }
+}
+
+void SplitBytes(std::string_view s, char sep, std::vector<std::string_view>& parts) {
+  Active().split(s, sep, parts);
+}
+
+void ReplaceBytes(char* p, size_t n, char from, char to) {
+  Active().replace(p, n, from, to);
+}
+
+const char* ByteScanIsa() {
+  return Active().isa;
+}
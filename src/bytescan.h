@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+// Byte-scanning kernels for the loops that run once per path or pattern:
+// splitting on '/' and rewriting '\\'. They compare a whole vector of bytes
+// at once (SSE2 or NEON; AVX2 on CPUs that have it, chosen at run time by
+// GCC and Clang builds and at compile time by MSVC ones) and turn the hits
+// into a bit mask, so the cost goes with the number of separators rather
+// than the number of bytes. The plain loops are the fallback, and what
+// gitdump_scan_bench measures the vector ones against.
+
+// Appends the pieces of `s` between occurrences of `sep` to `parts`: one
+// more piece than there are separators, empty ones included.
+void SplitBytes(std::string_view s, char sep, std::vector<std::string_view>& parts);
+
+// Replaces every `from` in [p, p + n) with `to`.
+void ReplaceBytes(char* p, size_t n, char from, char to);
+
+void SplitBytesScalar(std::string_view s, char sep, std::vector<std::string_view>& parts);
+void ReplaceBytesScalar(char* p, size_t n, char from, char to);
+
+// The instruction set of the kernels in use: "avx2", "sse2", "neon" or
+// "scalar".
+const char* ByteScanIsa();
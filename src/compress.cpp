@@ -0,0 +1,289 @@
+#include "compress.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <utility>
+
+#if defined(GITDUMP_HAVE_ZLIB)
+#include <zlib.h>
+#endif
+#if defined(GITDUMP_HAVE_ZSTD)
+#include <zstd.h>
+#endif
+
+namespace {
+
+// Compresses `raw` into one self-contained frame; empty on failure.
+std::string CompressFrame(const CompressOptions& opts, std::string_view raw) {
+  std::string packed;
+  switch (opts.codec) {
+    case Codec::kGzip: {
+#if defined(GITDUMP_HAVE_ZLIB)
+      z_stream zs{};
+      // 15 + 16: the largest window, with a gzip header and trailer.
+      if (deflateInit2(&zs, opts.level ? opts.level : Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                       Z_DEFAULT_STRATEGY) != Z_OK) {
+        return packed;
+      }
+      packed.resize(deflateBound(&zs, static_cast<uLong>(raw.size())));
+      zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(raw.data()));
+      zs.avail_in = static_cast<uInt>(raw.size());
+      zs.next_out = reinterpret_cast<Bytef*>(&packed[0]);
+      zs.avail_out = static_cast<uInt>(packed.size());
+      const int rc = deflate(&zs, Z_FINISH);
+      packed.resize(rc == Z_STREAM_END ? zs.total_out : 0);
+      deflateEnd(&zs);
+#endif
+      break;
+    }
+    case Codec::kZstd: {
+#if defined(GITDUMP_HAVE_ZSTD)
+      struct FreeCCtx {
+        void operator()(ZSTD_CCtx* c) const { ZSTD_freeCCtx(c); }
+      };
+      thread_local std::unique_ptr<ZSTD_CCtx, FreeCCtx> cctx(ZSTD_createCCtx());
+      if (!cctx) return packed;
+      packed.resize(ZSTD_compressBound(raw.size()));
+      const size_t n = ZSTD_compressCCtx(cctx.get(), &packed[0], packed.size(), raw.data(), raw.size(),
+                                         opts.level ? opts.level : ZSTD_CLEVEL_DEFAULT);
+      packed.resize(ZSTD_isError(n) ? 0 : n);
+#endif
+      break;
+    }
+  }
+  return packed;
+}
+
+}  // namespace
+
+bool CodecAvailable(Codec codec) {
+  switch (codec) {
+    case Codec::kGzip:
+#if defined(GITDUMP_HAVE_ZLIB)
+      return true;
+#else
+      return false;
+#endif
+    case Codec::kZstd:
+#if defined(GITDUMP_HAVE_ZSTD)
+      return true;
+#else
+      return false;
+#endif
+  }
+  return false;
+}
+
+const char* CodecName(Codec codec) {
+  return codec == Codec::kGzip ? "gzip" : "zstd";
+}
+
+bool DecompressRange(Codec codec, std::string_view packed, uint64_t skip, uint64_t want, std::string& out) {
+  const size_t base = out.size();
+  char buf[64 << 10];
+  // Takes what the decoder produced; true once `want` bytes are in.
+  auto take = [&](size_t n) {
+    std::string_view got(buf, n);
+    const uint64_t drop = std::min<uint64_t>(skip, got.size());
+    skip -= drop;
+    got.remove_prefix(static_cast<size_t>(drop));
+    const uint64_t have = out.size() - base;
+    out.append(got.data(), static_cast<size_t>(std::min<uint64_t>(got.size(), want - have)));
+    return out.size() - base == want;
+  };
+  if (want == 0) return true;
+  switch (codec) {
+    case Codec::kGzip: {
+#if defined(GITDUMP_HAVE_ZLIB)
+      z_stream zs{};
+      if (inflateInit2(&zs, 15 + 16) != Z_OK) return false;
+      zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(packed.data()));
+      zs.avail_in = static_cast<uInt>(std::min<size_t>(packed.size(), 0x40000000u));
+      size_t fed = zs.avail_in;
+      bool done = false;
+      while (!done) {
+        zs.next_out = reinterpret_cast<Bytef*>(buf);
+        zs.avail_out = sizeof(buf);
+        int rc = inflate(&zs, Z_NO_FLUSH);
+        if (rc != Z_OK && rc != Z_STREAM_END) break;
+        done = take(sizeof(buf) - zs.avail_out);
+        if (rc == Z_STREAM_END && !done) {
+          // The next frame is another gzip member.
+          if (zs.avail_in == 0 && fed == packed.size()) break;
+          inflateReset(&zs);
+        }
+        if (zs.avail_in == 0 && fed < packed.size()) {
+          zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(packed.data() + fed));
+          zs.avail_in = static_cast<uInt>(std::min<size_t>(packed.size() - fed, 0x40000000u));
+          fed += zs.avail_in;
+        }
+      }
+      inflateEnd(&zs);
+      return done;
+#else
+      return false;
+#endif
+    }
+    case Codec::kZstd: {
+#if defined(GITDUMP_HAVE_ZSTD)
+      std::unique_ptr<ZSTD_DStream, size_t (*)(ZSTD_DStream*)> ds(ZSTD_createDStream(), ZSTD_freeDStream);
+      if (!ds) return false;
+      ZSTD_inBuffer in{packed.data(), packed.size(), 0};
+      bool done = false;
+      while (!done) {
+        ZSTD_outBuffer o{buf, sizeof(buf), 0};
+        size_t rc = ZSTD_decompressStream(ds.get(), &o, &in);
+        if (ZSTD_isError(rc)) break;
+        done = take(o.pos);
+        if (!done && o.pos == 0 && in.pos == in.size) break;
+      }
+      return done;
+#else
+      return false;
+#endif
+    }
+  }
+  return false;
+}
+
+bool ParseCompressSpec(std::string_view spec, CompressOptions& opts, std::string& error) {
+  std::string_view name = spec.substr(0, spec.find(':'));
+  int min_level = 1, max_level = 9;
+  if (name == "gzip") {
+    opts.codec = Codec::kGzip;
+  } else if (name == "zstd") {
+    opts.codec = Codec::kZstd;
+    max_level = 22;
+  } else {
+    error = "unknown codec '" + std::string(name) + "' (expected zstd or gzip)";
+    return false;
+  }
+  if (!CodecAvailable(opts.codec)) {
+    error = std::string("this build has no ") + CodecName(opts.codec) + " support";
+    return false;
+  }
+  opts.level = 0;
+  if (name.size() < spec.size()) {
+    std::string level(spec.substr(name.size() + 1));
+    char* end = nullptr;
+    long v = std::strtol(level.c_str(), &end, 10);
+    if (level.empty() || *end != '\0' || v < min_level || v > max_level) {
+      error = "invalid " + std::string(name) + " level '" + level + "' (expected " + std::to_string(min_level) +
+              " to " + std::to_string(max_level) + ")";
+      return false;
+    }
+    opts.level = static_cast<int>(v);
+  }
+  return true;
+}
+
+CompressSink::CompressSink(std::unique_ptr<OutputSink> out, const CompressOptions& opts)
+    : out_(std::move(out)), opts_(opts) {
+  opts_.frame_bytes = std::max<size_t>(opts_.frame_bytes, size_t{64} << 10);
+  raw_.reserve(opts_.frame_bytes);
+  if (opts_.threads <= 1) return;
+  for (unsigned i = 0; i < opts_.threads; ++i) workers_.emplace_back([this] { WorkerLoop(); });
+}
+
+CompressSink::~CompressSink() {
+  Flush();
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    stopping_ = true;
+  }
+  work_cv_.notify_all();
+  for (auto& t : workers_) t.join();
+}
+
+void CompressSink::Write(std::string_view data) {
+  position_ += data.size();
+  // A block too big for one frame is split; only its first frame is one a
+  // reader can start at.
+  const size_t limit = opts_.frame_bytes * 4;
+  while (!data.empty()) {
+    size_t take = std::min(data.size(), limit - raw_.size());
+    raw_.append(data.data(), take);
+    data.remove_prefix(take);
+    if (raw_.size() >= limit) Cut();
+  }
+}
+
+void CompressSink::EndBlock() {
+  if (raw_.size() >= opts_.frame_bytes) Cut();
+}
+
+void CompressSink::Flush() {
+  Cut();
+  Drain(true);
+  out_->Flush();
+}
+
+void CompressSink::Cut() {
+  if (raw_.empty()) return;
+  raw_sizes_.push_back(raw_.size());
+  if (workers_.empty()) {
+    Pass(CompressFrame(opts_, raw_));
+    raw_.clear();
+    return;
+  }
+
+  // Two frames per worker in flight keep them busy while bounding memory.
+  const uint64_t window = uint64_t{2} * workers_.size();
+  for (;;) {
+    Drain(false);
+    std::unique_lock<std::mutex> lock(mu_);
+    if (next_seq_ - next_write_ < window) {
+      todo_.emplace_back(next_seq_++, std::move(raw_));
+      break;
+    }
+    done_cv_.wait(lock, [&] { return done_.count(next_write_) != 0; });
+  }
+  work_cv_.notify_one();
+  raw_.clear();
+  raw_.reserve(opts_.frame_bytes);
+}
+
+void CompressSink::Drain(bool all) {
+  for (;;) {
+    std::string packed;
+    {
+      std::unique_lock<std::mutex> lock(mu_);
+      if (all) done_cv_.wait(lock, [&] { return next_write_ == next_seq_ || done_.count(next_write_) != 0; });
+      auto it = done_.find(next_write_);
+      if (it == done_.end()) return;
+      packed = std::move(it->second);
+      done_.erase(it);
+      ++next_write_;
+    }
+    Pass(packed);
+  }
+}
+
+void CompressSink::Pass(const std::string& packed) {
+  const uint64_t raw_size = raw_sizes_.front();
+  raw_sizes_.pop_front();
+  if (packed.empty()) failed_ = true;
+  if (failed_) return;
+  if (on_frame_) on_frame_(raw_passed_, out_->position());
+  raw_passed_ += raw_size;
+  out_->Write(packed);
+}
+
+void CompressSink::WorkerLoop() {
+  for (;;) {
+    std::pair<uint64_t, std::string> job;
+    {
+      std::unique_lock<std::mutex> lock(mu_);
+      work_cv_.wait(lock, [&] { return stopping_ || !todo_.empty(); });
+      if (todo_.empty()) return;
+      job = std::move(todo_.front());
+      todo_.pop_front();
+    }
+    std::string packed = CompressFrame(opts_, job.second);
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      done_.emplace(job.first, std::move(packed));
+    }
+    done_cv_.notify_all();
+  }
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "output.h"
+
+enum class Codec { kGzip, kZstd };
+
+struct CompressOptions {
+  Codec codec = Codec::kZstd;
+  int level = 0;         // 0 for the codec's default
+  unsigned threads = 1;  // 1 compresses on the writing thread
+  // A frame is closed at the first block boundary past this many bytes of
+  // input, or mid-block at four times that.
+  size_t frame_bytes = size_t{1} << 20;
+};
+
+// Whether this build can write `codec`.
+bool CodecAvailable(Codec codec);
+const char* CodecName(Codec codec);
+
+// Parses "zstd[:LEVEL]" or "gzip[:LEVEL]" into `opts`; on failure `error`
+// says why.
+bool ParseCompressSpec(std::string_view spec, CompressOptions& opts, std::string& error);
+
+// Decompresses the frames in `packed`, which must start at a frame, and
+// appends `want` bytes of their output past the first `skip` to `out`.
+// Stops decoding as soon as it has them.
+bool DecompressRange(Codec codec, std::string_view packed, uint64_t skip, uint64_t want, std::string& out);
+
+// Compresses everything written to it into a stream of independent frames
+// (zstd frames, or gzip members) and passes them on to `out` in order. The
+// stream is what the codec's own tools decompress in one go, but since
+// frames start at file blocks a reader that knows their offsets can also
+// decompress any one file on its own. Frames are compressed on up to
+// `threads` worker threads while the writer carries on filling the next.
+class CompressSink : public OutputSink {
+ public:
+  CompressSink(std::unique_ptr<OutputSink> out, const CompressOptions& opts);
+  ~CompressSink() override;
+  CompressSink(const CompressSink&) = delete;
+  CompressSink& operator=(const CompressSink&) = delete;
+
+  void Write(std::string_view data) override;
+  void EndBlock() override;
+  void Flush() override;
+  bool failed() const override { return failed_ || out_->failed(); }
+
+  // Bytes of compressed output passed on so far.
+  uint64_t packed_size() const { return out_->position(); }
+
+  // Called on the writing thread as each frame is passed on, with where it
+  // starts in the uncompressed stream and in the compressed one.
+  using FrameFn = std::function<void(uint64_t raw_offset, uint64_t packed_offset)>;
+  void set_on_frame(FrameFn fn) { on_frame_ = std::move(fn); }
+
+ private:
+  // Hands the buffered input to a worker, or compresses it here.
+  void Cut();
+  // Passes on the frames that are done, in order; with `all` it waits for
+  // every frame handed out so far.
+  void Drain(bool all);
+  void WorkerLoop();
+  void Pass(const std::string& packed);
+
+  std::unique_ptr<OutputSink> out_;
+  CompressOptions opts_;
+  std::string raw_;
+  bool failed_ = false;
+  FrameFn on_frame_;
+  std::deque<uint64_t> raw_sizes_;  // of the frames not yet passed on
+  uint64_t raw_passed_ = 0;
+
+  std::mutex mu_;
+  std::condition_variable work_cv_, done_cv_;
+  std::deque<std::pair<uint64_t, std::string>> todo_;
+  std::map<uint64_t, std::string> done_;  // an empty frame marks a failure
+  uint64_t next_seq_ = 0, next_write_ = 0;
+  bool stopping_ = false;
+  std::vector<std::thread> workers_;
+};
@@ -0,0 +1,182 @@
+#include "dedup.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+#include "fileio.h"
+
+namespace {
+
+constexpr uint64_t kPrime1 = 11400714785074694791ull;
+constexpr uint64_t kPrime2 = 14029467366897019727ull;
+constexpr uint64_t kPrime3 = 1609587929392839161ull;
+constexpr uint64_t kPrime4 = 9650029242287828579ull;
+constexpr uint64_t kPrime5 = 2870177450012600261ull;
+
+inline uint64_t Rotl(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+// The hash never leaves the process, so host byte order is fine.
+inline uint64_t Load64(const unsigned char* p) {
+  uint64_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline uint32_t Load32(const unsigned char* p) {
+  uint32_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline uint64_t Round(uint64_t acc, uint64_t input) {
+  acc += input * kPrime2;
+  acc = Rotl(acc, 31);
+  return acc * kPrime1;
+}
+
+inline uint64_t MergeLane(uint64_t h, uint64_t lane) {
+  h ^= Round(0, lane);
+  return h * kPrime1 + kPrime4;
+}
+
+bool HashFile(const std::filesystem::path& path, uint64_t size, uint64_t& hash) {
+  MappedFile map;
+  if (!map.Open(path) || map.size() != size) return false;
+  hash = HashBytes(std::string_view(map.data(), map.size()));
+  return true;
+}
+
+bool SameContents(const std::filesystem::path& a, const std::filesystem::path& b) {
+  MappedFile x, y;
+  if (!x.Open(a) || !y.Open(b) || x.size() != y.size()) return false;
+  return x.size() == 0 || std::memcmp(x.data(), y.data(), x.size()) == 0;
+}
+
+}  // namespace
+
+ContentHasher::ContentHasher() : lanes_{kPrime1 + kPrime2, kPrime2, 0, 0 - kPrime1} {}
+
+void ContentHasher::Stripe(const unsigned char* p) {
+  lanes_[0] = Round(lanes_[0], Load64(p));
+  lanes_[1] = Round(lanes_[1], Load64(p + 8));
+  lanes_[2] = Round(lanes_[2], Load64(p + 16));
+  lanes_[3] = Round(lanes_[3], Load64(p + 24));
+}
+
+void ContentHasher::Update(const char* data, size_t n) {
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+  total_ += n;
+  if (buffered_ > 0) {
+    size_t take = std::min(n, sizeof(buf_) - buffered_);
+    std::memcpy(buf_ + buffered_, p, take);
+    buffered_ += take;
+    p += take;
+    n -= take;
+    if (buffered_ < sizeof(buf_)) return;
+    Stripe(buf_);
+    buffered_ = 0;
+  }
+  for (; n >= 32; p += 32, n -= 32) Stripe(p);
+  std::memcpy(buf_, p, n);
+  buffered_ = n;
+}
+
+uint64_t ContentHasher::Digest() const {
+  uint64_t h;
+  if (total_ >= 32) {
+    h = Rotl(lanes_[0], 1) + Rotl(lanes_[1], 7) + Rotl(lanes_[2], 12) + Rotl(lanes_[3], 18);
+    for (uint64_t lane : lanes_) h = MergeLane(h, lane);
+  } else {
+    h = kPrime5;
+  }
+  h += total_;
+
+  const unsigned char* p = buf_;
+  size_t n = buffered_;
+  for (; n >= 8; p += 8, n -= 8) {
+    h ^= Round(0, Load64(p));
+    h = Rotl(h, 27) * kPrime1 + kPrime4;
+  }
+  if (n >= 4) {
+    h ^= uint64_t{Load32(p)} * kPrime1;
+    h = Rotl(h, 23) * kPrime2 + kPrime3;
+    p += 4;
+    n -= 4;
+  }
+  for (; n > 0; ++p, --n) {
+    h ^= *p * kPrime5;
+    h = Rotl(h, 11) * kPrime1;
+  }
+
+  h ^= h >> 33;
+  h *= kPrime2;
+  h ^= h >> 29;
+  h *= kPrime3;
+  h ^= h >> 32;
+  return h;
+}
+
+uint64_t HashBytes(std::string_view s) {
+  ContentHasher h;
+  h.Update(s);
+  return h.Digest();
+}
+
+std::vector<size_t> FindDuplicates(const std::vector<DedupItem>& items, unsigned jobs) {
+  std::vector<size_t> dup(items.size(), SIZE_MAX);
+
+  // A file whose size nobody else has can't be a copy of anything.
+  std::unordered_map<uint64_t, size_t> by_size;
+  for (const DedupItem& it : items) {
+    if (it.stamped && it.size >= kDedupMinBytes) ++by_size[it.size];
+  }
+  std::vector<size_t> candidates;
+  for (size_t i = 0; i < items.size(); ++i) {
+    if (items[i].stamped && items[i].size >= kDedupMinBytes && by_size[items[i].size] > 1) candidates.push_back(i);
+  }
+  if (candidates.empty()) return dup;
+
+  std::vector<uint64_t> hashes(items.size());
+  std::vector<char> hashed(items.size(), 0);
+  std::atomic<size_t> next{0};
+  auto work = [&] {
+    for (size_t k; (k = next.fetch_add(1)) < candidates.size();) {
+      size_t i = candidates[k];
+      hashed[i] = HashFile(*items[i].path, items[i].size, hashes[i]) ? 1 : 0;
+    }
+  };
+  std::vector<std::thread> threads;
+  const size_t extra = std::min<size_t>(std::max(jobs, 1u), candidates.size()) - 1;
+  for (size_t t = 0; t < extra; ++t) threads.emplace_back(work);
+  work();
+  for (auto& t : threads) t.join();
+
+  // Distinct contents sharing a size and a hash are kept apart by the byte
+  // comparison; each gets its own first copy.
+  struct Key {
+    uint64_t size, hash;
+    bool operator==(const Key& o) const { return size == o.size && hash == o.hash; }
+  };
+  struct KeyHash {
+    size_t operator()(const Key& k) const { return static_cast<size_t>(k.hash ^ (k.size * kPrime1)); }
+  };
+  std::unordered_map<Key, std::vector<size_t>, KeyHash> firsts;
+  for (size_t i : candidates) {
+    if (!hashed[i]) continue;
+    std::vector<size_t>& seen = firsts[Key{items[i].size, hashes[i]}];
+    for (size_t first : seen) {
+      if (SameContents(*items[first].path, *items[i].path)) {
+        dup[i] = first;
+        break;
+      }
+    }
+    if (dup[i] == SIZE_MAX) seen.push_back(i);
+  }
+  return dup;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string_view>
+#include <vector>
+
+// Files smaller than this are always dumped in full under --dedup: the
+// reference to an earlier copy would cost about as much as the copy.
+constexpr uint64_t kDedupMinBytes = 256;
+
+// A fast non-cryptographic 64-bit hash in the xxh64 mould: four independent
+// multiply-rotate lanes over 32-byte stripes, so the CPU overlaps them, and
+// a final avalanche. Incremental; the same bytes give the same hash however
+// they are split across Update() calls.
+class ContentHasher {
+ public:
+  ContentHasher();
+
+  void Update(const char* data, size_t n);
+  void Update(std::string_view s) { Update(s.data(), s.size()); }
+  uint64_t Digest() const;
+
+ private:
+  void Stripe(const unsigned char* p);
+
+  uint64_t lanes_[4];
+  unsigned char buf_[32];
+  size_t buffered_ = 0;
+  uint64_t total_ = 0;
+};
+
+uint64_t HashBytes(std::string_view s);
+
+// One file of the dump, as the --dedup pre-pass sees it.
+struct DedupItem {
+  const std::filesystem::path* path = nullptr;
+  uint64_t size = 0;
+  bool stamped = false;  // false when the file couldn't be stat'ed
+};
+
+// For each item, the index of the first earlier item with the same
+// contents, or SIZE_MAX. Only items whose size collides with another's are
+// hashed, on up to `jobs` threads, and a hash match is confirmed byte for
+// byte before it counts.
+std::vector<size_t> FindDuplicates(const std::vector<DedupItem>& items, unsigned jobs);
@@ -0,0 +1,120 @@
+#include "dirlist.h"
+
+#include <string>
+#include <system_error>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <cerrno>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+#if defined(_WIN32)
+
+void ListDirectory(const fs::path& dir, Arena& names, std::vector<ListedEntry>& out) {
+  out.clear();
+  WIN32_FIND_DATAW data;
+  HANDLE h = FindFirstFileExW((dir / L"*").c_str(), FindExInfoBasic, &data, FindExSearchNameMatch, nullptr,
+                              FIND_FIRST_EX_LARGE_FETCH);
+  if (h == INVALID_HANDLE_VALUE) return;
+  do {
+    const wchar_t* name = data.cFileName;
+    if (name[0] == L'.' && (name[1] == L'\0' || (name[1] == L'.' && name[2] == L'\0'))) continue;
+    ListedEntry e;
+    if (data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) {
+      e.type = ListedType::kSymlink;  // symlinks and junctions alike
+    } else if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+      e.type = ListedType::kDir;
+    } else {
+      e.type = ListedType::kFile;
+    }
+    e.name = names.Copy(fs::path(name).string());
+    out.push_back(std::move(e));
+  } while (FindNextFileW(h, &data));
+  FindClose(h);
+}
+
+#elif defined(__linux__)
+
+namespace {
+
+// Layout the kernel fills in; glibc only wraps getdents64 from 2.30 on.
+struct LinuxDirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[1];
+};
+
+constexpr size_t kDirentBuffer = size_t{64} << 10;
+
+}  // namespace
+
+void ListDirectory(const fs::path& dir, Arena& names, std::vector<ListedEntry>& out) {
+  out.clear();
+  int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) return;
+  thread_local std::vector<char> buf(kDirentBuffer);
+  for (;;) {
+    long n = ::syscall(SYS_getdents64, fd, buf.data(), buf.size());
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+    for (long at = 0; at < n;) {
+      const auto* d = reinterpret_cast<const LinuxDirent64*>(buf.data() + at);
+      at += d->d_reclen;
+      const char* name = d->d_name;
+      if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+      unsigned char type = d->d_type;
+      if (type == DT_UNKNOWN) {
+        struct stat st;
+        if (::fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+        type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : S_ISLNK(st.st_mode) ? DT_LNK : DT_UNKNOWN;
+      }
+      ListedEntry e;
+      switch (type) {
+        case DT_REG: e.type = ListedType::kFile; break;
+        case DT_DIR: e.type = ListedType::kDir; break;
+        case DT_LNK: e.type = ListedType::kSymlink; break;
+        default: continue;
+      }
+      e.name = names.Copy(name);
+      out.push_back(std::move(e));
+    }
+  }
+  ::close(fd);
+}
+
+#else
+
+void ListDirectory(const fs::path& dir, Arena& names, std::vector<ListedEntry>& out) {
+  out.clear();
+  std::error_code ec;
+  for (auto it = fs::directory_iterator(dir, fs::directory_options::skip_permission_denied, ec);
+       !ec && it != fs::end(it); it.increment(ec)) {
+    const fs::directory_entry& entry = *it;
+    ListedEntry e;
+    if (entry.is_symlink(ec) && !ec) {
+      e.type = ListedType::kSymlink;
+    } else if (entry.is_directory(ec) && !ec) {
+      e.type = ListedType::kDir;
+    } else if (entry.is_regular_file(ec) && !ec) {
+      e.type = ListedType::kFile;
+    } else {
+      continue;
+    }
+    e.name = names.Copy(entry.path().filename().string());
+    out.push_back(std::move(e));
+  }
+}
+
+#endif
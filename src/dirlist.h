@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string_view>
+#include <vector>
+
+#include "arena.h"
+
+// One name from a directory listing, before any ignore rule is applied, so a
+// cached listing stays valid when only the rules change. `name` points into
+// whatever produced the listing: an Arena, or a mapped scan cache.
+enum class ListedType : uint8_t { kFile, kDir, kSymlink };
+
+struct ListedEntry {
+  std::string_view name;
+  ListedType type = ListedType::kFile;
+};
+
+// Lists the regular files, directories and symlinks directly in `dir`, in
+// the order the filesystem returns them; "." and ".." and any other kind of
+// entry are left out. Types come from the listing itself wherever the
+// filesystem reports them, so most entries cost no stat:
+//  - Linux: getdents64 into a large buffer, d_type, with an fstatat()
+//    relative to the open directory when d_type is DT_UNKNOWN;
+//  - Windows: FindFirstFileExW with FIND_FIRST_EX_LARGE_FETCH and the
+//    attributes it returns;
+//  - elsewhere: std::filesystem::directory_iterator.
+// Names are copied into `names`. A directory that can't be read lists as
+// empty.
+void ListDirectory(const std::filesystem::path& dir, Arena& names, std::vector<ListedEntry>& out);
@@ -0,0 +1,560 @@
+#include "dump.h"
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "batchread.h"
+#include "dedup.h"
+#include "fileio.h"
+#include "gitignore.h"
+#include "gitindex.h"
+#include "sniff.h"
+#include "stats.h"
+#include "strutil.h"
+
+namespace fs = std::filesystem;
+
+static Rendered RenderError(const std::string& msg) {
+  Rendered r;
+  r.text = msg + "\n\n";
+  r.diagnostic = msg;
+  return r;
+}
+
+static void RenderHeader(std::string& out, const WalkFile& f) {
+  out += f.canonical.string();
+  out += "\n```\n";
+}
+
+// Closing fence, preceded by a newline when the body didn't end with one and
+// by a marker line when the body was cut short.
+static void RenderFooter(std::string& out, char last, uint64_t shown, uint64_t size) {
+  if (shown > 0 && last != '\n') out += "\n";
+  if (shown < size) {
+    out += "[... truncated: " + std::to_string(shown) + " of " + std::to_string(size) + " bytes shown]\n";
+  }
+  out += "```\n\n";
+}
+
+// The block of a file whose contents were already dumped under `first`.
+static Rendered RenderCopy(const WalkFile& f, const WalkFile& first, uint64_t size) {
+  Rendered r;
+  RenderHeader(r.text, f);
+  r.text += "[duplicate of " + first.canonical.string() + ": " + std::to_string(size) + " bytes]\n```\n\n";
+  return r;
+}
+
+// Reads [offset, offset + n) of `file` onto the end of `out` and returns how
+// many bytes arrived.
+static size_t AppendRange(std::string& out, const SourceFile& file, uint64_t offset, size_t n) {
+  size_t base = out.size();
+  out.resize(base + n);
+  size_t got = 0;
+  while (got < n) {
+    long long r = file.ReadAt(offset + got, &out[base + got], n - got);
+    if (r <= 0) break;
+    got += static_cast<size_t>(r);
+  }
+  out.resize(base + got);
+  if (RunStats* stats = RunStats::Active()) stats->Add(StatCounter::kBytesRead, got);
+  return got;
+}
+
+// `head` is the start of the file when it was already read (--io-uring); the
+// rest, if any, is read from `file`.
+static Rendered RenderContent(SourceFile file, uint64_t size, std::string_view head, const WalkFile& f,
+                              const DumpOptions& opts, bool zero_copy, const ReserveFn& reserve) {
+  uint64_t shown = size;
+  if (opts.max_file_size && size > *opts.max_file_size) {
+    if (opts.oversize == OversizePolicy::kSkip) return Rendered{};
+    shown = *opts.max_file_size;
+  }
+
+  Rendered r;
+  RenderHeader(r.text, f);
+  const size_t body = r.text.size();
+  r.text += head;
+
+  // The sniffed head is kept as the start of the body, so text files are
+  // never read twice.
+  if (opts.skip_binary) {
+    size_t want = static_cast<size_t>(std::min<uint64_t>(size, kSniffBytes));
+    size_t have = r.text.size() - body;
+    if (have < want) have += AppendRange(r.text, file, have, want - have);
+    size_t got = std::min(have, want);
+    std::string_view sniffed(r.text.data() + body, got);
+    if (LooksBinary(sniffed, got >= size)) {
+      r.text.resize(body);
+      r.text += "[binary file omitted: " + std::to_string(size) + " bytes]\n```\n\n";
+      return r;
+    }
+    if (got < want) shown = got;  // the file shrank
+  }
+  if (r.text.size() - body > shown) r.text.resize(body + static_cast<size_t>(shown));
+  uint64_t loaded = r.text.size() - body;
+
+  // Anything bigger than one chunk is streamed by the writer rather than
+  // loaded, so peak memory doesn't depend on the largest file. The single
+  // byte needed to decide on a closing newline is read with a positional read.
+  if (loaded < shown && (zero_copy || shown > opts.chunk_size)) {
+    Splice splice;
+    splice.offset = loaded;
+    splice.size = shown - loaded;
+    char last = '\n';
+    if (file.ReadAt(shown - 1, &last, 1) != 1) last = '\n';
+    RenderFooter(splice.tail, last, shown, size);
+    splice.file = std::make_shared<const SourceFile>(std::move(file));
+    r.splice = std::move(splice);
+    return r;
+  }
+
+  if (loaded < shown) {
+    reserve(shown - loaded);
+    size_t want = static_cast<size_t>(shown - loaded);
+    if (AppendRange(r.text, file, loaded, want) < want) size = shown = r.text.size() - body;
+  }
+  char last = r.text.size() > body ? r.text.back() : '\n';
+  RenderFooter(r.text, last, shown, size);
+  return r;
+}
+
+// The size of the block RenderContent() would give a file of `size` bytes,
+// for the --budget pre-pass; 0 for a file it would leave out. Text is
+// assumed, which is also the upper bound for anything over a few dozen
+// bytes when --skip-binary turns out to omit it.
+static uint64_t EstimateBlockSize(const WalkFile& f, uint64_t size, const DumpOptions& opts) {
+  uint64_t shown = size;
+  if (opts.max_file_size && size > *opts.max_file_size) {
+    if (opts.oversize == OversizePolicy::kSkip) return 0;
+    shown = *opts.max_file_size;
+  }
+  std::string frame;
+  RenderHeader(frame, f);
+  RenderFooter(frame, 0, shown, size);
+  uint64_t text = frame.size() + shown;
+  if (opts.skip_binary) {
+    std::string binary;
+    RenderHeader(binary, f);
+    binary += "[binary file omitted: " + std::to_string(size) + " bytes]\n```\n\n";
+    text = std::max<uint64_t>(text, binary.size());
+  }
+  return text;
+}
+
+// Whether --skip-binary would omit the file at `path`, `size` bytes long.
+static bool SniffsBinary(const fs::path& path, uint64_t size) {
+  SourceFile file;
+  if (!file.Open(path)) return true;
+  std::string head;
+  const size_t want = static_cast<size_t>(std::min<uint64_t>(size, kSniffBytes));
+  const size_t got = AppendRange(head, file, 0, want);
+  return LooksBinary(head, got >= size);
+}
+
+// HashBytes() of a block as the pipeline writes it, for --index. Spliced
+// bodies are read back from their source.
+static uint64_t HashBlock(const Rendered& r) {
+  ContentHasher h;
+  h.Update(r.text);
+  if (r.splice) {
+    std::vector<char> buf(size_t{64} << 10);
+    for (uint64_t done = 0; done < r.splice->size;) {
+      size_t want = static_cast<size_t>(std::min<uint64_t>(r.splice->size - done, buf.size()));
+      long long got = r.splice->file->ReadAt(r.splice->offset + done, buf.data(), want);
+      if (got <= 0) break;
+      h.Update(buf.data(), static_cast<size_t>(got));
+      done += static_cast<uint64_t>(got);
+    }
+    h.Update(r.splice->tail);
+  }
+  return h.Digest();
+}
+
+uint64_t CacheFingerprint(const fs::path& root, const DumpOptions& opts) {
+  std::error_code ec;
+  fs::path root_abs = fs::weakly_canonical(root, ec);
+  if (ec) root_abs = root;
+  std::string key = "gitdump-cache-1\n" + root_abs.string() + "\n";
+  key += opts.skip_binary ? "b" : "-";
+  key += opts.oversize == OversizePolicy::kSkip ? "s" : "t";
+  if (opts.max_file_size) key += std::to_string(*opts.max_file_size);
+  uint64_t h = 14695981039346656037ull;  // FNV-1a
+  for (unsigned char c : key) {
+    h ^= c;
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
+// Lists the tracked files under `root_abs` straight from the index, in index
+// order. With --include-untracked a walk of the tree supplies the files the
+// index doesn't know about (minus ignored ones), merged in by path.
+static bool ListIndexFiles(const fs::path& root_abs, const IgnoreScopePtr& excludes, const DumpOptions& opts,
+                           const std::function<void(const WalkFile&)>& on_file) {
+  fs::path worktree, git_dir;
+  if (!FindGitDir(root_abs, worktree, git_dir)) {
+    std::cerr << "Error: '" << root_abs.string() << "' is not inside a git repository\n";
+    return false;
+  }
+  std::vector<IndexEntry> entries;
+  std::string error;
+  if (!ReadGitIndex(git_dir, entries, error)) {
+    std::cerr << "Error: " << error << "\n";
+    return false;
+  }
+
+  // Index paths are relative to the top of the worktree; keep the ones under
+  // the requested directory and make them relative to it.
+  std::string prefix = root_abs.lexically_relative(worktree).generic_string();
+  if (prefix == ".") prefix.clear();
+  if (!prefix.empty()) prefix += '/';
+  struct Tracked {
+    std::string_view rel;
+    const IndexEntry* entry;
+  };
+  std::vector<Tracked> tracked;
+  tracked.reserve(entries.size());
+  for (const IndexEntry& e : entries) {
+    if (StartsWith(e.path, prefix)) tracked.push_back({std::string_view(e.path).substr(prefix.size()), &e});
+  }
+
+  // Everything the index knows about counts as tracked, including paths it
+  // won't dump: skip-worktree files, and whole submodules and collapsed
+  // sparse directories, which are cut off at their root.
+  std::vector<WalkFile> untracked;
+  if (opts.include_untracked) {
+    std::unordered_set<std::string_view> known, owned_dirs;
+    known.reserve(tracked.size());
+    for (const Tracked& t : tracked) {
+      std::string_view rel = t.rel;
+      if (t.entry->kind == IndexEntryKind::kSparseDir && !rel.empty() && rel.back() == '/') rel.remove_suffix(1);
+      if (t.entry->kind == IndexEntryKind::kGitlink || t.entry->kind == IndexEntryKind::kSparseDir) {
+        owned_dirs.insert(rel);
+      } else {
+        known.insert(rel);
+      }
+    }
+    auto owned = [&](std::string_view rel) {
+      for (size_t slash = rel.find('/'); slash != std::string_view::npos; slash = rel.find('/', slash + 1)) {
+        if (owned_dirs.count(rel.substr(0, slash))) return true;
+      }
+      return false;
+    };
+    WalkTree(root_abs, excludes, opts.walk, [&](const WalkFile& f) {
+      if (known.count(f.rel) || (!owned_dirs.empty() && owned(f.rel))) return;
+      untracked.push_back(f);
+    });
+    std::sort(untracked.begin(), untracked.end(),
+              [](const WalkFile& x, const WalkFile& y) { return x.rel < y.rel; });
+  }
+
+  // For --watch: the index itself, and every directory holding a tracked
+  // file (index order keeps a directory's files together).
+  if (opts.walk.on_dir) {
+    opts.walk.on_dir(git_dir);
+    std::string_view last_parent;
+    bool first = true;
+    for (const Tracked& t : tracked) {
+      size_t slash = t.rel.rfind('/');
+      std::string_view parent = slash == std::string_view::npos ? std::string_view() : t.rel.substr(0, slash);
+      if (!first && parent == last_parent) continue;
+      first = false;
+      last_parent = parent;
+      opts.walk.on_dir(parent.empty() ? root_abs : root_abs / fs::path(std::string(parent)));
+    }
+  }
+
+  size_t u = 0;
+  for (const Tracked& t : tracked) {
+    for (; u < untracked.size() && untracked[u].rel < t.rel; ++u) on_file(untracked[u]);
+    if (t.entry->skip_worktree) continue;
+    if (t.entry->kind != IndexEntryKind::kFile && t.entry->kind != IndexEntryKind::kSymlink) continue;
+    if (opts.walk.filter && !opts.walk.filter->AdmitsPath(t.rel)) continue;
+    if (opts.walk.shard && !opts.walk.shard->Owns(t.rel)) continue;
+    WalkFile f;
+    f.rel = std::string(t.rel);
+    f.path = root_abs / fs::path(f.rel);
+    f.canonical = f.path;
+    if (t.entry->kind == IndexEntryKind::kSymlink) {
+      // Dumped like the walk does: through the link, when it leads to a file.
+      std::error_code ec;
+      if (!fs::is_regular_file(f.path, ec)) continue;
+      f.canonical = fs::weakly_canonical(f.path, ec);
+      if (ec) f.canonical = f.path;
+    }
+    on_file(f);
+  }
+  for (; u < untracked.size(); ++u) on_file(untracked[u]);
+  return true;
+}
+
+// How much of each file --io-uring reads ahead; most source files fit.
+constexpr size_t kReadAheadBytes = size_t{16} << 10;
+
+namespace {
+
+// --io-uring: a loading thread's ring, and what it read ahead for the batch
+// it is about to render.
+struct ReadAhead {
+  struct File {
+    const WalkFile* file = nullptr;
+    std::optional<Rendered> cached;  // the block was found in the cache
+    BatchRead read;                  // otherwise what the ring loaded
+  };
+
+  std::unique_ptr<BatchReader> reader;
+  bool tried = false;
+  std::vector<File> files;
+  size_t next = 0;
+
+  // The entry for `f`, which render asks for in batch order.
+  File* Take(const WalkFile& f) {
+    if (next < files.size() && files[next].file == &f) return &files[next++];
+    return nullptr;
+  }
+};
+
+}  // namespace
+
+static ReadAhead& ThreadReadAhead() {
+  thread_local ReadAhead ahead;
+  return ahead;
+}
+
+bool DumpTree(const fs::path& root, OutputSink& out, const fs::path& self_path, const DumpOptions& opts) {
+  std::unique_ptr<RunStats> stats;
+  if (opts.stats || opts.stats_json) {
+    stats = std::make_unique<RunStats>(opts.stats_top);
+    stats->Start();
+  }
+
+  std::error_code ec;
+  fs::path root_abs = fs::weakly_canonical(root, ec);
+  if (ec) root_abs = root;
+  IgnoreScopePtr excludes = opts.excludes ? *opts.excludes : LoadRepoExcludes(root_abs, opts.global_excludes);
+
+  // The binary may live inside the tree it is dumping; recognise it by
+  // identity from the fstat each file gets anyway.
+  FileId self_id;
+  bool have_self = FileIdOf(self_path, self_id);
+
+  out.set_copy_chunk(opts.chunk_size);
+  const bool zero_copy = out.SupportsZeroCopy();
+  // A file that hasn't changed since the last run is copied out of the
+  // previous output as it was written there. Files reached through a symlink
+  // are always rendered afresh, since their header depends on the link.
+  auto find_cached = [&](const WalkFile& f, Rendered& r) {
+    if (!opts.cache || f.canonical != f.path) return false;
+    FileStamp stamp;
+    uint64_t offset = 0, length = 0;
+    if (!StampOf(f.path, stamp) || !opts.cache->FindBlock(f.rel, stamp, offset, length)) return false;
+    r.splice = Splice{opts.cache->previous_output(), offset, length, {}};
+    r.stamp = stamp;
+    if (stats) stats->Add(StatCounter::kCacheHits, 1);
+    return true;
+  };
+
+  // --dedup: the repeats by path, each with the first copy in dump order.
+  // Filled in before the first file is submitted and only read after.
+  struct Copy {
+    const WalkFile* first;
+    uint64_t size;
+  };
+  std::unordered_map<std::string_view, Copy> copies;
+  auto find_copy = [&](const WalkFile& f, Rendered& r) {
+    if (copies.empty()) return false;
+    auto it = copies.find(f.rel);
+    if (it == copies.end()) return false;
+    r = RenderCopy(f, *it->second.first, it->second.size);
+    return true;
+  };
+
+  // Cache hits are sorted out first so the ring only loads what will be
+  // rendered. Files it couldn't load take the regular path in render.
+  PrepareFn prepare;
+  if (opts.io_uring) {
+    prepare = [&](const std::vector<const WalkFile*>& batch) {
+      ReadAhead& ahead = ThreadReadAhead();
+      if (!ahead.tried) {
+        ahead.tried = true;
+        ahead.reader = BatchReader::Create(opts.pipeline.batch, kReadAheadBytes);
+      }
+      ahead.files.clear();
+      ahead.next = 0;
+      if (!ahead.reader) return;
+      std::vector<const fs::path*> paths;
+      for (const WalkFile* f : batch) {
+        ReadAhead::File e;
+        e.file = f;
+        Rendered hit;
+        if (find_copy(*f, hit) || find_cached(*f, hit)) {
+          e.cached = std::move(hit);
+        } else {
+          paths.push_back(&f->path);
+        }
+        ahead.files.push_back(std::move(e));
+      }
+      std::vector<BatchRead> reads;
+      {
+        StatTimer timer(StatPhase::kRead);
+        ahead.reader->Read(paths, reads);
+      }
+      size_t k = 0;
+      for (ReadAhead::File& e : ahead.files) {
+        if (e.cached) continue;
+        e.read = std::move(reads[k++]);
+        if (stats) stats->Add(StatCounter::kBytesRead, e.read.head.size());
+      }
+    };
+  }
+
+  auto render_file = [&](const WalkFile& f, const ReserveFn& reserve) {
+    ReadAhead::File* ahead = opts.io_uring ? ThreadReadAhead().Take(f) : nullptr;
+    if (ahead && ahead->cached) return std::move(*ahead->cached);
+    Rendered hit;
+    if (!ahead && (find_copy(f, hit) || find_cached(f, hit))) return hit;
+
+    SourceFile file;
+    FileStamp stamp;
+    std::string head;
+    if (ahead && ahead->read.ok) {
+      file = std::move(ahead->read.file);
+      stamp = ahead->read.stamp;
+      head = std::move(ahead->read.head);
+    } else {
+      StatTimer timer(StatPhase::kOpen);
+      if (!file.Open(f.path)) {
+        // The index still lists files deleted from the worktree; git doesn't
+        // show those either.
+        std::error_code missing;
+        if (opts.source == FileSource::kIndex && !fs::exists(f.path, missing)) return Rendered{};
+        return RenderError(std::string("Failed to read file ") + f.path.string() + ": open error");
+      }
+      if (!file.Stamp(stamp)) stamp = FileStamp{};
+    }
+    if (have_self && stamp.id == self_id) return Rendered{};
+    StatTimer timer(StatPhase::kRead);
+    Rendered r = RenderContent(std::move(file), stamp.size, head, f, opts, zero_copy, reserve);
+    if (f.canonical == f.path && opts.cache_out && r.diagnostic.empty()) r.stamp = stamp;
+    return r;
+  };
+  auto render = [&](const WalkFile& f, const ReserveFn& reserve) {
+    if (!stats) return render_file(f, reserve);
+    const uint64_t start = StatTicks();
+    Rendered r = render_file(f, reserve);
+    stats->Add(StatCounter::kFiles, 1);
+    stats->Slow(false, StatTicks() - start, [&] { return f.rel; });
+    return r;
+  };
+  EmitFn on_emit;
+  if (opts.cache_out || opts.index_out) {
+    on_emit = [&](const WalkFile& f, const Rendered& r, uint64_t offset, uint64_t length) {
+      if (opts.cache_out && r.stamp) opts.cache_out->AddBlock(f.rel, *r.stamp, offset, length);
+      if (opts.index_out && length > 0) opts.index_out->AddBlock(f.rel, offset, length, HashBlock(r));
+    };
+  }
+  DumpPipeline pipeline(opts.pipeline, render, out, std::move(on_emit), std::move(prepare));
+
+  // With a budget or --dedup the files are only collected at first. A pass
+  // over their stat sizes then picks the ones that fit, and no other file is
+  // opened, and finds the repeats among those, hashing only the files whose
+  // size some other file shares.
+  std::vector<WalkFile> listed;
+  std::function<void(const WalkFile&)> submit = [&](const WalkFile& f) { pipeline.Submit(f); };
+  if (opts.budget || opts.dedup) submit = [&](const WalkFile& f) { listed.push_back(f); };
+  bool ok = true;
+  if (opts.source == FileSource::kIndex) {
+    ok = ListIndexFiles(root_abs, excludes, opts, submit);
+  } else {
+    WalkTree(root_abs, excludes, opts.walk, submit);
+  }
+  if (opts.budget || opts.dedup) {
+    struct Planned {
+      const WalkFile* file;
+      FileStamp stamp;
+      bool stamped;
+    };
+    std::vector<Planned> files;
+    files.reserve(listed.size());
+    for (const WalkFile& f : listed) {
+      Planned p{&f, FileStamp{}, false};
+      p.stamped = StampOf(f.path, p.stamp);
+      if (p.stamped && have_self && p.stamp.id == self_id) continue;
+      files.push_back(p);
+    }
+
+    // Repeats are budgeted at full size, since which copy comes first is
+    // only known once the selection is made.
+    if (opts.budget) {
+      std::vector<BudgetItem> items;
+      std::vector<Planned> fit;
+      for (const Planned& p : files) {
+        uint64_t cost = p.stamped ? EstimateBlockSize(*p.file, p.stamp.size, opts) : 0;
+        if (cost == 0) continue;
+        items.push_back(BudgetItem{p.file->rel, cost, p.stamp.mtime_ns});
+        fit.push_back(p);
+      }
+      std::vector<bool> keep = SelectWithinBudget(items, *opts.budget);
+      const size_t considered = fit.size();
+      uint64_t kept_bytes = 0;
+      files.clear();
+      for (size_t i = 0; i < fit.size(); ++i) {
+        if (!keep[i]) continue;
+        kept_bytes += items[i].cost;
+        files.push_back(fit[i]);
+      }
+      if (files.size() < considered) {
+        std::cerr << "Budget: dumping " << files.size() << " of " << considered << " files (about " << kept_bytes
+                  << " bytes, " << EstimateTokens(kept_bytes) << " tokens)\n";
+      }
+    }
+
+    if (opts.dedup) {
+      // Only files dumped whole take part: a skipped or truncated file's block
+      // doesn't hold the bytes a reference to it would stand for, and a
+      // skipped file has to stay out of the dump altogether.
+      std::vector<const Planned*> whole;
+      std::vector<DedupItem> items;
+      for (const Planned& p : files) {
+        if (!p.stamped || (opts.max_file_size && p.stamp.size > *opts.max_file_size)) continue;
+        whole.push_back(&p);
+        items.push_back(DedupItem{&p.file->path, p.stamp.size, p.stamped});
+      }
+      std::vector<size_t> first = FindDuplicates(items, opts.walk.jobs);
+      // Under --skip-binary the first copy of each group is sniffed; if it is
+      // omitted as binary, every copy is left to be omitted on its own.
+      std::unordered_map<size_t, bool> carries;
+      for (size_t i = 0; i < whole.size(); ++i) {
+        if (first[i] == SIZE_MAX) continue;
+        auto [it, fresh] = carries.emplace(first[i], true);
+        if (fresh && opts.skip_binary) it->second = !SniffsBinary(whole[first[i]]->file->path, whole[i]->stamp.size);
+        if (it->second) copies.emplace(whole[i]->file->rel, Copy{whole[first[i]]->file, whole[i]->stamp.size});
+      }
+    }
+    for (const Planned& p : files) pipeline.Submit(*p.file);
+  }
+  pipeline.Finish();
+  if (stats) {
+    stats->Add(StatCounter::kBytesWritten, out.position());
+    stats->Stop();
+    if (opts.stats) std::cerr << stats->Report();
+    if (opts.stats_json && opts.stats_json->empty()) {
+      std::cerr << stats->ReportJson();
+    } else if (opts.stats_json) {
+      std::ofstream json(*opts.stats_json, std::ios::binary | std::ios::trunc);
+      json << stats->ReportJson();
+      if (!json) std::cerr << "Warning: could not write stats to '" << *opts.stats_json << "'\n";
+    }
+  }
+  return ok;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+
+#include "budget.h"
+#include "dumpindex.h"
+#include "output.h"
+#include "pipeline.h"
+#include "scancache.h"
+#include "walk.h"
+
+// What to do with files above --max-file-size.
+enum class OversizePolicy { kTruncate, kSkip };
+
+// Where the list of files comes from.
+enum class FileSource { kWalk, kIndex };
+
+struct DumpOptions {
+  WalkOptions walk;
+  PipelineOptions pipeline;
+  size_t chunk_size = kDefaultCopyChunk;
+  std::optional<uint64_t> max_file_size;
+  OversizePolicy oversize = OversizePolicy::kTruncate;
+  bool skip_binary = false;
+  bool global_excludes = true;
+  std::optional<IgnoreScopePtr> excludes;  // rules above the tree, instead of loading them
+  FileSource source = FileSource::kWalk;
+  bool include_untracked = false;
+  const ScanCache* cache = nullptr;      // blocks reusable from the previous output
+  ScanCacheWriter* cache_out = nullptr;  // records this run's blocks
+  bool io_uring = false;                 // read files ahead in batches (Linux)
+  bool stats = false;                    // report where the time went on stderr
+  std::optional<std::string> stats_json;  // the same as JSON, to a file or "" for stderr
+  size_t stats_top = 10;                 // slowest files, directories and patterns listed
+  std::optional<BudgetOptions> budget;   // only dump what fits
+  bool dedup = false;                    // repeats become references to the first copy
+  DumpIndexWriter* index_out = nullptr;  // records every block for --index
+};
+
+// Dumps every file under `root` that the ignore rules let through into
+// `out`, one fenced block per file, and flushes it. `self_path`, if it names
+// a file in the tree (the running binary), is left out; it may be empty.
+// Problems with single files are reported on stderr and in the dump; false
+// means the file list itself couldn't be had.
+bool DumpTree(const std::filesystem::path& root, OutputSink& out, const std::filesystem::path& self_path,
+              const DumpOptions& opts);
+
+// Everything that shapes a file's block: a cache saved under different
+// options describes a different dump.
+uint64_t CacheFingerprint(const std::filesystem::path& root, const DumpOptions& opts);
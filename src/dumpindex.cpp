@@ -0,0 +1,183 @@
+#include "dumpindex.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <system_error>
+#include <utility>
+
+namespace fs = std::filesystem;
+
+// On-disk layout, native byte order: a header, the block table sorted by
+// path, the frame table sorted by offset, then one blob holding every path.
+
+namespace {
+
+constexpr char kMagic[4] = {'G', 'D', 'I', 'X'};
+constexpr uint32_t kVersion = 1;
+
+template <typename T>
+T ReadRecord(const char* table, uint64_t i) {
+  T rec;
+  std::memcpy(&rec, table + i * sizeof(T), sizeof(T));
+  return rec;
+}
+
+}  // namespace
+
+struct DumpIndex::Header {
+  char magic[4];
+  uint32_t version;
+  uint32_t codec;
+  uint32_t reserved;
+  uint64_t dump_size;
+  uint64_t block_count;
+  uint64_t frame_count;
+  uint64_t strings_size;
+};
+
+struct DumpIndex::BlockRecord {
+  uint64_t path_off;
+  uint32_t path_len;
+  uint32_t reserved;
+  uint64_t offset;
+  uint64_t length;
+  uint64_t hash;
+};
+
+bool DumpIndex::Load(const fs::path& file, uint64_t dump_size, std::string& error) {
+  if (!map_.Open(file)) {
+    error = "cannot read index '" + file.string() + "'";
+    return false;
+  }
+  const char* data = map_.data();
+  const size_t size = map_.size();
+  Header h{};
+  if (size >= sizeof(Header)) std::memcpy(&h, data, sizeof(h));
+  if (size < sizeof(Header) || std::memcmp(h.magic, kMagic, sizeof(kMagic)) != 0 || h.version != kVersion ||
+      h.codec > static_cast<uint32_t>(Codec::kZstd)) {
+    error = "'" + file.string() + "' is not a gitdump index";
+    return false;
+  }
+  // Overflow-safe size check: every count is bounded by the file size first.
+  if (h.block_count > size || h.frame_count > size || h.strings_size > size ||
+      sizeof(Header) + h.block_count * sizeof(BlockRecord) + h.frame_count * sizeof(Frame) + h.strings_size !=
+          size) {
+    error = "index '" + file.string() + "' is corrupt";
+    return false;
+  }
+  if (h.dump_size != dump_size) {
+    error = "index '" + file.string() + "' was written for another version of the dump";
+    return false;
+  }
+
+  codec_ = static_cast<Codec>(h.codec);
+  blocks_ = data + sizeof(Header);
+  frames_ = blocks_ + h.block_count * sizeof(BlockRecord);
+  strings_ = frames_ + h.frame_count * sizeof(Frame);
+  block_count_ = h.block_count;
+  frame_count_ = h.frame_count;
+  strings_size_ = h.strings_size;
+  return true;
+}
+
+std::string_view DumpIndex::String(uint64_t off, uint32_t len) const {
+  if (off > strings_size_ || len > strings_size_ - off) return {};
+  return std::string_view(strings_ + off, len);
+}
+
+bool DumpIndex::Find(std::string_view rel, Block& out) const {
+  uint64_t lo = 0, hi = block_count_;
+  while (lo < hi) {
+    uint64_t mid = lo + (hi - lo) / 2;
+    BlockRecord rec = ReadRecord<BlockRecord>(blocks_, mid);
+    std::string_view path = String(rec.path_off, rec.path_len);
+    if (path < rel) {
+      lo = mid + 1;
+    } else if (rel < path) {
+      hi = mid;
+    } else {
+      out = Block{rec.offset, rec.length, rec.hash};
+      return true;
+    }
+  }
+  return false;
+}
+
+std::string_view DumpIndex::BlockAt(uint64_t i, Block& out) const {
+  BlockRecord rec = ReadRecord<BlockRecord>(blocks_, i);
+  out = Block{rec.offset, rec.length, rec.hash};
+  return String(rec.path_off, rec.path_len);
+}
+
+bool DumpIndex::FrameAt(uint64_t raw_offset, Frame& out) const {
+  // The last frame starting at or before the offset.
+  uint64_t lo = 0, hi = frame_count_;
+  while (lo < hi) {
+    uint64_t mid = lo + (hi - lo) / 2;
+    if (ReadRecord<Frame>(frames_, mid).raw_offset <= raw_offset) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo == 0) return false;
+  out = ReadRecord<Frame>(frames_, lo - 1);
+  return true;
+}
+
+void DumpIndexWriter::AddBlock(std::string rel, uint64_t offset, uint64_t length, uint64_t hash) {
+  blocks_.push_back(Entry{std::move(rel), DumpIndex::Block{offset, length, hash}});
+}
+
+void DumpIndexWriter::AddFrame(uint64_t raw_offset, uint64_t packed_offset) {
+  frames_.push_back(DumpIndex::Frame{raw_offset, packed_offset});
+}
+
+std::string DumpIndexWriter::Serialize(DumpIndex::Codec codec, uint64_t dump_size) {
+  std::sort(blocks_.begin(), blocks_.end(), [](const Entry& a, const Entry& b) { return a.rel < b.rel; });
+
+  std::string strings;
+  std::vector<DumpIndex::BlockRecord> blocks;
+  blocks.reserve(blocks_.size());
+  for (size_t i = 0; i < blocks_.size(); ++i) {
+    const Entry& e = blocks_[i];
+    if (i > 0 && e.rel == blocks_[i - 1].rel) continue;
+    blocks.push_back({strings.size(), static_cast<uint32_t>(e.rel.size()), 0, e.block.offset, e.block.length,
+                      e.block.hash});
+    strings += e.rel;
+  }
+
+  DumpIndex::Header h{};
+  std::memcpy(h.magic, kMagic, sizeof(kMagic));
+  h.version = kVersion;
+  h.codec = static_cast<uint32_t>(codec);
+  h.dump_size = dump_size;
+  h.block_count = blocks.size();
+  h.frame_count = frames_.size();
+  h.strings_size = strings.size();
+
+  std::string image;
+  auto append = [&](const void* p, size_t n) { image.append(static_cast<const char*>(p), n); };
+  image.reserve(sizeof(h) + blocks.size() * sizeof(blocks[0]) + frames_.size() * sizeof(frames_[0]) +
+                strings.size());
+  append(&h, sizeof(h));
+  append(blocks.data(), blocks.size() * sizeof(blocks[0]));
+  append(frames_.data(), frames_.size() * sizeof(frames_[0]));
+  image += strings;
+  return image;
+}
+
+bool DumpIndexWriter::Save(const fs::path& file, const std::string& image) {
+  fs::path tmp = file;
+  tmp += ".tmp";
+  {
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    if (!out) return false;
+    out.write(image.data(), static_cast<std::streamsize>(image.size()));
+    if (!out.flush()) return false;
+  }
+  std::error_code ec;
+  fs::rename(tmp, file, ec);
+  return !ec;
+}
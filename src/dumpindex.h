@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "fileio.h"
+
+// Sidecar of a dump (--index), mapped read-only and searched in place:
+//  - every file's block, sorted by path: where it sits in the uncompressed
+//    dump, how long it is and a hash of its bytes;
+//  - for a compressed dump, where each frame starts in the uncompressed and
+//    in the compressed stream, sorted by both, so a block is found by
+//    decompressing from the frame holding its first byte.
+// The index names the size of the dump it describes; one that has changed
+// since doesn't load.
+class DumpIndex {
+ public:
+  enum class Codec : uint32_t { kNone, kGzip, kZstd };
+
+  struct Block {
+    uint64_t offset = 0;
+    uint64_t length = 0;
+    uint64_t hash = 0;  // HashBytes() of the block
+  };
+
+  struct Frame {
+    uint64_t raw_offset = 0;
+    uint64_t packed_offset = 0;
+  };
+
+  DumpIndex() = default;
+  DumpIndex(const DumpIndex&) = delete;
+  DumpIndex& operator=(const DumpIndex&) = delete;
+
+  // Fails on a missing or corrupt index, or one saved for a dump of another
+  // size than `dump_size`; `error` says which.
+  bool Load(const std::filesystem::path& file, uint64_t dump_size, std::string& error);
+
+  Codec codec() const { return codec_; }
+
+  // Binary search on the path.
+  bool Find(std::string_view rel, Block& out) const;
+
+  // The blocks in path order, for reading a whole dump back.
+  uint64_t block_count() const { return block_count_; }
+  std::string_view BlockAt(uint64_t i, Block& out) const;
+
+  // The frame a block starting at `raw_offset` begins in.
+  bool FrameAt(uint64_t raw_offset, Frame& out) const;
+
+ private:
+  friend class DumpIndexWriter;
+
+  struct Header;
+  struct BlockRecord;
+
+  std::string_view String(uint64_t off, uint32_t len) const;
+
+  MappedFile map_;
+  Codec codec_ = Codec::kNone;
+  const char* blocks_ = nullptr;
+  const char* frames_ = nullptr;
+  const char* strings_ = nullptr;
+  uint64_t block_count_ = 0;
+  uint64_t frame_count_ = 0;
+  uint64_t strings_size_ = 0;
+};
+
+// Collects the blocks and frames of the dump being written, on the thread
+// that writes it.
+class DumpIndexWriter {
+ public:
+  void AddBlock(std::string rel, uint64_t offset, uint64_t length, uint64_t hash);
+  void AddFrame(uint64_t raw_offset, uint64_t packed_offset);
+
+  std::string Serialize(DumpIndex::Codec codec, uint64_t dump_size);
+
+  // Writes the image next to `file` and renames it over, so readers never
+  // see half an index.
+  static bool Save(const std::filesystem::path& file, const std::string& image);
+
+ private:
+  struct Entry {
+    std::string rel;
+    DumpIndex::Block block;
+  };
+
+  std::vector<Entry> blocks_;
+  std::vector<DumpIndex::Frame> frames_;
+};
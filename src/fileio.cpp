@@ -0,0 +1,277 @@
+#include "fileio.h"
+
+#include <cstdint>
+#include <utility>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+SourceFile::~SourceFile() {
+  Close();
+}
+
+MappedFile::~MappedFile() {
+  Close();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+    : data_(std::exchange(other.data_, nullptr)), size_(std::exchange(other.size_, 0)) {}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+  if (this != &other) {
+    Close();
+    data_ = std::exchange(other.data_, nullptr);
+    size_ = std::exchange(other.size_, 0);
+  }
+  return *this;
+}
+
+#if defined(_WIN32)
+
+SourceFile::SourceFile(SourceFile&& other) noexcept
+    : handle_(std::exchange(other.handle_, nullptr)) {}
+
+SourceFile& SourceFile::operator=(SourceFile&& other) noexcept {
+  if (this != &other) {
+    Close();
+    handle_ = std::exchange(other.handle_, nullptr);
+  }
+  return *this;
+}
+
+bool SourceFile::Open(const std::filesystem::path& p) {
+  Close();
+  HANDLE h = CreateFileW(p.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                         nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (h == INVALID_HANDLE_VALUE) return false;
+  handle_ = h;
+  return true;
+}
+
+void SourceFile::Close() {
+  if (handle_) CloseHandle(static_cast<HANDLE>(handle_));
+  handle_ = nullptr;
+}
+
+bool SourceFile::IsOpen() const {
+  return handle_ != nullptr;
+}
+
+bool SourceFile::Size(uint64_t& size) const {
+  LARGE_INTEGER li;
+  if (!handle_ || !GetFileSizeEx(static_cast<HANDLE>(handle_), &li)) return false;
+  size = static_cast<uint64_t>(li.QuadPart);
+  return true;
+}
+
+bool SourceFile::Info(uint64_t& size, FileId& id) const {
+  BY_HANDLE_FILE_INFORMATION info;
+  if (!handle_ || !GetFileInformationByHandle(static_cast<HANDLE>(handle_), &info)) return false;
+  size = (static_cast<uint64_t>(info.nFileSizeHigh) << 32) | info.nFileSizeLow;
+  id.dev = info.dwVolumeSerialNumber;
+  id.ino = (static_cast<uint64_t>(info.nFileIndexHigh) << 32) | info.nFileIndexLow;
+  return true;
+}
+
+namespace {
+
+// FILETIME counts 100 ns ticks from 1601; shift it to the Unix epoch.
+int64_t FileTimeToUnixNs(const FILETIME& ft) {
+  constexpr int64_t kEpochDelta = 116444736000000000LL;
+  int64_t ticks = static_cast<int64_t>((static_cast<uint64_t>(ft.dwHighDateTime) << 32) | ft.dwLowDateTime);
+  return (ticks - kEpochDelta) * 100;
+}
+
+}  // namespace
+
+bool SourceFile::Stamp(FileStamp& stamp) const {
+  BY_HANDLE_FILE_INFORMATION info;
+  if (!handle_ || !GetFileInformationByHandle(static_cast<HANDLE>(handle_), &info)) return false;
+  stamp.size = (static_cast<uint64_t>(info.nFileSizeHigh) << 32) | info.nFileSizeLow;
+  stamp.mtime_ns = FileTimeToUnixNs(info.ftLastWriteTime);
+  stamp.id.dev = info.dwVolumeSerialNumber;
+  stamp.id.ino = (static_cast<uint64_t>(info.nFileIndexHigh) << 32) | info.nFileIndexLow;
+  return true;
+}
+
+bool StampOf(const std::filesystem::path& p, FileStamp& stamp) {
+  WIN32_FILE_ATTRIBUTE_DATA data;
+  if (!GetFileAttributesExW(p.c_str(), GetFileExInfoStandard, &data)) return false;
+  stamp.size = (static_cast<uint64_t>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+  stamp.mtime_ns = FileTimeToUnixNs(data.ftLastWriteTime);
+  stamp.id = FileId{};
+  return true;
+}
+
+bool FileIdOf(const std::filesystem::path& p, FileId& id) {
+  SourceFile f;
+  uint64_t size = 0;
+  return f.Open(p) && f.Info(size, id);
+}
+
+long long SourceFile::ReadAt(uint64_t offset, char* buf, size_t n) const {
+  if (!handle_) return -1;
+  OVERLAPPED ov = {};
+  ov.Offset = static_cast<DWORD>(offset & 0xffffffffu);
+  ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+  DWORD want = n > 0x40000000u ? 0x40000000u : static_cast<DWORD>(n);
+  DWORD got = 0;
+  if (!ReadFile(static_cast<HANDLE>(handle_), buf, want, &got, &ov)) {
+    return GetLastError() == ERROR_HANDLE_EOF ? 0 : -1;
+  }
+  return static_cast<long long>(got);
+}
+
+bool MappedFile::Open(const std::filesystem::path& p) {
+  Close();
+  SourceFile file;
+  uint64_t size = 0;
+  if (!file.Open(p) || !file.Size(size)) return false;
+  if (size == 0) return true;
+  if (size > static_cast<uint64_t>(SIZE_MAX)) return false;
+  HANDLE mapping = CreateFileMappingW(static_cast<HANDLE>(file.handle()), nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (!mapping) return false;
+  // The view keeps the mapping (and the file) alive on its own.
+  void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(mapping);
+  if (!view) return false;
+  data_ = static_cast<const char*>(view);
+  size_ = static_cast<size_t>(size);
+  return true;
+}
+
+void MappedFile::Close() {
+  if (data_) UnmapViewOfFile(data_);
+  data_ = nullptr;
+  size_ = 0;
+}
+
+#else
+
+SourceFile::SourceFile(SourceFile&& other) noexcept
+    : fd_(std::exchange(other.fd_, -1)) {}
+
+SourceFile& SourceFile::operator=(SourceFile&& other) noexcept {
+  if (this != &other) {
+    Close();
+    fd_ = std::exchange(other.fd_, -1);
+  }
+  return *this;
+}
+
+bool SourceFile::Open(const std::filesystem::path& p) {
+  Close();
+  int flags = O_RDONLY;
+#if defined(O_CLOEXEC)
+  flags |= O_CLOEXEC;
+#endif
+  fd_ = ::open(p.c_str(), flags);
+  return fd_ >= 0;
+}
+
+void SourceFile::Close() {
+  if (fd_ >= 0) ::close(fd_);
+  fd_ = -1;
+}
+
+void SourceFile::Adopt(int fd) {
+  Close();
+  fd_ = fd;
+}
+
+bool SourceFile::IsOpen() const {
+  return fd_ >= 0;
+}
+
+bool SourceFile::Size(uint64_t& size) const {
+  struct stat st;
+  if (fd_ < 0 || ::fstat(fd_, &st) != 0) return false;
+  size = static_cast<uint64_t>(st.st_size);
+  return true;
+}
+
+bool SourceFile::Info(uint64_t& size, FileId& id) const {
+  struct stat st;
+  if (fd_ < 0 || ::fstat(fd_, &st) != 0) return false;
+  size = static_cast<uint64_t>(st.st_size);
+  id.dev = static_cast<uint64_t>(st.st_dev);
+  id.ino = static_cast<uint64_t>(st.st_ino);
+  return true;
+}
+
+namespace {
+
+void FillStamp(const struct stat& st, FileStamp& stamp) {
+  stamp.size = static_cast<uint64_t>(st.st_size);
+#if defined(__APPLE__)
+  stamp.mtime_ns = static_cast<int64_t>(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+  stamp.mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+  stamp.id.dev = static_cast<uint64_t>(st.st_dev);
+  stamp.id.ino = static_cast<uint64_t>(st.st_ino);
+}
+
+}  // namespace
+
+bool SourceFile::Stamp(FileStamp& stamp) const {
+  struct stat st;
+  if (fd_ < 0 || ::fstat(fd_, &st) != 0) return false;
+  FillStamp(st, stamp);
+  return true;
+}
+
+bool StampOf(const std::filesystem::path& p, FileStamp& stamp) {
+  struct stat st;
+  if (::stat(p.c_str(), &st) != 0) return false;
+  FillStamp(st, stamp);
+  return true;
+}
+
+bool FileIdOf(const std::filesystem::path& p, FileId& id) {
+  struct stat st;
+  if (::stat(p.c_str(), &st) != 0) return false;
+  id.dev = static_cast<uint64_t>(st.st_dev);
+  id.ino = static_cast<uint64_t>(st.st_ino);
+  return true;
+}
+
+long long SourceFile::ReadAt(uint64_t offset, char* buf, size_t n) const {
+  if (fd_ < 0) return -1;
+  for (;;) {
+    ssize_t got = ::pread(fd_, buf, n, static_cast<off_t>(offset));
+    if (got < 0 && errno == EINTR) continue;
+    return static_cast<long long>(got);
+  }
+}
+
+bool MappedFile::Open(const std::filesystem::path& p) {
+  Close();
+  SourceFile file;
+  uint64_t size = 0;
+  if (!file.Open(p) || !file.Size(size)) return false;
+  if (size == 0) return true;
+  if (size > static_cast<uint64_t>(SIZE_MAX)) return false;
+  void* addr = ::mmap(nullptr, static_cast<size_t>(size), PROT_READ, MAP_PRIVATE, file.fd(), 0);
+  if (addr == MAP_FAILED) return false;
+  data_ = static_cast<const char*>(addr);
+  size_ = static_cast<size_t>(size);
+  return true;
+}
+
+void MappedFile::Close() {
+  if (data_) ::munmap(const_cast<char*>(data_), size_);
+  data_ = nullptr;
+  size_ = 0;
+}
+
+#endif
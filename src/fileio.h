@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+// Identity of a file independent of the path used to reach it: device and
+// inode on POSIX, volume serial and file index on Windows.
+struct FileId {
+  uint64_t dev = 0;
+  uint64_t ino = 0;
+
+  bool operator==(const FileId& o) const { return dev == o.dev && ino == o.ino; }
+  bool operator!=(const FileId& o) const { return !(*this == o); }
+};
+
+// Looks up the identity of `p` without opening it for reading.
+bool FileIdOf(const std::filesystem::path& p, FileId& id);
+
+// What a file looked like when it was last seen, for deciding whether work
+// done on it can be reused. Modification times are nanoseconds since the Unix
+// epoch on every platform.
+struct FileStamp {
+  uint64_t size = 0;
+  int64_t mtime_ns = 0;
+  FileId id;
+
+  bool operator==(const FileStamp& o) const { return size == o.size && mtime_ns == o.mtime_ns && id == o.id; }
+  bool operator!=(const FileStamp& o) const { return !(*this == o); }
+};
+
+// Stamps `p` (following symlinks) without opening it. On Windows the
+// identity is left zero, since it is only available from an open handle.
+bool StampOf(const std::filesystem::path& p, FileStamp& stamp);
+
+// Read-only handle on a file being dumped: a file descriptor on POSIX, a
+// HANDLE on Windows. Move-only; closes on destruction.
+class SourceFile {
+ public:
+  SourceFile() = default;
+  ~SourceFile();
+  SourceFile(SourceFile&& other) noexcept;
+  SourceFile& operator=(SourceFile&& other) noexcept;
+  SourceFile(const SourceFile&) = delete;
+  SourceFile& operator=(const SourceFile&) = delete;
+
+  bool Open(const std::filesystem::path& p);
+  void Close();
+  bool IsOpen() const;
+
+  bool Size(uint64_t& size) const;
+
+  // Size and identity from a single fstat.
+  bool Info(uint64_t& size, FileId& id) const;
+
+  // Size, modification time and identity from a single fstat.
+  bool Stamp(FileStamp& stamp) const;
+
+  // Positional read that leaves the file offset alone. Returns the number of
+  // bytes read, 0 at end of file, or -1 on error.
+  long long ReadAt(uint64_t offset, char* buf, size_t n) const;
+
+#if defined(_WIN32)
+  void* handle() const { return handle_; }
+#else
+  int fd() const { return fd_; }
+
+  // Takes ownership of a descriptor opened elsewhere.
+  void Adopt(int fd);
+#endif
+
+ private:
+#if defined(_WIN32)
+  void* handle_ = nullptr;
+#else
+  int fd_ = -1;
+#endif
+};
+
+// Read-only mapping of a whole file, for formats that are parsed in place.
+// Move-only; unmaps on destruction. An empty file maps to an empty view.
+class MappedFile {
+ public:
+  MappedFile() = default;
+  ~MappedFile();
+  MappedFile(MappedFile&& other) noexcept;
+  MappedFile& operator=(MappedFile&& other) noexcept;
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  bool Open(const std::filesystem::path& p);
+  void Close();
+
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+};
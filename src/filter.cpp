@@ -0,0 +1,77 @@
+#include "filter.h"
+
+#include <utility>
+
+#include "strutil.h"
+
+namespace {
+
+GitignoreSpec Compile(const std::vector<std::string>& globs) {
+  std::vector<Pattern> patterns;
+  for (const std::string& g : globs) {
+    if (auto p = ParseGitignoreLine(g)) patterns.push_back(std::move(*p));
+  }
+  return MakeGitignoreSpec(std::move(patterns));
+}
+
+// A positive match puts a path inside the includes, a negated one takes it
+// out, and no match leaves it where its parent is.
+bool Within(const GitignoreSpec& spec, std::string_view rel, bool is_dir, bool within) {
+  switch (Evaluate(spec, rel, is_dir)) {
+    case MatchResult::kIgnored: return true;
+    case MatchResult::kIncluded: return false;
+    case MatchResult::kNone: break;
+  }
+  return within;
+}
+
+}  // namespace
+
+void PathFilter::AddInclude(std::string glob) {
+  includes_.push_back(std::move(glob));
+}
+
+void PathFilter::AddExclude(std::string glob) {
+  excludes_.push_back(std::move(glob));
+}
+
+void PathFilter::AddExtensions(std::string_view list) {
+  while (!list.empty()) {
+    size_t comma = list.find(',');
+    std::string ext = Trim(std::string(list.substr(0, comma)));
+    list.remove_prefix(comma == std::string_view::npos ? list.size() : comma + 1);
+    while (StartsWith(ext, ".")) ext.erase(0, 1);
+    if (!ext.empty()) extensions_.push_back(std::move(ext));
+  }
+}
+
+void PathFilter::Build() {
+  include_spec_ = Compile(includes_);
+  std::vector<std::string> ext_globs;
+  for (const std::string& e : extensions_) ext_globs.push_back("*." + e);
+  ext_spec_ = Compile(ext_globs);
+  exclude_ = PushScope(nullptr, "", Compile(excludes_));
+}
+
+bool PathFilter::AdmitsDir(std::string_view rel, bool within, bool& within_below) const {
+  if (exclude_ &&
+      (IsIgnored(exclude_.get(), rel, true) || ClassifySubtree(exclude_.get(), rel) == SubtreeVerdict::kSkip)) {
+    return false;
+  }
+  within_below = includes_.empty() || Within(include_spec_, rel, true, within);
+  return within_below || CanMatchBelow(include_spec_, rel);
+}
+
+bool PathFilter::AdmitsFile(std::string_view rel, bool within) const {
+  if (exclude_ && IsIgnored(exclude_.get(), rel, false)) return false;
+  if (!includes_.empty() && !Within(include_spec_, rel, false, within)) return false;
+  return extensions_.empty() || Evaluate(ext_spec_, rel, false) == MatchResult::kIgnored;
+}
+
+bool PathFilter::AdmitsPath(std::string_view rel) const {
+  bool within = IncludesAll();
+  for (size_t slash = rel.find('/'); slash != std::string_view::npos; slash = rel.find('/', slash + 1)) {
+    if (!AdmitsDir(rel.substr(0, slash), within, within)) return false;
+  }
+  return AdmitsFile(rel, within);
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "gitignore.h"
+
+// --include, --exclude and --ext: which of the files the ignore rules let
+// through are dumped. Globs use gitignore syntax relative to the root and
+// are compiled into the same matchers, so they are cheap enough to check
+// during the walk, before anything is opened:
+//  - a path matching an --exclude is left out, and so is everything below an
+//    excluded directory;
+//  - with --include, a file is kept only if it, or a directory above it,
+//    matches one; directories no include could reach into aren't listed;
+//  - with --ext, a file is kept only if it has one of the extensions.
+// A file must pass every kind of filter it was given.
+class PathFilter {
+ public:
+  void AddInclude(std::string glob);
+  void AddExclude(std::string glob);
+  // A comma-separated list; leading dots are optional.
+  void AddExtensions(std::string_view list);
+
+  // Compiles what was added; the filter is used only after this.
+  void Build();
+
+  bool empty() const { return includes_.empty() && excludes_.empty() && extensions_.empty(); }
+
+  const std::vector<std::string>& includes() const { return includes_; }
+  const std::vector<std::string>& excludes() const { return excludes_; }
+  const std::vector<std::string>& extensions() const { return extensions_; }
+
+  // Whether the walk's root is inside the includes, where every file counts
+  // as included until a negated include says otherwise.
+  bool IncludesAll() const { return includes_.empty(); }
+
+  // For the walk, one directory level at a time. `within` says whether the
+  // parent directory is inside the includes; `within_below` is set to
+  // whether `rel` is.
+  bool AdmitsDir(std::string_view rel, bool within, bool& within_below) const;
+  bool AdmitsFile(std::string_view rel, bool within) const;
+
+  // For a file that didn't come from a walk: checks every directory above
+  // it as well.
+  bool AdmitsPath(std::string_view rel) const;
+
+ private:
+  std::vector<std::string> includes_, excludes_, extensions_;
+  GitignoreSpec include_spec_, ext_spec_;
+  IgnoreScopePtr exclude_;
+};
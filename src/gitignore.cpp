@@ -0,0 +1,578 @@
+#include "gitignore.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <functional>
+#include <fstream>
+#include <utility>
+
+#include "bytescan.h"
+#include "stats.h"
+#include "strutil.h"
+
+namespace fs = std::filesystem;
+
+void PathSegments::Assign(std::string_view path) {
+  parts.clear();
+  if (!path.empty() && path.back() == '/') path.remove_suffix(1);
+  SplitBytes(path, '/', parts);
+}
+
+// The literal a segment stands for once its escapes are resolved, or nothing
+// when an unescaped '*', '?' or '[' leaves wildcards in it.
+static std::optional<std::string> Unescape(std::string_view s) {
+  std::string text;
+  for (size_t i = 0; i < s.size(); ++i) {
+    if (s[i] == '*' || s[i] == '?' || s[i] == '[') return std::nullopt;
+    if (s[i] == '\\' && i + 1 < s.size()) ++i;
+    text.push_back(s[i]);
+  }
+  return text;
+}
+
+static Segment CompileSegment(std::string_view s) {
+  Segment seg;
+  if (s == "**") {
+    seg.kind = SegmentKind::kAnyPath;
+    return seg;
+  }
+  size_t wild = s.find_first_of("*?[\\");
+  if (wild == std::string_view::npos) {
+    seg.kind = SegmentKind::kLiteral;
+    seg.text = std::string(s);
+  } else if (s.find_first_not_of('*') == std::string_view::npos) {
+    seg.kind = SegmentKind::kAny;
+  } else if (s.find_first_of("?[\\") == std::string_view::npos && s.find('*', wild + 1) == std::string_view::npos) {
+    if (wild == s.size() - 1) {
+      seg.kind = SegmentKind::kPrefix;
+      seg.text = std::string(s.substr(0, wild));
+    } else if (wild == 0) {
+      seg.kind = SegmentKind::kSuffix;
+      seg.text = std::string(s.substr(1));
+    } else {
+      seg.kind = SegmentKind::kGlob;
+      seg.text = std::string(s);
+    }
+  } else if (auto text = Unescape(s)) {
+    seg.kind = SegmentKind::kLiteral;
+    seg.text = std::move(*text);
+  } else {
+    seg.kind = SegmentKind::kGlob;
+    seg.text = std::string(s);
+  }
+  return seg;
+}
+
+std::vector<Segment> CompilePattern(std::string_view pattern) {
+  std::vector<std::string_view> parts;
+  SplitBytes(pattern, '/', parts);
+  std::vector<Segment> out;
+  out.reserve(parts.size() + 1);
+  for (std::string_view part : parts) out.push_back(CompileSegment(part));
+  // "dir/**" matches everything inside dir but not dir itself, so a final
+  // "**" has to take at least one segment: it runs as "*/**".
+  if (out.size() > 1 && out.back().kind == SegmentKind::kAnyPath) {
+    out.insert(out.end() - 1, Segment{SegmentKind::kAny, {}});
+  }
+  return out;
+}
+
+static bool InPosixClass(std::string_view name, unsigned char c) {
+  if (name == "alnum") return std::isalnum(c);
+  if (name == "alpha") return std::isalpha(c);
+  if (name == "blank") return c == ' ' || c == '\t';
+  if (name == "cntrl") return std::iscntrl(c);
+  if (name == "digit") return std::isdigit(c);
+  if (name == "graph") return std::isgraph(c);
+  if (name == "lower") return std::islower(c);
+  if (name == "print") return std::isprint(c);
+  if (name == "punct") return std::ispunct(c);
+  if (name == "space") return std::isspace(c);
+  if (name == "upper") return std::isupper(c);
+  if (name == "xdigit") return std::isxdigit(c);
+  return false;
+}
+
+// Matches `c` against the bracket expression opening at pat[pi] and sets
+// `next` past its ']'. Ranges, '!' or '^' negation, a leading ']', escapes
+// and [:name:] classes are read as git does; an unclosed '[' matches nothing.
+static bool ClassMatch(std::string_view pat, size_t pi, char ch, size_t& next) {
+  const unsigned char c = static_cast<unsigned char>(ch);
+  size_t i = pi + 1;
+  const bool negate = i < pat.size() && (pat[i] == '!' || pat[i] == '^');
+  if (negate) ++i;
+  bool matched = false;
+  for (bool first = true;; first = false) {
+    if (i >= pat.size()) return false;
+    if (pat[i] == ']' && !first) break;
+    if (pat[i] == '[' && i + 1 < pat.size() && pat[i + 1] == ':') {
+      size_t close = pat.find(":]", i + 2);
+      if (close != std::string_view::npos) {
+        matched |= InPosixClass(pat.substr(i + 2, close - i - 2), c);
+        i = close + 2;
+        continue;
+      }
+    }
+    if (pat[i] == '\\' && i + 1 < pat.size()) ++i;
+    unsigned char lo = static_cast<unsigned char>(pat[i++]), hi = lo;
+    if (i + 1 < pat.size() && pat[i] == '-' && pat[i + 1] != ']') {
+      if (pat[i + 1] == '\\' && i + 2 < pat.size()) ++i;
+      hi = static_cast<unsigned char>(pat[i + 1]);
+      i += 2;
+    }
+    matched |= lo <= c && c <= hi;
+  }
+  next = i + 1;
+  return matched != negate;
+}
+
+// One pattern character against `c`: '?', a bracket expression, an escaped
+// character or a plain one. Sets `next` past what was used up.
+static bool CharMatch(std::string_view pat, size_t pi, char c, size_t& next) {
+  switch (pat[pi]) {
+    case '?': next = pi + 1; return true;
+    case '[': return ClassMatch(pat, pi, c, next);
+    case '\\':
+      if (pi + 1 < pat.size()) {
+        next = pi + 2;
+        return pat[pi + 1] == c;
+      }
+      break;
+  }
+  next = pi + 1;
+  return pat[pi] == c;
+}
+
+// Single-star-restart glob: on mismatch only the most recent '*' is retried,
+// so this is O(pattern × text) rather than exponential in the number of '*'.
+static bool GlobMatch(std::string_view pat, std::string_view text) {
+  size_t pi = 0, ti = 0, next = 0;
+  size_t star_pi = std::string_view::npos, star_ti = std::string_view::npos;
+  while (ti < text.size()) {
+    if (pi < pat.size() && pat[pi] == '*') {
+      star_pi = ++pi;
+      star_ti = ti;
+    } else if (pi < pat.size() && CharMatch(pat, pi, text[ti], next)) {
+      pi = next;
+      ++ti;
+    } else if (star_pi != std::string_view::npos) {
+      pi = star_pi;
+      ti = ++star_ti;
+    } else {
+      return false;
+    }
+  }
+  while (pi < pat.size() && pat[pi] == '*') ++pi;
+  return pi == pat.size();
+}
+
+static bool SegmentMatch(const Segment& seg, std::string_view text) {
+  switch (seg.kind) {
+    case SegmentKind::kLiteral: return text == seg.text;
+    case SegmentKind::kAny: return true;
+    case SegmentKind::kPrefix: return StartsWith(text, seg.text);
+    case SegmentKind::kSuffix: return EndsWith(text, seg.text);
+    case SegmentKind::kGlob: return GlobMatch(seg.text, text);
+    case SegmentKind::kAnyPath: return true;
+  }
+  return false;
+}
+
+// Adds the free '**' fall-through transitions to a state set.
+static void CloseStates(const std::vector<Segment>& ptokens, std::vector<unsigned char>& st) {
+  for (size_t pi = 0; pi < ptokens.size(); ++pi) {
+    if (st[pi] && ptokens[pi].kind == SegmentKind::kAnyPath) st[pi + 1] = 1;
+  }
+}
+
+// Consumes one path segment: fills `next` from `cur` and returns whether any
+// state survived.
+static bool StepStates(const std::vector<Segment>& ptokens, const std::vector<unsigned char>& cur,
+                       std::string_view seg, bool floating, std::vector<unsigned char>& next) {
+  const size_t n = ptokens.size();
+  std::fill(next.begin(), next.end(), 0);
+  bool alive = floating;
+  for (size_t pi = 0; pi < n; ++pi) {
+    if (!cur[pi]) continue;
+    if (ptokens[pi].kind == SegmentKind::kAnyPath) {
+      next[pi] = 1;
+      alive = true;
+    } else if (SegmentMatch(ptokens[pi], seg)) {
+      next[pi + 1] = 1;
+      alive = true;
+    }
+  }
+  if (!alive) return false;
+  if (floating) next[0] = 1;
+  CloseStates(ptokens, next);
+  return true;
+}
+
+// Runs the segment program as an NFA over pattern positions: after consuming
+// k path segments, state[pi] says whether ptokens[0, pi) can match them. A
+// '**' state both stays put on a segment and falls through to pi + 1 for
+// free, so every (pi, si) pair is visited once: O(pattern × path) regardless
+// of how many '**' the pattern has. `floating` re-arms state 0 after every
+// segment, which is how non-anchored patterns match at any depth.
+static bool TokensMatch(const std::vector<Segment>& ptokens,
+                        const std::vector<std::string_view>& stokens,
+                        bool floating) {
+  const size_t n = ptokens.size();
+  thread_local std::vector<unsigned char> cur, next;
+  cur.assign(n + 1, 0);
+  next.assign(n + 1, 0);
+
+  cur[0] = 1;
+  CloseStates(ptokens, cur);
+  for (std::string_view seg : stokens) {
+    if (!StepStates(ptokens, cur, seg, floating, next)) return false;
+    cur.swap(next);
+  }
+  return cur[n] != 0;
+}
+
+bool GitWildMatch(const Pattern& p, const PathSegments& path, bool is_dir) {
+  if (p.dir_only && !is_dir) return false;
+  return TokensMatch(p.segments, path.parts, !p.anchored);
+}
+
+std::optional<Pattern> ParseGitignoreLine(std::string line) {
+  // As in git: a CR from a CRLF file and trailing spaces go unless the last
+  // one is escaped; leading spaces are part of the name.
+  if (!line.empty() && line.back() == '\r') line.pop_back();
+  while (!line.empty() && line.back() == ' ') {
+    size_t slashes = 0;
+    while (slashes + 1 < line.size() && line[line.size() - 2 - slashes] == '\\') ++slashes;
+    if (slashes % 2) break;
+    line.pop_back();
+  }
+  if (line.empty()) return std::nullopt;
+  if (line[0] == '#') return std::nullopt;
+  bool neg = false;
+  if (line[0] == '!') {
+    neg = true;
+    line.erase(line.begin());
+    if (line.empty()) return std::nullopt;
+  }
+  bool dir_only = false;
+  if (EndsWith(line, "/")) {
+    dir_only = true;
+    line.pop_back();
+  }
+  // A slash at the start or in the middle ties the pattern to its base.
+  bool anchored = line.find('/') != std::string::npos;
+  while (!line.empty() && line[0] == '/') line.erase(line.begin());
+  if (line.empty()) return std::nullopt;
+  std::vector<Segment> segments = CompilePattern(line);
+  return Pattern{std::move(line), neg, dir_only, anchored, std::move(segments)};
+}
+
+std::string_view PatternIndex::Intern(const std::string& key) {
+  keys_.push_back(key);
+  return keys_.back();
+}
+
+void PatternIndex::Build(const std::vector<Pattern>& patterns) {
+  for (uint32_t ord = 0; ord < patterns.size(); ++ord) {
+    const std::vector<Segment>& segs = patterns[ord].segments;
+    const Segment& last = segs.back();
+    if (last.kind == SegmentKind::kLiteral) {
+      by_basename_[Intern(last.text)].push_back(ord);
+    } else if (last.kind == SegmentKind::kSuffix && StartsWith(last.text, ".")) {
+      by_extension_[Intern(last.text)].push_back(ord);
+    } else if (patterns[ord].anchored && segs.front().kind == SegmentKind::kLiteral) {
+      TrieNode* node = &anchored_;
+      for (const Segment& seg : segs) {
+        if (seg.kind != SegmentKind::kLiteral) break;
+        auto& child = node->children[Intern(seg.text)];
+        if (!child) child = std::make_unique<TrieNode>();
+        node = child.get();
+      }
+      node->ordinals.push_back(ord);
+    } else {
+      fallback_.push_back(ord);
+    }
+  }
+}
+
+void PatternIndex::Candidates(const PathSegments& path, std::vector<uint32_t>& out) const {
+  size_t first = out.size();
+  std::string_view base = path.parts.back();
+  if (auto it = by_basename_.find(base); it != by_basename_.end()) {
+    out.insert(out.end(), it->second.begin(), it->second.end());
+  }
+  if (!by_extension_.empty()) {
+    for (size_t dot = base.find('.'); dot != std::string_view::npos; dot = base.find('.', dot + 1)) {
+      if (auto it = by_extension_.find(base.substr(dot)); it != by_extension_.end()) {
+        out.insert(out.end(), it->second.begin(), it->second.end());
+      }
+    }
+  }
+  const TrieNode* node = &anchored_;
+  for (std::string_view part : path.parts) {
+    auto it = node->children.find(part);
+    if (it == node->children.end()) break;
+    node = it->second.get();
+    out.insert(out.end(), node->ordinals.begin(), node->ordinals.end());
+  }
+  out.insert(out.end(), fallback_.begin(), fallback_.end());
+  std::sort(out.begin() + static_cast<std::ptrdiff_t>(first), out.end(), std::greater<uint32_t>());
+}
+
+GitignoreSpec MakeGitignoreSpec(std::vector<Pattern> patterns) {
+  GitignoreSpec spec;
+  spec.patterns = std::move(patterns);
+  spec.index.Build(spec.patterns);
+  return spec;
+}
+
+GitignoreSpec LoadGitignoreFile(const fs::path& file) {
+  std::vector<Pattern> res;
+  std::ifstream in(file);
+  if (!in) return MakeGitignoreSpec(std::move(res));
+  std::string line;
+  uint32_t line_no = 0;
+  while (std::getline(in, line)) {
+    ++line_no;
+    if (auto p = ParseGitignoreLine(std::move(line))) {
+      p->line = line_no;
+      res.push_back(std::move(*p));
+    }
+  }
+  GitignoreSpec spec = MakeGitignoreSpec(std::move(res));
+  spec.source = file.generic_string();
+  return spec;
+}
+
+GitignoreSpec LoadGitignoreSpec(const fs::path& root) {
+  fs::path gitignore = root / ".gitignore";
+  std::error_code ec;
+  if (!fs::is_regular_file(gitignore, ec)) return MakeGitignoreSpec({});
+  return LoadGitignoreFile(gitignore);
+}
+
+// Candidates come back newest-first, so the first one that matches decides
+// the outcome exactly as a full last-match-wins scan would.
+MatchResult Evaluate(const GitignoreSpec& spec, std::string_view rel_posix, bool is_dir) {
+  if (spec.patterns.empty()) return MatchResult::kNone;
+  thread_local PathSegments path;
+  thread_local std::vector<uint32_t> candidates;
+  path.Assign(rel_posix);
+  candidates.clear();
+  spec.index.Candidates(path, candidates);
+  if (RunStats* stats = RunStats::Active()) {
+    for (uint32_t ord : candidates) {
+      const Pattern& p = spec.patterns[ord];
+      const uint64_t start = StatTicks();
+      const bool matched = GitWildMatch(p, path, is_dir);
+      stats->PatternEval(spec, p, matched, StatTicks() - start);
+      if (matched) return p.negated ? MatchResult::kIncluded : MatchResult::kIgnored;
+    }
+    return MatchResult::kNone;
+  }
+  for (uint32_t ord : candidates) {
+    const Pattern& p = spec.patterns[ord];
+    if (GitWildMatch(p, path, is_dir)) return p.negated ? MatchResult::kIncluded : MatchResult::kIgnored;
+  }
+  return MatchResult::kNone;
+}
+
+bool IsIgnored(const GitignoreSpec& spec, std::string_view rel_posix, bool is_dir) {
+  return Evaluate(spec, rel_posix, is_dir) == MatchResult::kIgnored;
+}
+
+IgnoreScopePtr PushScope(IgnoreScopePtr parent, std::string base, GitignoreSpec spec) {
+  if (spec.patterns.empty()) return parent;
+  auto scope = std::make_shared<IgnoreScope>();
+  scope->parent = std::move(parent);
+  scope->base = std::move(base);
+  scope->spec = std::move(spec);
+  if (RunStats* stats = RunStats::Active()) stats->Retain(scope);
+  return scope;
+}
+
+bool IsIgnored(const IgnoreScope* scope, std::string_view rel_posix, bool is_dir) {
+  for (; scope; scope = scope->parent.get()) {
+    std::string_view rel = rel_posix;
+    if (!scope->base.empty()) {
+      // Entries below a scope always carry its base as a prefix.
+      if (rel.size() <= scope->base.size() || rel[scope->base.size()] != '/' ||
+          !StartsWith(rel, scope->base)) {
+        continue;
+      }
+      rel.remove_prefix(scope->base.size() + 1);
+    }
+    MatchResult m = Evaluate(scope->spec, rel, is_dir);
+    if (m != MatchResult::kNone) return m == MatchResult::kIgnored;
+  }
+  return false;
+}
+
+// What one pattern can do to the entries strictly below a directory whose
+// path (relative to the pattern's base) is `dir`: the NFA is run over the
+// directory's segments and the surviving states are inspected. A state short
+// of the end means some deeper path can still complete the match; a state
+// followed only by '**'s and at most one '*' matches every such path.
+enum class BelowEffect { kNone, kSome, kAll };
+
+static BelowEffect EffectBelow(const Pattern& p, const std::vector<std::string_view>& dir) {
+  const std::vector<Segment>& ptokens = p.segments;
+  const size_t n = ptokens.size();
+  thread_local std::vector<unsigned char> cur, next;
+  cur.assign(n + 1, 0);
+  next.assign(n + 1, 0);
+  cur[0] = 1;
+  CloseStates(ptokens, cur);
+  for (std::string_view seg : dir) {
+    if (!StepStates(ptokens, cur, seg, !p.anchored, next)) return BelowEffect::kNone;
+    cur.swap(next);
+  }
+  BelowEffect effect = BelowEffect::kNone;
+  for (size_t pi = 0; pi < n; ++pi) {
+    if (!cur[pi]) continue;
+    effect = BelowEffect::kSome;
+    if (p.dir_only || p.negated) continue;
+    // Every deeper path has at least one more segment, so what is left
+    // matches them all when it is '**'s and at most one '*'.
+    size_t rest = pi;
+    bool one = false;
+    for (; rest < n; ++rest) {
+      if (ptokens[rest].kind == SegmentKind::kAnyPath) continue;
+      if (ptokens[rest].kind != SegmentKind::kAny || one) break;
+      one = true;
+    }
+    if (rest == n) return BelowEffect::kAll;
+  }
+  return effect;
+}
+
+SubtreeVerdict ClassifySubtree(const IgnoreScope* scope, std::string_view dir_rel) {
+  std::vector<std::string_view> dir;
+  for (; scope; scope = scope->parent.get()) {
+    std::string_view rel = dir_rel;
+    if (!scope->base.empty()) {
+      if (!StartsWith(rel, scope->base)) continue;
+      if (rel.size() == scope->base.size()) {
+        rel = {};
+      } else if (rel[scope->base.size()] == '/') {
+        rel.remove_prefix(scope->base.size() + 1);
+      } else {
+        continue;
+      }
+    }
+    dir.clear();
+    if (!rel.empty()) SplitBytes(rel, '/', dir);
+    // Newest pattern first, innermost scope first: the first one that can
+    // reach below `dir` is the one whose verdict every deeper path sees
+    // before any other, so it alone decides whether the subtree can go.
+    const std::vector<Pattern>& patterns = scope->spec.patterns;
+    for (size_t i = patterns.size(); i-- > 0;) {
+      switch (EffectBelow(patterns[i], dir)) {
+        case BelowEffect::kNone: break;
+        case BelowEffect::kSome: return SubtreeVerdict::kMatch;
+        case BelowEffect::kAll: return SubtreeVerdict::kSkip;
+      }
+    }
+  }
+  return SubtreeVerdict::kIncludeAll;
+}
+
+bool CanMatchBelow(const GitignoreSpec& spec, std::string_view dir_rel) {
+  std::vector<std::string_view> dir;
+  if (!dir_rel.empty()) SplitBytes(dir_rel, '/', dir);
+  for (const Pattern& p : spec.patterns) {
+    if (!p.negated && EffectBelow(p, dir) != BelowEffect::kNone) return true;
+  }
+  return false;
+}
+
+namespace {
+
+std::string ExpandHome(std::string p) {
+  if (!StartsWith(p, "~/")) return p;
+  const char* home = std::getenv("HOME");
+#if defined(_WIN32)
+  if (!home) home = std::getenv("USERPROFILE");
+#endif
+  if (!home) return p;
+  return std::string(home) + p.substr(1);
+}
+
+// Pulls core.excludesFile out of a git config file. Only what that key needs
+// is understood: [section] headers, key = value, quotes and comments.
+std::optional<std::string> ReadExcludesFile(const fs::path& config) {
+  std::ifstream in(config);
+  if (!in) return std::nullopt;
+  std::optional<std::string> found;
+  std::string line;
+  bool in_core = false;
+  while (std::getline(in, line)) {
+    line = Trim(line);
+    if (line.empty() || line[0] == '#' || line[0] == ';') continue;
+    if (line[0] == '[') {
+      size_t close = line.find(']');
+      std::string section = ToLower(Trim(line.substr(1, close == std::string::npos ? std::string::npos : close - 1)));
+      in_core = section == "core";
+      continue;
+    }
+    if (!in_core) continue;
+    size_t eq = line.find('=');
+    if (eq == std::string::npos) continue;
+    if (ToLower(Trim(line.substr(0, eq))) != "excludesfile") continue;
+    std::string value = Trim(line.substr(eq + 1));
+    if (value.size() >= 2 && value.front() == '"' && value.back() == '"') {
+      value = value.substr(1, value.size() - 2);
+    } else {
+      size_t comment = value.find_first_of("#;");
+      if (comment != std::string::npos) value = Trim(value.substr(0, comment));
+    }
+    found = ExpandHome(value);  // later entries override earlier ones
+  }
+  return found;
+}
+
+fs::path XdgConfigHome() {
+  if (const char* xdg = std::getenv("XDG_CONFIG_HOME"); xdg && *xdg) return xdg;
+  const char* home = std::getenv("HOME");
+#if defined(_WIN32)
+  if (!home) home = std::getenv("USERPROFILE");
+#endif
+  return home ? fs::path(home) / ".config" : fs::path();
+}
+
+std::optional<fs::path> FindExcludesFile(const fs::path& root) {
+  const char* home = std::getenv("HOME");
+#if defined(_WIN32)
+  if (!home) home = std::getenv("USERPROFILE");
+#endif
+  fs::path xdg = XdgConfigHome();
+  // Most specific config wins, as in git: repository, then global.
+  std::vector<fs::path> configs = {root / ".git" / "config"};
+  if (home) configs.push_back(fs::path(home) / ".gitconfig");
+  if (!xdg.empty()) configs.push_back(xdg / "git" / "config");
+  for (const fs::path& c : configs) {
+    if (auto v = ReadExcludesFile(c)) {
+      if (v->empty()) return std::nullopt;
+      fs::path p(*v);
+      return p.is_relative() ? root / p : p;
+    }
+  }
+  if (xdg.empty()) return std::nullopt;
+  return xdg / "git" / "ignore";
+}
+
+}  // namespace
+
+IgnoreScopePtr LoadRepoExcludes(const fs::path& root, bool global) {
+  IgnoreScopePtr scope;
+  std::error_code ec;
+  if (global) {
+    if (auto file = FindExcludesFile(root); file && fs::is_regular_file(*file, ec)) {
+      scope = PushScope(scope, "", LoadGitignoreFile(*file));
+    }
+  }
+  fs::path info = root / ".git" / "info" / "exclude";
+  if (fs::is_regular_file(info, ec)) scope = PushScope(scope, "", LoadGitignoreFile(info));
+  return scope;
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// A single '/'-separated piece of a gitignore pattern, classified once at load
+// time so the per-entry matcher can pick the cheapest comparison.
+enum class SegmentKind {
+  kLiteral,   // no wildcards: exact compare, escapes already resolved
+  kAny,       // "*": matches any single segment
+  kPrefix,    // "abc*": text is the part before '*'
+  kSuffix,    // "*abc": text is the part after '*'
+  kGlob,      // anything else: '*', '?', [classes] and escapes
+  kAnyPath,   // "**": matches zero or more segments
+};
+
+struct Segment {
+  SegmentKind kind = SegmentKind::kLiteral;
+  std::string text;
+};
+
+struct Pattern {
+  std::string pattern;
+  bool negated = false;
+  bool dir_only = false;
+  bool anchored = false;
+  std::vector<Segment> segments;
+  uint32_t line = 0;  // 1-based line in its ignore file, 0 when not from one
+};
+
+// The entry path split once into '/'-separated views; matching is done with
+// index offsets into this, so nothing is allocated per pattern.
+struct PathSegments {
+  std::vector<std::string_view> parts;
+
+  void Assign(std::string_view path);
+};
+
+// Buckets pattern ordinals by what a match requires of the entry path, so a
+// lookup only returns the patterns that could possibly match it:
+//  - last segment literal (`build`, `docs/**/a.md`): keyed by basename;
+//  - last segment `*.ext`: keyed by extension, including multi-dot ones;
+//  - anchored with literal leading segments (`/src/gen/**`): a trie walked
+//    along the path's leading segments;
+//  - everything else: a fallback list that is always a candidate.
+class PatternIndex {
+ public:
+  PatternIndex() = default;
+  PatternIndex(const PatternIndex&) = delete;
+  PatternIndex& operator=(const PatternIndex&) = delete;
+  PatternIndex(PatternIndex&&) = default;
+  PatternIndex& operator=(PatternIndex&&) = default;
+
+  void Build(const std::vector<Pattern>& patterns);
+
+  // Appends candidate ordinals to `out`, highest (i.e. last-wins) first.
+  void Candidates(const PathSegments& path, std::vector<uint32_t>& out) const;
+
+ private:
+  struct TrieNode {
+    std::unordered_map<std::string_view, std::unique_ptr<TrieNode>> children;
+    std::vector<uint32_t> ordinals;
+  };
+
+  std::string_view Intern(const std::string& key);
+
+  std::deque<std::string> keys_;  // owns every string_view key below
+  std::unordered_map<std::string_view, std::vector<uint32_t>> by_basename_;
+  std::unordered_map<std::string_view, std::vector<uint32_t>> by_extension_;
+  TrieNode anchored_;
+  std::vector<uint32_t> fallback_;
+};
+
+struct GitignoreSpec {
+  std::string source;  // the file the patterns came from, for --stats
+  std::vector<Pattern> patterns;
+  PatternIndex index;
+};
+
+std::vector<Segment> CompilePattern(std::string_view pattern);
+
+// Parses one .gitignore line; returns nothing for blanks and comments.
+std::optional<Pattern> ParseGitignoreLine(std::string line);
+
+bool GitWildMatch(const Pattern& p, const PathSegments& path, bool is_dir);
+
+GitignoreSpec MakeGitignoreSpec(std::vector<Pattern> patterns);
+
+// Parses an ignore file; a missing or unreadable file gives an empty spec.
+GitignoreSpec LoadGitignoreFile(const std::filesystem::path& file);
+
+// Loads `root / ".gitignore"`.
+GitignoreSpec LoadGitignoreSpec(const std::filesystem::path& root);
+
+enum class MatchResult { kNone, kIgnored, kIncluded };
+
+// Last-match-wins verdict of one spec; kNone when no pattern matches.
+MatchResult Evaluate(const GitignoreSpec& spec, std::string_view rel_posix, bool is_dir);
+
+bool IsIgnored(const GitignoreSpec& spec, std::string_view rel_posix, bool is_dir);
+
+// One layer of ignore rules whose patterns are relative to `base`: a
+// directory's .gitignore, or one of the repository-wide exclude files.
+// Layers chain to their parent, innermost first, and are immutable once
+// built, so every directory below shares its parent's compiled matchers by
+// reference, across threads too.
+struct IgnoreScope {
+  std::shared_ptr<const IgnoreScope> parent;
+  std::string base;  // posix path of the directory relative to the walk root
+  GitignoreSpec spec;
+};
+
+using IgnoreScopePtr = std::shared_ptr<const IgnoreScope>;
+
+// Returns `parent` itself when `spec` is empty, so directories without a
+// .gitignore add no layer.
+IgnoreScopePtr PushScope(IgnoreScopePtr parent, std::string base, GitignoreSpec spec);
+
+// Asks each layer from the innermost out; the first one with an opinion wins,
+// which is how a nested .gitignore overrides its parents.
+bool IsIgnored(const IgnoreScope* scope, std::string_view rel_posix, bool is_dir);
+
+// What the rules in effect at a directory say about everything under it,
+// decided from the patterns alone before the directory is listed.
+enum class SubtreeVerdict {
+  kSkip,        // one rule ignores every path below and none can override it
+  kMatch,       // entries must be matched one by one
+  kIncludeAll,  // no rule can reach below, so nothing needs matching
+};
+
+// `dir_rel` is the directory's posix path relative to the walk root ("" for
+// the root). The answer covers the layers in `scope` only; a .gitignore found
+// further down has to be classified again once it is pushed.
+SubtreeVerdict ClassifySubtree(const IgnoreScope* scope, std::string_view dir_rel);
+
+// Whether some pattern of `spec` that isn't negated could match a path
+// strictly below the directory `dir_rel` ("" for the root).
+bool CanMatchBelow(const GitignoreSpec& spec, std::string_view dir_rel);
+
+// The layers git consults below every .gitignore: `core.excludesFile` (from
+// the repository's config or the user's global one, defaulting to
+// $XDG_CONFIG_HOME/git/ignore) when `global` is set, then
+// `.git/info/exclude`. May return null.
+IgnoreScopePtr LoadRepoExcludes(const std::filesystem::path& root, bool global);
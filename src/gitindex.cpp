@@ -0,0 +1,173 @@
+#include "gitindex.h"
+
+#include <cstring>
+#include <fstream>
+#include <string_view>
+
+#include "fileio.h"
+#include "strutil.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr uint32_t kModeTypeMask = 0170000;
+constexpr uint32_t kModeDirectory = 0040000;
+constexpr uint32_t kModeSymlink = 0120000;
+constexpr uint32_t kModeGitlink = 0160000;
+
+constexpr uint16_t kFlagExtended = 0x4000;
+constexpr uint16_t kFlagStageShift = 12;
+constexpr uint16_t kExtFlagSkipWorktree = 0x4000;
+
+// Fixed part of an on-disk entry before the object id: ctime, mtime, dev,
+// ino, mode, uid, gid and size, 32 bits each.
+constexpr size_t kStatBytes = 40;
+
+uint32_t Be32(const unsigned char* p) {
+  return (uint32_t{p[0]} << 24) | (uint32_t{p[1]} << 16) | (uint32_t{p[2]} << 8) | p[3];
+}
+
+uint16_t Be16(const unsigned char* p) {
+  return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+// Repositories created with `--object-format=sha256` say so in their config;
+// everything else uses 20-byte SHA-1 ids.
+size_t ObjectIdSize(const fs::path& git_dir) {
+  std::ifstream in(git_dir / "config");
+  std::string line;
+  while (std::getline(in, line)) {
+    std::string l = ToLower(Trim(line));
+    if (!StartsWith(l, "objectformat")) continue;
+    size_t eq = l.find('=');
+    if (eq != std::string::npos && Trim(l.substr(eq + 1)) == "sha256") return 32;
+  }
+  return 20;
+}
+
+}  // namespace
+
+bool FindGitDir(const fs::path& dir, fs::path& worktree, fs::path& git_dir) {
+  std::error_code ec;
+  for (fs::path d = dir; !d.empty(); d = d.parent_path()) {
+    fs::path dot_git = d / ".git";
+    if (fs::is_directory(dot_git, ec)) {
+      worktree = d;
+      git_dir = dot_git;
+      return true;
+    }
+    if (fs::is_regular_file(dot_git, ec)) {
+      std::ifstream in(dot_git);
+      std::string line;
+      std::getline(in, line);
+      line = Trim(line);
+      if (!StartsWith(line, "gitdir:")) return false;
+      fs::path target = Trim(line.substr(7));
+      worktree = d;
+      git_dir = target.is_absolute() ? target : d / target;
+      return true;
+    }
+    if (d == d.parent_path()) break;
+  }
+  return false;
+}
+
+bool ReadGitIndex(const fs::path& git_dir, std::vector<IndexEntry>& entries, std::string& error) {
+  fs::path file = git_dir / "index";
+  MappedFile map;
+  if (!map.Open(file)) {
+    error = "cannot read " + file.string();
+    return false;
+  }
+  const auto* data = reinterpret_cast<const unsigned char*>(map.data());
+  const size_t size = map.size();
+  if (size < 12 || std::memcmp(data, "DIRC", 4) != 0) {
+    error = file.string() + " is not a git index";
+    return false;
+  }
+  const uint32_t version = Be32(data + 4);
+  if (version < 2 || version > 4) {
+    error = file.string() + ": unsupported index version " + std::to_string(version);
+    return false;
+  }
+  const uint32_t count = Be32(data + 8);
+  const size_t flags_at = kStatBytes + ObjectIdSize(git_dir);
+
+  entries.clear();
+  entries.reserve(count);
+  std::string path;  // version 4 compresses each path against the previous one
+  size_t off = 12;
+  for (uint32_t i = 0; i < count; ++i) {
+    if (off + flags_at + 2 > size) {
+      error = file.string() + ": truncated entry table";
+      return false;
+    }
+    const unsigned char* e = data + off;
+    const uint16_t flags = Be16(e + flags_at);
+    size_t name_at = flags_at + 2;
+    uint16_t ext_flags = 0;
+    if (flags & kFlagExtended) {
+      if (version < 3 || off + name_at + 2 > size) {
+        error = file.string() + ": malformed entry";
+        return false;
+      }
+      ext_flags = Be16(e + name_at);
+      name_at += 2;
+    }
+
+    const char* name = reinterpret_cast<const char*>(e + name_at);
+    const size_t avail = size - off - name_at;
+    const auto* nul = static_cast<const char*>(std::memchr(name, '\0', avail));
+    if (version == 4) {
+      // Offset varint: how many bytes of the previous path to drop, then the
+      // NUL-terminated remainder.
+      size_t k = 0;
+      uint64_t strip = 0;
+      unsigned char c;
+      do {
+        if (k >= avail || k > 9) {
+          error = file.string() + ": malformed path";
+          return false;
+        }
+        c = static_cast<unsigned char>(name[k++]);
+        strip = k == 1 ? (c & 0x7f) : ((strip + 1) << 7) | (c & 0x7f);
+      } while (c & 0x80);
+      nul = static_cast<const char*>(std::memchr(name + k, '\0', avail - k));
+      if (!nul || strip > path.size()) {
+        error = file.string() + ": malformed path";
+        return false;
+      }
+      path.resize(path.size() - static_cast<size_t>(strip));
+      path.append(name + k, nul);
+      off += name_at + static_cast<size_t>(nul - name) + 1;
+    } else {
+      if (!nul) {
+        error = file.string() + ": malformed path";
+        return false;
+      }
+      path.assign(name, nul);
+      // Entries are NUL-padded (at least one byte) to a multiple of eight.
+      off += (name_at + path.size() + 8) & ~size_t{7};
+    }
+
+    if ((flags >> kFlagStageShift) & 3) {
+      // Conflicted paths appear once per stage; keep one of them.
+      if (!entries.empty() && entries.back().path == path) continue;
+    }
+    IndexEntry entry;
+    entry.path = path;
+    switch (Be32(e + 24) & kModeTypeMask) {
+      case kModeSymlink: entry.kind = IndexEntryKind::kSymlink; break;
+      case kModeGitlink: entry.kind = IndexEntryKind::kGitlink; break;
+      case kModeDirectory: entry.kind = IndexEntryKind::kSparseDir; break;
+      default: entry.kind = IndexEntryKind::kFile; break;
+    }
+    entry.skip_worktree = (ext_flags & kExtFlagSkipWorktree) != 0;
+    entry.size = Be32(e + 36);
+    entry.mtime_sec = Be32(e + 8);
+    entry.mtime_nsec = Be32(e + 12);
+    entries.push_back(std::move(entry));
+  }
+  return true;
+}
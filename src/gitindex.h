@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+enum class IndexEntryKind {
+  kFile,
+  kSymlink,
+  kGitlink,    // a submodule's commit; its directory belongs to the submodule
+  kSparseDir,  // a whole directory collapsed by a sparse index
+};
+
+// One path tracked in the index (stage 0, or the first stage of a conflict),
+// with the stat data git recorded when it last refreshed the entry.
+struct IndexEntry {
+  std::string path;  // posix, relative to the top of the worktree
+  IndexEntryKind kind = IndexEntryKind::kFile;
+  bool skip_worktree = false;  // sparse checkout: not expected on disk
+  uint32_t size = 0;  // truncated to 32 bits, as git stores it
+  uint32_t mtime_sec = 0;
+  uint32_t mtime_nsec = 0;
+};
+
+// Finds the repository that `dir` belongs to by looking for `.git` in it and
+// its parents. A `.git` file (worktrees, submodules) is followed through its
+// "gitdir:" line.
+bool FindGitDir(const std::filesystem::path& dir, std::filesystem::path& worktree,
+                std::filesystem::path& git_dir);
+
+// Parses `git_dir/index` (versions 2 to 4) in place from a read-only mapping,
+// without running git. Entries come back in index order, i.e. sorted bytewise
+// by path.
+bool ReadGitIndex(const std::filesystem::path& git_dir, std::vector<IndexEntry>& entries,
+                  std::string& error);
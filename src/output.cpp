@@ -0,0 +1,301 @@
+#include "output.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <vector>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
+#endif
+
+namespace {
+constexpr size_t kMinBuffer = size_t{4} << 10;
+}  // namespace
+
+void OutputSink::set_copy_chunk(size_t bytes) {
+  copy_chunk_ = std::max<size_t>(bytes, kMinBuffer);
+}
+
+// Streams through one reusable buffer, so memory use doesn't grow with the
+// size of the file being copied.
+uint64_t OutputSink::CopyFrom(const SourceFile& src, uint64_t offset, uint64_t size) {
+  if (size == 0) return 0;
+  if (copy_buf_.size() < copy_chunk_) copy_buf_.resize(copy_chunk_);
+  uint64_t done = 0;
+  while (done < size) {
+    size_t want = static_cast<size_t>(std::min<uint64_t>(size - done, copy_chunk_));
+    long long got = src.ReadAt(offset + done, copy_buf_.data(), want);
+    if (got <= 0) break;
+    Write(std::string_view(copy_buf_.data(), static_cast<size_t>(got)));
+    done += static_cast<uint64_t>(got);
+  }
+  return done;
+}
+
+void StreamSink::Write(std::string_view data) {
+  position_ += data.size();
+  out_.write(data.data(), static_cast<std::streamsize>(data.size()));
+}
+
+void StreamSink::Flush() {
+  out_.flush();
+}
+
+void StringSink::Write(std::string_view data) {
+  position_ += data.size();
+  data_.append(data.data(), data.size());
+}
+
+#if defined(_WIN32)
+
+HandleSink::HandleSink(void* handle, size_t buffer_size, bool owned)
+    : handle_(handle), owned_(owned), cap_(std::max<size_t>(buffer_size, kMinBuffer)) {
+  disk_ = GetFileType(static_cast<HANDLE>(handle_)) == FILE_TYPE_DISK;
+  buf_.reserve(cap_);
+}
+
+HandleSink::~HandleSink() {
+  Flush();
+  if (owned_) CloseHandle(static_cast<HANDLE>(handle_));
+}
+
+void HandleSink::WriteAll(const char* data, size_t n) {
+  while (n > 0 && !failed_) {
+    DWORD want = n > 0x40000000u ? 0x40000000u : static_cast<DWORD>(n);
+    DWORD wrote = 0;
+    if (!WriteFile(static_cast<HANDLE>(handle_), data, want, &wrote, nullptr) || wrote == 0) {
+      failed_ = true;
+      return;
+    }
+    data += wrote;
+    n -= wrote;
+  }
+}
+
+void HandleSink::Write(std::string_view data) {
+  position_ += data.size();
+  if (buf_.size() + data.size() <= cap_) {
+    buf_.append(data.data(), data.size());
+    return;
+  }
+  Flush();
+  if (data.size() >= cap_ / 2) {
+    WriteAll(data.data(), data.size());
+  } else {
+    buf_.append(data.data(), data.size());
+  }
+}
+
+void HandleSink::Flush() {
+  if (buf_.empty()) return;
+  WriteAll(buf_.data(), buf_.size());
+  buf_.clear();
+}
+
+uint64_t HandleSink::CopyFrom(const SourceFile& src, uint64_t offset, uint64_t size) {
+  if (size == 0 || failed_) return 0;
+  Flush();
+  uint64_t copied = MappedCopy(src, offset, size);
+  if (copied < size) copied += OutputSink::CopyFrom(src, offset + copied, size - copied);
+  return copied;
+}
+
+// Maps and writes one copy_chunk_-sized window at a time, so only a window's
+// worth of the source is ever resident on our behalf. Returns how many bytes
+// were written, which is short of `size` when the file is.
+uint64_t HandleSink::MappedCopy(const SourceFile& src, uint64_t offset, uint64_t size) {
+  uint64_t file_size = 0;
+  if (!src.Size(file_size)) return 0;
+  if (file_size <= offset) return 0;
+  const uint64_t end = offset + std::min<uint64_t>(size, file_size - offset);
+  HANDLE mapping = CreateFileMappingW(static_cast<HANDLE>(src.handle()), nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (!mapping) return 0;
+  SYSTEM_INFO si;
+  GetSystemInfo(&si);
+  const uint64_t gran = si.dwAllocationGranularity;
+  const uint64_t window = std::max<uint64_t>(gran, copy_chunk_ - copy_chunk_ % gran);
+  const uint64_t start = offset;
+  while (offset < end && !failed_) {
+    uint64_t base = offset - offset % gran;
+    size_t len = static_cast<size_t>(std::min<uint64_t>(base + window, end) - base);
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, static_cast<DWORD>(base >> 32),
+                               static_cast<DWORD>(base & 0xffffffffu), len);
+    if (!view) {
+      CloseHandle(mapping);
+      return offset - start;
+    }
+    const size_t n = static_cast<size_t>(base + len - offset);
+    WriteAll(static_cast<const char*>(view) + (offset - base), n);
+    position_ += n;
+    UnmapViewOfFile(view);
+    offset = base + len;
+  }
+  CloseHandle(mapping);
+  return offset - start;
+}
+
+#else
+
+FdSink::FdSink(int fd, size_t buffer_size, bool owned)
+    : fd_(fd), owned_(owned), cap_(std::max<size_t>(buffer_size, kMinBuffer)) {
+  struct stat st;
+  regular_ = ::fstat(fd_, &st) == 0 && S_ISREG(st.st_mode);
+  buf_.reserve(cap_);
+}
+
+FdSink::~FdSink() {
+  Flush();
+  if (owned_) ::close(fd_);
+}
+
+// Writes `a` then `b` with as few syscalls as possible.
+void FdSink::WriteAll(std::string_view a, std::string_view b) {
+  while (!failed_ && (!a.empty() || !b.empty())) {
+    struct iovec iov[2];
+    int cnt = 0;
+    if (!a.empty()) iov[cnt++] = {const_cast<char*>(a.data()), a.size()};
+    if (!b.empty()) iov[cnt++] = {const_cast<char*>(b.data()), b.size()};
+    ssize_t w = ::writev(fd_, iov, cnt);
+    if (w < 0) {
+      if (errno == EINTR) continue;
+      failed_ = true;
+      return;
+    }
+    size_t n = static_cast<size_t>(w);
+    size_t from_a = std::min(n, a.size());
+    a.remove_prefix(from_a);
+    b.remove_prefix(n - from_a);
+  }
+}
+
+void FdSink::Write(std::string_view data) {
+  position_ += data.size();
+  if (buf_.size() + data.size() <= cap_) {
+    buf_.append(data.data(), data.size());
+    return;
+  }
+  if (data.size() >= cap_ / 2) {
+    WriteAll(buf_, data);
+    buf_.clear();
+    return;
+  }
+  Flush();
+  buf_.append(data.data(), data.size());
+}
+
+void FdSink::Flush() {
+  if (buf_.empty()) return;
+  WriteAll(buf_);
+  buf_.clear();
+}
+
+uint64_t FdSink::CopyFrom(const SourceFile& src, uint64_t offset, uint64_t size) {
+  if (size == 0 || failed_) return 0;
+  Flush();
+  uint64_t copied = KernelCopy(src.fd(), offset, size);
+  if (copied < size) copied += MappedCopy(src.fd(), offset + copied, size - copied);
+  if (copied < size) copied += OutputSink::CopyFrom(src, offset + copied, size - copied);
+  return copied;
+}
+
+// Returns how many bytes made it across, short of `size` when the file is;
+// the caller finishes the rest. Works for pipes too, through sendfile.
+uint64_t FdSink::KernelCopy(int src_fd, uint64_t offset, uint64_t size) {
+#if defined(__linux__)
+  off_t off = static_cast<off_t>(offset);
+  const off_t end = static_cast<off_t>(offset + size);
+  bool use_copy_range = true;
+  while (off < end) {
+    size_t want = static_cast<size_t>(std::min<uint64_t>(static_cast<uint64_t>(end - off), size_t{1} << 30));
+    ssize_t n;
+    if (use_copy_range) {
+      loff_t in_off = off;
+      n = ::copy_file_range(src_fd, &in_off, fd_, nullptr, want, 0);
+      if (n > 0) off = static_cast<off_t>(in_off);
+    } else {
+      n = ::sendfile(fd_, src_fd, &off, want);
+    }
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (use_copy_range && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP ||
+                             errno == EBADF)) {
+        use_copy_range = false;
+        continue;
+      }
+      break;
+    }
+    if (n == 0) break;  // the file shrank since it was sized
+    position_ += static_cast<uint64_t>(n);
+  }
+  return static_cast<uint64_t>(off) - offset;
+#else
+  (void)src_fd;
+  (void)offset;
+  (void)size;
+  return 0;
+#endif
+}
+
+// Maps and writes one copy_chunk_-sized window at a time, so only a window's
+// worth of the source is ever resident on our behalf. Returns how many bytes
+// were written, like KernelCopy().
+uint64_t FdSink::MappedCopy(int src_fd, uint64_t offset, uint64_t size) {
+  // Touching a mapping past EOF raises SIGBUS, so clamp to the current size.
+  struct stat st;
+  if (::fstat(src_fd, &st) != 0 || !S_ISREG(st.st_mode)) return 0;
+  if (static_cast<uint64_t>(st.st_size) <= offset) return 0;
+  const uint64_t end = offset + std::min<uint64_t>(size, static_cast<uint64_t>(st.st_size) - offset);
+  static const uint64_t page = static_cast<uint64_t>(::sysconf(_SC_PAGESIZE));
+  const uint64_t window = std::max<uint64_t>(page, copy_chunk_ - copy_chunk_ % page);
+  const uint64_t start = offset;
+  while (offset < end && !failed_) {
+    uint64_t base = offset - offset % page;
+    size_t len = static_cast<size_t>(std::min<uint64_t>(base + window, end) - base);
+    void* map = ::mmap(nullptr, len, PROT_READ, MAP_PRIVATE, src_fd, static_cast<off_t>(base));
+    if (map == MAP_FAILED) return offset - start;
+#if defined(POSIX_MADV_SEQUENTIAL)
+    ::posix_madvise(map, len, POSIX_MADV_SEQUENTIAL);
+#endif
+    const size_t n = static_cast<size_t>(base + len - offset);
+    WriteAll(std::string_view(static_cast<const char*>(map) + (offset - base), n));
+    position_ += n;
+    ::munmap(map, len);
+    offset = base + len;
+  }
+  return offset - start;
+}
+
+#endif
+
+std::unique_ptr<OutputSink> OpenFileSink(const std::string& path, size_t buffer_size) {
+#if defined(_WIN32)
+  HANDLE h = CreateFileW(std::filesystem::path(path).c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+                         CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (h == INVALID_HANDLE_VALUE) return nullptr;
+  return std::make_unique<HandleSink>(h, buffer_size, true);
+#else
+  int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) return nullptr;
+  return std::make_unique<FdSink>(fd, buffer_size, true);
+#endif
+}
+
+std::unique_ptr<OutputSink> OpenStdoutSink(size_t buffer_size) {
+#if defined(_WIN32)
+  return std::make_unique<HandleSink>(GetStdHandle(STD_OUTPUT_HANDLE), buffer_size);
+#else
+  return std::make_unique<FdSink>(STDOUT_FILENO, buffer_size);
+#endif
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "fileio.h"
+
+constexpr size_t kDefaultOutputBuffer = size_t{4} << 20;
+constexpr size_t kDefaultCopyChunk = size_t{1} << 20;
+
+// Where the dump goes. Headers, fences and error lines go through Write();
+// file bodies go through CopyFrom(), which sinks backed by a regular file
+// can satisfy without pulling the bytes into user space.
+class OutputSink {
+ public:
+  virtual ~OutputSink() = default;
+
+  virtual void Write(std::string_view data) = 0;
+
+  // Copies `size` bytes of `src` starting at `offset` to the output and
+  // returns how many it copied: fewer when the file has shrunk since it was
+  // sized, or when the output has failed.
+  virtual uint64_t CopyFrom(const SourceFile& src, uint64_t offset, uint64_t size);
+
+  // True when CopyFrom() avoids a user-space copy.
+  virtual bool SupportsZeroCopy() const { return false; }
+
+  // Marks the end of a file's block: a point where a sink that frames its
+  // output may start a new frame.
+  virtual void EndBlock() {}
+
+  virtual void Flush() {}
+
+  // Set once a write has failed; later writes are dropped.
+  virtual bool failed() const { return false; }
+
+  // Chunk size for copies that have to go through user space.
+  void set_copy_chunk(size_t bytes);
+  size_t copy_chunk() const { return copy_chunk_; }
+
+  // Bytes accepted so far, buffered ones included: the offset in the output
+  // at which the next write will land.
+  uint64_t position() const { return position_; }
+
+ protected:
+  size_t copy_chunk_ = kDefaultCopyChunk;
+  uint64_t position_ = 0;
+
+ private:
+  std::vector<char> copy_buf_;
+};
+
+// Compatibility path for anything that is only available as an iostream.
+class StreamSink : public OutputSink {
+ public:
+  explicit StreamSink(std::ostream& out) : out_(out) {}
+
+  void Write(std::string_view data) override;
+  void Flush() override;
+  bool failed() const override { return !out_; }
+
+ private:
+  std::ostream& out_;
+};
+
+// Collects the output in memory.
+class StringSink : public OutputSink {
+ public:
+  void Write(std::string_view data) override;
+
+  std::string& data() { return data_; }
+
+ private:
+  std::string data_;
+};
+
+#if defined(_WIN32)
+// Writes to a Windows HANDLE through one large buffer. For disk files,
+// CopyFrom() writes straight out of a read-only view of the source.
+class HandleSink : public OutputSink {
+ public:
+  explicit HandleSink(void* handle, size_t buffer_size = kDefaultOutputBuffer, bool owned = false);
+  ~HandleSink() override;
+
+  void Write(std::string_view data) override;
+  uint64_t CopyFrom(const SourceFile& src, uint64_t offset, uint64_t size) override;
+  bool SupportsZeroCopy() const override { return disk_; }
+  void Flush() override;
+  bool failed() const override { return failed_; }
+
+ private:
+  void WriteAll(const char* data, size_t n);
+  uint64_t MappedCopy(const SourceFile& src, uint64_t offset, uint64_t size);
+
+  void* handle_;
+  bool owned_;
+  bool disk_ = false;
+  bool failed_ = false;
+  size_t cap_;
+  std::string buf_;
+};
+#else
+// Writes to a file descriptor through one large buffer. A write that does
+// not fit goes out together with the buffered bytes in a single writev().
+// When the descriptor is a regular file, CopyFrom() uses copy_file_range or
+// sendfile on Linux and an mmap-backed write elsewhere.
+class FdSink : public OutputSink {
+ public:
+  explicit FdSink(int fd, size_t buffer_size = kDefaultOutputBuffer, bool owned = false);
+  ~FdSink() override;
+
+  void Write(std::string_view data) override;
+  uint64_t CopyFrom(const SourceFile& src, uint64_t offset, uint64_t size) override;
+  bool SupportsZeroCopy() const override { return regular_; }
+  void Flush() override;
+  bool failed() const override { return failed_; }
+
+ private:
+  void WriteAll(std::string_view a, std::string_view b = {});
+  uint64_t KernelCopy(int src_fd, uint64_t offset, uint64_t size);
+  uint64_t MappedCopy(int src_fd, uint64_t offset, uint64_t size);
+
+  int fd_;
+  bool owned_;
+  bool regular_ = false;
+  bool failed_ = false;
+  size_t cap_;
+  std::string buf_;
+};
+#endif
+
+// Creates (truncating) `path` and returns a sink that owns it, or nullptr.
+std::unique_ptr<OutputSink> OpenFileSink(const std::string& path, size_t buffer_size);
+
+// A sink on the process's standard output, bypassing std::cout.
+std::unique_ptr<OutputSink> OpenStdoutSink(size_t buffer_size);
@@ -0,0 +1,224 @@
+#include "pipeline.h"
+
+#include <iostream>
+#include <utility>
+
+#include "stats.h"
+
+namespace fs = std::filesystem;
+
+// Copies a splice's body and returns whether all of it arrived. A source
+// that shrank since it was sized leaves the block short: it is closed where
+// the copy stopped, saying so, in place of the tail written for the full
+// size, as a short read while loading ends the block where the file did.
+static bool CopySplice(OutputSink& out, const Splice& s) {
+  const uint64_t copied = out.CopyFrom(*s.file, s.offset, s.size);
+  if (copied == s.size || out.failed()) return true;
+  char last = '\n';
+  if (copied > 0 && s.file->ReadAt(s.offset + copied - 1, &last, 1) != 1) last = '\n';
+  std::string end = last == '\n' ? "" : "\n";
+  end += "[... changed while dumped: " + std::to_string(copied) + " of " + std::to_string(s.size) +
+         " bytes shown]\n```\n\n";
+  out.Write(end);
+  return false;
+}
+
+DumpPipeline::DumpPipeline(const PipelineOptions& opts, RenderFn render, OutputSink& out, EmitFn on_emit,
+                           PrepareFn prepare)
+    : opts_(opts),
+      render_(std::move(render)),
+      out_(out),
+      on_emit_(std::move(on_emit)),
+      prepare_(std::move(prepare)) {
+  if (opts_.queue_depth == 0) opts_.queue_depth = 1;
+  // A batch can't be bigger than the window, and is pointless without
+  // anything to prepare it.
+  if (!prepare_ || opts_.batch == 0) opts_.batch = 1;
+  if (opts_.batch > opts_.queue_depth) opts_.batch = opts_.queue_depth;
+  if (opts_.readers == 0) return;
+  RunStats* stats = RunStats::Active();
+  for (unsigned i = 0; i < opts_.readers; ++i) {
+    readers_.emplace_back([this, stats] {
+      RunStats::Attach(stats);
+      ReaderLoop();
+    });
+  }
+  writer_ = std::thread([this, stats] {
+    RunStats::Attach(stats);
+    WriterLoop();
+  });
+}
+
+DumpPipeline::~DumpPipeline() {
+  Finish();
+}
+
+void DumpPipeline::FlushPending() {
+  if (!pending_) return;
+  if (!CopySplice(out_, *pending_)) {
+    std::cerr << "Warning: the previous output shrank while blocks were copied out of it\n";
+  }
+  out_.EndBlock();
+  pending_.reset();
+}
+
+void DumpPipeline::Emit(const WalkFile& f, const Rendered& r) {
+  StatTimer timer(StatPhase::kWrite);
+  const bool bare = r.text.empty() && r.diagnostic.empty() && r.splice && r.splice->tail.empty();
+  if (bare) {
+    const Splice& s = *r.splice;
+    if (pending_ && pending_->file == s.file && pending_->offset + pending_->size == s.offset) {
+      const uint64_t start = pending_at_ + pending_->size;
+      pending_->size += s.size;
+      if (on_emit_) on_emit_(f, r, start, s.size);
+      return;
+    }
+    FlushPending();
+    pending_ = s;
+    pending_at_ = out_.position();
+    if (on_emit_) on_emit_(f, r, pending_at_, s.size);
+    return;
+  }
+  FlushPending();
+
+  if (!r.diagnostic.empty()) std::cerr << r.diagnostic << "\n";
+  const uint64_t start = out_.position();
+  out_.Write(r.text);
+  if (r.splice) {
+    if (CopySplice(out_, *r.splice)) {
+      out_.Write(r.splice->tail);
+    } else {
+      std::cerr << "Warning: " << f.path.string() << " changed while it was dumped\n";
+    }
+  }
+  out_.EndBlock();
+  if (on_emit_) on_emit_(f, r, start, out_.position() - start);
+}
+
+void DumpPipeline::RunInline() {
+  if (prepare_) {
+    std::vector<const WalkFile*> files;
+    files.reserve(inline_batch_.size());
+    for (const WalkFile& f : inline_batch_) files.push_back(&f);
+    prepare_(files);
+  }
+  for (const WalkFile& f : inline_batch_) Emit(f, render_(f, [](uint64_t) {}));
+  inline_batch_.clear();
+}
+
+void DumpPipeline::Submit(const WalkFile& file) {
+  if (readers_.empty()) {
+    inline_batch_.push_back(file);
+    if (inline_batch_.size() >= opts_.batch) RunInline();
+    return;
+  }
+  std::unique_lock<std::mutex> lock(mu_);
+  if (next_seq_ - next_write_ >= opts_.queue_depth) {
+    StatTimer timer(StatPhase::kSubmitWait);
+    submit_cv_.wait(lock, [&] { return next_seq_ - next_write_ < opts_.queue_depth; });
+  }
+  jobs_.push_back(Job{next_seq_++, file});
+  lock.unlock();
+  reader_cv_.notify_all();
+}
+
+void DumpPipeline::Finish() {
+  if (finished_) return;
+  finished_ = true;
+  if (readers_.empty()) {
+    RunInline();
+    StatTimer timer(StatPhase::kWrite);
+    FlushPending();
+    out_.Flush();
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    closing_ = true;
+  }
+  reader_cv_.notify_all();
+  writer_cv_.notify_all();
+  for (auto& t : readers_) t.join();
+  writer_.join();
+  StatTimer timer(StatPhase::kWrite);
+  FlushPending();
+  out_.Flush();
+}
+
+void DumpPipeline::ReaderLoop() {
+  std::vector<Job> batch;
+  std::vector<const WalkFile*> files;
+  for (;;) {
+    batch.clear();
+    {
+      std::unique_lock<std::mutex> lock(mu_);
+      reader_cv_.wait(lock, [&] { return closing_ || !jobs_.empty(); });
+      if (jobs_.empty()) return;
+      while (!jobs_.empty() && batch.size() < opts_.batch) {
+        batch.push_back(std::move(jobs_.front()));
+        jobs_.pop_front();
+      }
+    }
+    if (prepare_) {
+      files.clear();
+      for (const Job& job : batch) files.push_back(&job.file);
+      prepare_(files);
+    }
+
+    // Each result is published as soon as it is rendered: the batch holds
+    // consecutive files, so the one the writer waits on is never stuck
+    // behind a later one.
+    for (Job& job : batch) {
+      // The file the writer is waiting on is always let through, so one file
+      // bigger than the whole budget can't deadlock the pipeline.
+      size_t reserved = 0;
+      auto reserve = [&](uint64_t bytes) {
+        std::unique_lock<std::mutex> lock(mu_);
+        auto fits = [&] { return job.seq == next_write_ || in_flight_bytes_ + bytes <= opts_.memory_budget; };
+        if (!fits()) {
+          StatTimer timer(StatPhase::kBudgetWait);
+          reader_cv_.wait(lock, fits);
+        }
+        in_flight_bytes_ += static_cast<size_t>(bytes);
+        reserved += static_cast<size_t>(bytes);
+      };
+
+      Result res;
+      res.rendered = render_(job.file, reserve);
+      res.file = std::move(job.file);
+      res.cost = res.rendered.text.size();
+      {
+        std::lock_guard<std::mutex> lock(mu_);
+        in_flight_bytes_ = in_flight_bytes_ - reserved + res.cost;
+        done_.emplace(job.seq, std::move(res));
+      }
+      writer_cv_.notify_one();
+    }
+  }
+}
+
+void DumpPipeline::WriterLoop() {
+  for (;;) {
+    Result res;
+    {
+      std::unique_lock<std::mutex> lock(mu_);
+      auto ready = [&] { return done_.count(next_write_) != 0 || (closing_ && next_write_ == next_seq_); };
+      if (!ready()) {
+        StatTimer timer(StatPhase::kWriterWait);
+        writer_cv_.wait(lock, ready);
+      }
+      auto it = done_.find(next_write_);
+      if (it == done_.end()) return;
+      res = std::move(it->second);
+      done_.erase(it);
+    }
+    Emit(res.file, res.rendered);
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      in_flight_bytes_ -= res.cost;
+      ++next_write_;
+    }
+    submit_cv_.notify_one();
+    reader_cv_.notify_all();
+  }
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fileio.h"
+#include "output.h"
+#include "walk.h"
+
+struct PipelineOptions {
+  // Content-loading threads; 0 loads and writes inline on the caller.
+  unsigned readers = 0;
+  // Files submitted but not yet written before Submit() blocks.
+  size_t queue_depth = 64;
+  // Loaded-but-unwritten bytes before readers wait for the writer.
+  size_t memory_budget = size_t{256} << 20;
+  // Most files a reader (or, with no readers, Submit()) takes at once and
+  // hands to the prepare function before rendering them one by one.
+  size_t batch = 1;
+};
+
+// A file body left in the source file, to be copied by the sink. The source
+// is shared so that many blocks can come out of one file, e.g. the previous
+// output when --cache reuses it.
+struct Splice {
+  std::shared_ptr<const SourceFile> file;
+  uint64_t offset = 0;
+  uint64_t size = 0;
+  std::string tail;  // written after the body
+};
+
+// One file's contribution to the dump.
+struct Rendered {
+  std::string text;              // written to the output
+  std::optional<Splice> splice;  // then this, if set
+  std::string diagnostic;        // written to stderr first, if not empty
+  std::optional<FileStamp> stamp;  // set when the block may be reused later
+};
+
+// Called by a render function once it knows how many bytes it is about to
+// load; blocks until they fit in the pipeline's memory budget.
+using ReserveFn = std::function<void(uint64_t bytes)>;
+
+using RenderFn = std::function<Rendered(const WalkFile&, const ReserveFn&)>;
+
+// Called with a batch of files right before they are rendered, in order, on
+// the same thread, so their I/O can be issued together. The pointers are the
+// very objects render is then called with.
+using PrepareFn = std::function<void(const std::vector<const WalkFile*>&)>;
+
+// Called on the writing thread after each file's block is written, with the
+// block's offset and length in the output.
+using EmitFn = std::function<void(const WalkFile&, const Rendered&, uint64_t offset, uint64_t length)>;
+
+// Traversal -> readers -> writer. Submit() is called in dump order from the
+// traversal thread; `render` runs on the reader pool and a single writer
+// thread emits the results in submission order. Both the number of pending
+// files and the bytes held in memory are bounded, so a slow disk or a slow
+// consumer only stalls the stage next to it.
+class DumpPipeline {
+ public:
+  DumpPipeline(const PipelineOptions& opts, RenderFn render, OutputSink& out, EmitFn on_emit = nullptr,
+               PrepareFn prepare = nullptr);
+  ~DumpPipeline();
+
+  DumpPipeline(const DumpPipeline&) = delete;
+  DumpPipeline& operator=(const DumpPipeline&) = delete;
+
+  void Submit(const WalkFile& file);
+
+  // Waits until everything submitted has been written.
+  void Finish();
+
+ private:
+  struct Job {
+    uint64_t seq = 0;
+    WalkFile file;
+  };
+
+  struct Result {
+    WalkFile file;
+    Rendered rendered;
+    size_t cost = 0;  // bytes charged against the memory budget
+  };
+
+  void ReaderLoop();
+  void WriterLoop();
+  void RunInline();
+  void Emit(const WalkFile& f, const Rendered& r);
+  void FlushPending();
+
+  PipelineOptions opts_;
+  RenderFn render_;
+  OutputSink& out_;
+  EmitFn on_emit_;
+  PrepareFn prepare_;
+
+  // Files submitted inline (no readers) while a batch fills up.
+  std::vector<WalkFile> inline_batch_;
+
+  // Back-to-back bare splices of adjacent ranges of one source (unchanged
+  // blocks reused from a previous output, typically) are merged into one
+  // copy. Only touched by whichever thread is writing.
+  std::optional<Splice> pending_;
+  uint64_t pending_at_ = 0;  // output offset where `pending_` starts
+
+  std::mutex mu_;
+  std::condition_variable submit_cv_;  // room in the window
+  std::condition_variable reader_cv_;  // jobs queued / budget freed
+  std::condition_variable writer_cv_;  // next result landed
+  std::deque<Job> jobs_;
+  std::map<uint64_t, Result> done_;    // reorder buffer
+  uint64_t next_seq_ = 0;              // next sequence number to hand out
+  uint64_t next_write_ = 0;            // next sequence number to write
+  size_t in_flight_bytes_ = 0;
+  bool closing_ = false;
+  bool finished_ = false;
+
+  std::vector<std::thread> readers_;
+  std::thread writer_;
+};
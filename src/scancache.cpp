@@ -0,0 +1,250 @@
+#include "scancache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <system_error>
+#include <utility>
+
+namespace fs = std::filesystem;
+
+// On-disk layout, native byte order: a header, then the directory, listing
+// entry and file tables, then one blob holding every string. Directory and
+// file records are sorted by path so lookups are a binary search straight
+// over the mapping; strings are referenced by offset into the blob.
+
+namespace {
+
+constexpr char kMagic[4] = {'G', 'D', 'S', 'C'};
+constexpr uint32_t kVersion = 1;
+
+template <typename T>
+T ReadRecord(const char* table, uint64_t i) {
+  T rec;
+  std::memcpy(&rec, table + i * sizeof(T), sizeof(T));
+  return rec;
+}
+
+// Stamps taken by path on some platforms carry no identity; treat a zero
+// identity on either side as unknown rather than as a mismatch.
+bool SameStamp(const FileStamp& a, uint64_t size, int64_t mtime_ns, uint64_t dev, uint64_t ino) {
+  if (a.size != size || a.mtime_ns != mtime_ns) return false;
+  if (a.id == FileId{} || (dev == 0 && ino == 0)) return true;
+  return a.id.dev == dev && a.id.ino == ino;
+}
+
+}  // namespace
+
+struct ScanCache::Header {
+  char magic[4];
+  uint32_t version;
+  uint64_t fingerprint;
+  uint64_t out_size;
+  int64_t out_mtime_ns;
+  uint64_t out_dev;
+  uint64_t out_ino;
+  uint64_t dir_count;
+  uint64_t entry_count;
+  uint64_t file_count;
+  uint64_t strings_size;
+};
+
+struct ScanCache::DirRecord {
+  uint64_t path_off;
+  uint32_t path_len;
+  uint32_t entry_count;
+  int64_t mtime_ns;
+  uint64_t first_entry;
+};
+
+struct ScanCache::EntryRecord {
+  uint64_t name_off;
+  uint32_t name_len;
+  uint32_t type;
+};
+
+struct ScanCache::FileRecord {
+  uint64_t path_off;
+  uint32_t path_len;
+  uint32_t reserved;
+  uint64_t size;
+  int64_t mtime_ns;
+  uint64_t dev;
+  uint64_t ino;
+  uint64_t out_offset;
+  uint64_t out_length;
+};
+
+void ScanCache::Load(const fs::path& file, uint64_t fingerprint, const fs::path& previous_out) {
+  if (!map_.Open(file)) return;
+  Attach(map_.data(), map_.size(), fingerprint, previous_out);
+}
+
+void ScanCache::Load(std::string image, uint64_t fingerprint, const fs::path& previous_out) {
+  image_ = std::move(image);
+  Attach(image_.data(), image_.size(), fingerprint, previous_out);
+}
+
+void ScanCache::Attach(const char* data, size_t size, uint64_t fingerprint, const fs::path& previous_out) {
+  if (size < sizeof(Header)) return;
+  Header h;
+  std::memcpy(&h, data, sizeof(h));
+  if (std::memcmp(h.magic, kMagic, sizeof(kMagic)) != 0 || h.version != kVersion || h.fingerprint != fingerprint) {
+    return;
+  }
+  // Overflow-safe size check: every count is bounded by the file size first.
+  if (h.dir_count > size || h.entry_count > size || h.file_count > size || h.strings_size > size) return;
+  const uint64_t expect = sizeof(Header) + h.dir_count * sizeof(DirRecord) + h.entry_count * sizeof(EntryRecord) +
+                          h.file_count * sizeof(FileRecord) + h.strings_size;
+  if (expect != size) return;
+
+  dirs_ = data + sizeof(Header);
+  entries_ = dirs_ + h.dir_count * sizeof(DirRecord);
+  files_ = entries_ + h.entry_count * sizeof(EntryRecord);
+  strings_ = files_ + h.file_count * sizeof(FileRecord);
+  dir_count_ = h.dir_count;
+  entry_count_ = h.entry_count;
+  file_count_ = h.file_count;
+  strings_size_ = h.strings_size;
+
+  // The blocks are only worth anything if the output they point into is
+  // untouched since the cache was saved.
+  auto out = std::make_shared<SourceFile>();
+  FileStamp stamp;
+  if (out->Open(previous_out) && out->Stamp(stamp) &&
+      SameStamp(stamp, h.out_size, h.out_mtime_ns, h.out_dev, h.out_ino)) {
+    previous_out_ = std::move(out);
+  }
+}
+
+std::string_view ScanCache::String(uint64_t off, uint32_t len) const {
+  if (off > strings_size_ || len > strings_size_ - off) return {};
+  return std::string_view(strings_ + off, len);
+}
+
+template <typename Record>
+bool ScanCache::Find(const char* table, uint64_t count, std::string_view rel, Record& out) const {
+  uint64_t lo = 0, hi = count;
+  while (lo < hi) {
+    uint64_t mid = lo + (hi - lo) / 2;
+    Record rec = ReadRecord<Record>(table, mid);
+    std::string_view path = String(rec.path_off, rec.path_len);
+    if (path < rel) {
+      lo = mid + 1;
+    } else if (rel < path) {
+      hi = mid;
+    } else {
+      out = rec;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ScanCache::FindDir(std::string_view rel, int64_t mtime_ns, std::vector<ListedEntry>& entries) const {
+  DirRecord dir;
+  if (!Find(dirs_, dir_count_, rel, dir) || dir.mtime_ns != mtime_ns) return false;
+  if (dir.first_entry > entry_count_ || dir.entry_count > entry_count_ - dir.first_entry) return false;
+  entries.clear();
+  entries.reserve(dir.entry_count);
+  for (uint64_t i = 0; i < dir.entry_count; ++i) {
+    EntryRecord e = ReadRecord<EntryRecord>(entries_, dir.first_entry + i);
+    if (e.type > static_cast<uint32_t>(ListedType::kSymlink)) return false;
+    entries.push_back(ListedEntry{String(e.name_off, e.name_len), static_cast<ListedType>(e.type)});
+  }
+  return true;
+}
+
+bool ScanCache::FindBlock(std::string_view rel, const FileStamp& stamp, uint64_t& offset, uint64_t& length) const {
+  if (!previous_out_) return false;
+  FileRecord f;
+  if (!Find(files_, file_count_, rel, f) || !SameStamp(stamp, f.size, f.mtime_ns, f.dev, f.ino)) return false;
+  offset = f.out_offset;
+  length = f.out_length;
+  return true;
+}
+
+void ScanCacheWriter::AddDir(std::string rel, int64_t mtime_ns, const std::vector<ListedEntry>& entries) {
+  if (mtime_ns >= racy_after_ns_) return;
+  std::lock_guard<std::mutex> lock(dirs_mu_);
+  Dir d{std::move(rel), mtime_ns, entries};
+  for (ListedEntry& e : d.entries) e.name = names_.Copy(e.name);
+  dirs_.push_back(std::move(d));
+}
+
+void ScanCacheWriter::AddBlock(std::string rel, const FileStamp& stamp, uint64_t offset, uint64_t length) {
+  if (stamp.mtime_ns >= racy_after_ns_) return;
+  blocks_.push_back(Block{std::move(rel), stamp, offset, length});
+}
+
+std::string ScanCacheWriter::Serialize(uint64_t fingerprint, const FileStamp& out_stamp) {
+  std::sort(dirs_.begin(), dirs_.end(), [](const Dir& a, const Dir& b) { return a.rel < b.rel; });
+  std::sort(blocks_.begin(), blocks_.end(), [](const Block& a, const Block& b) { return a.rel < b.rel; });
+
+  std::string strings;
+  auto intern = [&](std::string_view s) {
+    uint64_t off = strings.size();
+    strings += s;
+    return off;
+  };
+
+  std::vector<ScanCache::DirRecord> dirs;
+  std::vector<ScanCache::EntryRecord> entries;
+  std::vector<ScanCache::FileRecord> files;
+  dirs.reserve(dirs_.size());
+  files.reserve(blocks_.size());
+  for (size_t i = 0; i < dirs_.size(); ++i) {
+    const Dir& d = dirs_[i];
+    if (i > 0 && d.rel == dirs_[i - 1].rel) continue;
+    ScanCache::DirRecord rec{intern(d.rel), static_cast<uint32_t>(d.rel.size()),
+                             static_cast<uint32_t>(d.entries.size()), d.mtime_ns, entries.size()};
+    for (const ListedEntry& e : d.entries) {
+      entries.push_back({intern(e.name), static_cast<uint32_t>(e.name.size()), static_cast<uint32_t>(e.type)});
+    }
+    dirs.push_back(rec);
+  }
+  for (size_t i = 0; i < blocks_.size(); ++i) {
+    const Block& b = blocks_[i];
+    if (i > 0 && b.rel == blocks_[i - 1].rel) continue;
+    files.push_back({intern(b.rel), static_cast<uint32_t>(b.rel.size()), 0, b.stamp.size, b.stamp.mtime_ns,
+                     b.stamp.id.dev, b.stamp.id.ino, b.offset, b.length});
+  }
+
+  ScanCache::Header h{};
+  std::memcpy(h.magic, kMagic, sizeof(kMagic));
+  h.version = kVersion;
+  h.fingerprint = fingerprint;
+  h.out_size = out_stamp.size;
+  h.out_mtime_ns = out_stamp.mtime_ns;
+  h.out_dev = out_stamp.id.dev;
+  h.out_ino = out_stamp.id.ino;
+  h.dir_count = dirs.size();
+  h.entry_count = entries.size();
+  h.file_count = files.size();
+  h.strings_size = strings.size();
+
+  std::string image;
+  auto append = [&](const void* p, size_t n) { image.append(static_cast<const char*>(p), n); };
+  image.reserve(sizeof(h) + dirs.size() * sizeof(dirs[0]) + entries.size() * sizeof(entries[0]) +
+                files.size() * sizeof(files[0]) + strings.size());
+  append(&h, sizeof(h));
+  append(dirs.data(), dirs.size() * sizeof(dirs[0]));
+  append(entries.data(), entries.size() * sizeof(entries[0]));
+  append(files.data(), files.size() * sizeof(files[0]));
+  image += strings;
+  return image;
+}
+
+bool ScanCacheWriter::Save(const fs::path& file, const std::string& image) {
+  fs::path tmp = file;
+  tmp += ".tmp";
+  {
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    if (!out) return false;
+    out.write(image.data(), static_cast<std::streamsize>(image.size()));
+    if (!out.flush()) return false;
+  }
+  std::error_code ec;
+  fs::rename(tmp, file, ec);
+  return !ec;
+}
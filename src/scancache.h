@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "dirlist.h"
+#include "fileio.h"
+
+// The state a previous run left behind (--cache), mapped read-only and
+// searched in place:
+//  - every directory's mtime and raw listing, so an unchanged directory is
+//    not listed again;
+//  - every dumped file's stamp and the offset and length of its block in the
+//    previous --out, so an unchanged file is copied from there instead of
+//    being opened and rendered.
+// Blocks are only offered while the previous output is exactly the file the
+// cache was saved with.
+class ScanCache {
+ public:
+  ScanCache() = default;
+  ScanCache(const ScanCache&) = delete;
+  ScanCache& operator=(const ScanCache&) = delete;
+
+  // A missing, corrupt or mismatched (`fingerprint`) cache loads as empty.
+  void Load(const std::filesystem::path& file, uint64_t fingerprint, const std::filesystem::path& previous_out);
+
+  // Same, from an image built by ScanCacheWriter::Serialize() and kept in
+  // memory (--watch carries it from one round to the next).
+  void Load(std::string image, uint64_t fingerprint, const std::filesystem::path& previous_out);
+
+  // Fills `entries` with the listing recorded for `rel` if the directory's
+  // mtime is still `mtime_ns`. The names point into the cache itself.
+  bool FindDir(std::string_view rel, int64_t mtime_ns, std::vector<ListedEntry>& entries) const;
+
+  // Where `rel`'s block sits in the previous output, if it was recorded for
+  // a file with this exact stamp.
+  bool FindBlock(std::string_view rel, const FileStamp& stamp, uint64_t& offset, uint64_t& length) const;
+
+  const std::shared_ptr<const SourceFile>& previous_output() const { return previous_out_; }
+
+ private:
+  friend class ScanCacheWriter;
+
+  struct Header;
+  struct DirRecord;
+  struct EntryRecord;
+  struct FileRecord;
+
+  void Attach(const char* data, size_t size, uint64_t fingerprint, const std::filesystem::path& previous_out);
+  std::string_view String(uint64_t off, uint32_t len) const;
+  template <typename Record>
+  bool Find(const char* table, uint64_t count, std::string_view rel, Record& out) const;
+
+  MappedFile map_;
+  std::string image_;  // backing store when not loaded from a file
+  const char* dirs_ = nullptr;
+  const char* entries_ = nullptr;
+  const char* files_ = nullptr;
+  const char* strings_ = nullptr;
+  uint64_t dir_count_ = 0;
+  uint64_t entry_count_ = 0;
+  uint64_t file_count_ = 0;
+  uint64_t strings_size_ = 0;
+  std::shared_ptr<const SourceFile> previous_out_;  // null when blocks are unusable
+};
+
+// Collects what this run saw, for the next one. AddDir() may be called from
+// any number of threads at once; AddBlock() from one thread, which may be
+// another than AddDir()'s.
+class ScanCacheWriter {
+ public:
+  // Anything modified at or after `racy_after_ns` is left out: a change in
+  // the same clock tick as the scan would not show up as a new mtime.
+  explicit ScanCacheWriter(int64_t racy_after_ns) : racy_after_ns_(racy_after_ns) {}
+
+  // Copies the names, so `entries` may point into a scratch arena.
+  void AddDir(std::string rel, int64_t mtime_ns, const std::vector<ListedEntry>& entries);
+  void AddBlock(std::string rel, const FileStamp& stamp, uint64_t offset, uint64_t length);
+
+  // The cache file's contents. `out_stamp` identifies the output the blocks
+  // refer to.
+  std::string Serialize(uint64_t fingerprint, const FileStamp& out_stamp);
+
+  // Writes `image` next to `file` and renames it into place.
+  static bool Save(const std::filesystem::path& file, const std::string& image);
+
+ private:
+  struct Dir {
+    std::string rel;
+    int64_t mtime_ns;
+    std::vector<ListedEntry> entries;
+  };
+  struct Block {
+    std::string rel;
+    FileStamp stamp;
+    uint64_t offset;
+    uint64_t length;
+  };
+
+  int64_t racy_after_ns_;
+  std::mutex dirs_mu_;
+  Arena names_;  // backs every Dir's entry names
+  std::vector<Dir> dirs_;
+  std::vector<Block> blocks_;
+};
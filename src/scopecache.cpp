@@ -0,0 +1,21 @@
+#include "scopecache.h"
+
+namespace fs = std::filesystem;
+
+IgnoreScopePtr ScopeCache::ScopeFor(const IgnoreScopePtr& parent, const std::string& rel, const fs::path& file) {
+  FileStamp stamp;
+  const bool present = StampOf(file, stamp);
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    auto it = layers_.find(rel);
+    if (it != layers_.end() && it->second.parent == parent && it->second.present == present &&
+        (!present || it->second.stamp == stamp)) {
+      return it->second.scope;
+    }
+  }
+  // Compiled outside the lock; two threads racing here build the same thing.
+  IgnoreScopePtr scope = present ? PushScope(parent, rel, LoadGitignoreFile(file)) : parent;
+  std::lock_guard<std::mutex> lock(mu_);
+  layers_[rel] = Layer{parent, present, stamp, scope};
+  return scope;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "fileio.h"
+#include "gitignore.h"
+
+// The compiled .gitignore of every directory of one tree, kept from one walk
+// to the next: a directory's scope is compiled again only once its
+// .gitignore, or a scope above it, has changed. Safe to use from any number
+// of threads at once.
+class ScopeCache {
+ public:
+  // The scope in effect inside the directory `rel` given `parent`, the one
+  // around it; `file` is the directory's .gitignore, which may not exist.
+  IgnoreScopePtr ScopeFor(const IgnoreScopePtr& parent, const std::string& rel, const std::filesystem::path& file);
+
+  // A WalkOptions::load_scope going through this cache, which must outlive
+  // the walk.
+  auto Loader() {
+    return [this](IgnoreScopePtr parent, const std::string& rel, const std::filesystem::path& file) {
+      return ScopeFor(parent, rel, file);
+    };
+  }
+
+ private:
+  struct Layer {
+    IgnoreScopePtr parent;
+    bool present = false;
+    FileStamp stamp;
+    IgnoreScopePtr scope;
+  };
+
+  std::mutex mu_;
+  std::unordered_map<std::string, Layer> layers_;  // by directory
+};
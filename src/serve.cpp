@@ -0,0 +1,623 @@
+#include "serve.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+#if !defined(_WIN32)
+#include <condition_variable>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "gitignore.h"
+#include "scancache.h"
+#include "scopecache.h"
+#include "watch.h"
+#endif
+
+namespace fs = std::filesystem;
+
+#if !defined(_WIN32)
+
+// The protocol: the client sends kHello and one "key=value" line per
+// option, then shuts down its side. The server answers "ok SIZE\n" and the
+// dump, or "error MESSAGE\n". A dump the server won't keep is sent as it is
+// written instead: "ok chunked\n", then "SIZE\n" and that many bytes per
+// chunk, up to "0\n", or to "error MESSAGE\n" if it fails part way.
+
+namespace {
+
+constexpr std::string_view kHello = "gitdump-serve 2\n";
+constexpr size_t kMaxRequest = 64 << 10;
+constexpr size_t kChunkBytes = 256 << 10;
+#if defined(MSG_NOSIGNAL)
+constexpr int kSendFlags = MSG_NOSIGNAL;
+#else
+constexpr int kSendFlags = 0;  // SIGPIPE is ignored instead
+#endif
+
+std::string FormatRequest(const fs::path& root, const DumpOptions& opts) {
+  std::string r(kHello);
+  r += "path=" + root.string() + "\n";
+  if (opts.walk.sort) r += "sort=1\n";
+  if (opts.max_file_size) r += "max_file_size=" + std::to_string(*opts.max_file_size) + "\n";
+  if (opts.oversize == OversizePolicy::kSkip) r += "oversize=skip\n";
+  if (opts.skip_binary) r += "skip_binary=1\n";
+  if (!opts.global_excludes) r += "global_excludes=0\n";
+  if (opts.source == FileSource::kIndex) r += "source=index\n";
+  if (opts.include_untracked) r += "include_untracked=1\n";
+  if (opts.dedup) r += "dedup=1\n";
+  if (const PathFilter* f = opts.walk.filter) {
+    for (const std::string& g : f->includes()) r += "include=" + g + "\n";
+    for (const std::string& g : f->excludes()) r += "exclude=" + g + "\n";
+    for (const std::string& e : f->extensions()) r += "ext=" + e + "\n";
+  }
+  return r;
+}
+
+// Applies a request to `opts`, which holds the server's own settings. The
+// request's filters are built into `filter`.
+bool ParseRequest(std::string_view text, fs::path& root, DumpOptions& opts, PathFilter& filter,
+                  std::string& error) {
+  if (text.substr(0, kHello.size()) != kHello) {
+    error = "not a gitdump request";
+    return false;
+  }
+  text.remove_prefix(kHello.size());
+  while (!text.empty()) {
+    size_t nl = text.find('\n');
+    std::string_view line = text.substr(0, nl);
+    text.remove_prefix(nl == std::string_view::npos ? text.size() : nl + 1);
+    size_t eq = line.find('=');
+    std::string_view key = line.substr(0, eq);
+    std::string value(eq == std::string_view::npos ? std::string_view() : line.substr(eq + 1));
+    if (key == "path") {
+      root = value;
+    } else if (key == "sort") {
+      opts.walk.sort = value == "1";
+    } else if (key == "max_file_size") {
+      char* end = nullptr;
+      unsigned long long n = std::strtoull(value.c_str(), &end, 10);
+      if (value.empty() || *end != '\0') {
+        error = "invalid max_file_size '" + value + "'";
+        return false;
+      }
+      opts.max_file_size = n;
+    } else if (key == "oversize") {
+      opts.oversize = value == "skip" ? OversizePolicy::kSkip : OversizePolicy::kTruncate;
+    } else if (key == "skip_binary") {
+      opts.skip_binary = value == "1";
+    } else if (key == "global_excludes") {
+      opts.global_excludes = value != "0";
+    } else if (key == "source") {
+      opts.source = value == "index" ? FileSource::kIndex : FileSource::kWalk;
+    } else if (key == "include_untracked") {
+      opts.include_untracked = value == "1";
+    } else if (key == "dedup") {
+      opts.dedup = value == "1";
+    } else if (key == "include") {
+      filter.AddInclude(value);
+    } else if (key == "exclude") {
+      filter.AddExclude(value);
+    } else if (key == "ext") {
+      filter.AddExtensions(value);
+    } else if (!key.empty()) {
+      error = "unknown option '" + std::string(key) + "'";
+      return false;
+    }
+  }
+  if (root.empty() || !root.is_absolute()) {
+    error = "the request needs an absolute path";
+    return false;
+  }
+  filter.Build();
+  opts.walk.filter = filter.empty() ? nullptr : &filter;
+  return true;
+}
+
+bool SendAll(int fd, std::string_view data) {
+  while (!data.empty()) {
+    ssize_t n = ::send(fd, data.data(), data.size(), kSendFlags);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    data.remove_prefix(static_cast<size_t>(n));
+  }
+  return true;
+}
+
+// The chunked reply, sent as the dump is written. Once the client is gone
+// the rest of the dump is dropped.
+class ChunkSink : public OutputSink {
+ public:
+  explicit ChunkSink(int fd) : fd_(fd) {}
+
+  void Write(std::string_view data) override {
+    position_ += data.size();
+    if (failed_) return;
+    buf_.append(data.data(), data.size());
+    if (buf_.size() >= kChunkBytes) Send();
+  }
+  void Flush() override { Send(); }
+  bool failed() const override { return failed_; }
+
+  // Ends the reply, as a complete dump or with `error`.
+  void Finish(bool ok, const std::string& error) {
+    if (failed_) return;
+    if (!ok) {
+      SendAll(fd_, "error " + error + "\n");
+      return;
+    }
+    Send();
+    SendAll(fd_, started_ ? "0\n" : "ok chunked\n0\n");
+  }
+
+ private:
+  void Send() {
+    if (failed_ || buf_.empty()) return;
+    std::string head = started_ ? std::string() : "ok chunked\n";
+    started_ = true;
+    head += std::to_string(buf_.size()) + "\n";
+    failed_ = !SendAll(fd_, head) || !SendAll(fd_, buf_);
+    buf_.clear();
+  }
+
+  int fd_;
+  std::string buf_;
+  bool started_ = false;
+  bool failed_ = false;
+};
+
+int64_t NowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+// What the server keeps of one tree dumped with one set of options.
+struct WarmTree {
+  std::mutex mu;  // one dump of a tree at a time; guards the rest
+  bool loaded = false;
+  IgnoreScopePtr excludes;  // read when the tree is first asked for
+  ScopeCache scopes;
+  std::string listings;  // the scan cache image of the last dump
+  TreeWatcher watcher;
+  std::vector<fs::path> dirs;  // watched, sorted
+  bool watching = false;       // every one of them
+  std::shared_ptr<const std::string> output;  // the last dump, while unchanged
+  uint64_t last_size = 0;                     // of the last dump, kept or not
+};
+
+class Server {
+ public:
+  explicit Server(const ServeOptions& opts) : opts_(opts) {}
+
+  int Run();
+
+ private:
+  struct Slot {
+    std::shared_ptr<WarmTree> tree;
+    size_t footprint = 0;
+    uint64_t last_used = 0;
+  };
+
+  void WorkerLoop();
+  void Handle(int fd);
+  // Either sets `output` to the whole dump or streams it into `stream`.
+  bool DumpWarm(WarmTree& t, const fs::path& root, DumpOptions opts, ChunkSink& stream,
+                std::shared_ptr<const std::string>& output, std::string& error);
+  std::shared_ptr<WarmTree> Acquire(const std::string& key);
+  // Records what `key` holds now and drops the least recently used trees,
+  // `key` too if it comes to that, until the rest fits in the cache.
+  void Account(const std::string& key, size_t footprint);
+
+  const ServeOptions& opts_;
+
+  std::mutex trees_mu_;
+  std::unordered_map<std::string, Slot> trees_;
+  uint64_t tick_ = 0;
+
+  std::mutex queue_mu_;
+  std::condition_variable queue_cv_;
+  std::deque<int> queue_;
+};
+
+// Whether the process on the other end of `fd` runs as the server's user, or
+// as root. Where the system can't say, the socket's mode is the only check.
+static bool PeerTrusted(int fd) {
+#if defined(__linux__)
+  ucred cred{};
+  socklen_t len = sizeof(cred);
+  if (::getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0) return false;
+  const uid_t uid = cred.uid;
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
+  uid_t uid;
+  gid_t gid;
+  if (::getpeereid(fd, &uid, &gid) != 0) return false;
+#else
+  (void)fd;
+  const uid_t uid = ::geteuid();
+#endif
+  return uid == ::geteuid() || uid == 0;
+}
+
+int Server::Run() {
+  const std::string path = opts_.socket.string();
+  sockaddr_un addr{};
+  if (path.size() >= sizeof(addr.sun_path)) {
+    std::cerr << "Error: socket path '" << path << "' is too long\n";
+    return 1;
+  }
+  addr.sun_family = AF_UNIX;
+  std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+  int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    std::cerr << "Error: cannot create a socket: " << std::strerror(errno) << "\n";
+    return 1;
+  }
+  ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+  // A socket file left behind by a server that is gone is taken over; a
+  // live one is not.
+  struct stat st;
+  if (::lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+    int probe = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    bool live = probe >= 0 && ::connect(probe, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+    if (probe >= 0) ::close(probe);
+    if (live) {
+      std::cerr << "Error: a server is already listening on '" << path << "'\n";
+      ::close(fd);
+      return 1;
+    }
+    ::unlink(path.c_str());
+  }
+  // A request can name any tree the server can read, so the socket is only
+  // ever the server's user's: it is created without group or other access
+  // whatever the umask (set before any worker starts, as it is process-wide),
+  // and every peer is checked in Handle() as well.
+  const mode_t umask = ::umask(077);
+  const bool bound = ::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+  ::umask(umask);
+  if (!bound || ::listen(fd, 128) != 0) {
+    std::cerr << "Error: cannot listen on '" << path << "': " << std::strerror(errno) << "\n";
+    ::close(fd);
+    return 1;
+  }
+  std::signal(SIGPIPE, SIG_IGN);
+
+  std::vector<std::thread> workers;
+  for (unsigned i = 0; i < std::max(1u, opts_.workers); ++i) workers.emplace_back([this] { WorkerLoop(); });
+  std::cout << "Serving on " << path << std::endl;
+  for (;;) {
+    int client = ::accept(fd, nullptr, nullptr);
+    if (client < 0) {
+      // Out of descriptors, most likely; requests in flight will free some.
+      if (errno != EINTR && errno != ECONNABORTED) {
+        std::cerr << "Warning: accept failed: " << std::strerror(errno) << "\n";
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      }
+      continue;
+    }
+    ::fcntl(client, F_SETFD, FD_CLOEXEC);
+    {
+      std::lock_guard<std::mutex> lock(queue_mu_);
+      queue_.push_back(client);
+    }
+    queue_cv_.notify_one();
+  }
+}
+
+void Server::WorkerLoop() {
+  for (;;) {
+    int fd;
+    {
+      std::unique_lock<std::mutex> lock(queue_mu_);
+      queue_cv_.wait(lock, [&] { return !queue_.empty(); });
+      fd = queue_.front();
+      queue_.pop_front();
+    }
+    Handle(fd);
+    ::close(fd);
+  }
+}
+
+void Server::Handle(int fd) {
+  // A client that never finishes its request gives up its worker in time.
+  timeval timeout{10, 0};
+  ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  // Nor does one that stops reading a streamed reply hold on to the tree.
+  ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  std::string request;
+  char buf[4096];
+  for (;;) {
+    ssize_t n = ::recv(fd, buf, sizeof(buf), 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) return;
+    if (n == 0) break;
+    request.append(buf, static_cast<size_t>(n));
+    if (request.size() > kMaxRequest) {
+      SendAll(fd, "error request too large\n");
+      return;
+    }
+  }
+  // Turned away only once its request is in, so the client is still
+  // listening for the answer.
+  if (!PeerTrusted(fd)) {
+    SendAll(fd, "error permission denied\n");
+    return;
+  }
+
+  fs::path root;
+  DumpOptions opts = opts_.dump;
+  PathFilter filter;
+  std::string error;
+  std::error_code ec;
+  std::shared_ptr<const std::string> output;
+  ChunkSink stream(fd);
+  bool ok = false;
+  if (ParseRequest(request, root, opts, filter, error) && !fs::is_directory(root, ec)) {
+    error = "directory '" + root.string() + "' not found";
+  } else if (error.empty()) {
+    // The options are part of the key: a dump with other options is
+    // another dump.
+    const std::string key = FormatRequest(root, opts);
+    std::shared_ptr<WarmTree> tree = Acquire(key);
+    size_t footprint = 0;
+    {
+      std::lock_guard<std::mutex> lock(tree->mu);
+      ok = DumpWarm(*tree, root, opts, stream, output, error);
+      footprint = tree->listings.size() + (tree->output ? tree->output->size() : 0);
+    }
+    Account(key, footprint);
+  }
+  if (!output) {
+    stream.Finish(ok, error);
+    return;
+  }
+  if (SendAll(fd, "ok " + std::to_string(output->size()) + "\n")) SendAll(fd, *output);
+}
+
+bool Server::DumpWarm(WarmTree& t, const fs::path& root, DumpOptions opts, ChunkSink& stream,
+                      std::shared_ptr<const std::string>& output, std::string& error) {
+  bool changed = true;
+  if (!t.watcher.Poll({}, changed)) changed = true;
+  if (t.output && !changed) {
+    output = t.output;
+    return true;
+  }
+  t.output.reset();
+  // Only a dump that may be kept is collected before it is sent: one of a
+  // watched tree whose last dump fit in the cache, listed by a walk (an
+  // index source can change without any directory in the tree changing).
+  // The rest stream out, so their requests don't hold the whole output.
+  const bool may_keep = opts_.keep_output && opts.source == FileSource::kWalk && t.watching &&
+                        t.last_size + t.listings.size() <= opts_.cache_bytes;
+
+  if (!t.loaded) {
+    t.excludes = LoadRepoExcludes(root, opts.global_excludes);
+    t.loaded = true;
+  }
+  opts.excludes = t.excludes;
+  opts.walk.load_scope = t.scopes.Loader();
+  // Listings of unchanged directories come from the last dump's; blocks
+  // are rendered afresh, there being no previous output file to copy from.
+  const uint64_t fingerprint = CacheFingerprint(root, opts);
+  ScanCache cache;
+  if (!t.listings.empty()) cache.Load(std::move(t.listings), fingerprint, fs::path());
+  t.listings.clear();
+  ScanCacheWriter record(NowNs() - int64_t{2000000000});
+  opts.walk.cache = &cache;
+  opts.walk.record = &record;
+  std::vector<fs::path> dirs;
+  opts.walk.on_dir = [&dirs](const fs::path& d) { dirs.push_back(d); };
+
+  StringSink collected;
+  OutputSink& sink = may_keep ? static_cast<OutputSink&>(collected) : stream;
+  if (!DumpTree(root, sink, fs::path(), opts)) {
+    error = "cannot list the files of '" + root.string() + "'";
+    return false;
+  }
+  t.last_size = sink.position();
+  t.listings = record.Serialize(fingerprint, FileStamp{});
+
+  // A change is only certain to be seen in a directory that was watched
+  // before the dump started, so a dump is kept once it found nothing new.
+  std::sort(dirs.begin(), dirs.end());
+  dirs.erase(std::unique(dirs.begin(), dirs.end()), dirs.end());
+  const bool covered = t.watching && std::includes(t.dirs.begin(), t.dirs.end(), dirs.begin(), dirs.end());
+  t.watching = t.watcher.Sync(dirs);
+  t.dirs = std::move(dirs);
+
+  if (!may_keep) return true;
+  output = std::make_shared<const std::string>(std::move(collected.data()));
+  if (covered && t.listings.size() + output->size() <= opts_.cache_bytes) t.output = output;
+  return true;
+}
+
+std::shared_ptr<WarmTree> Server::Acquire(const std::string& key) {
+  std::lock_guard<std::mutex> lock(trees_mu_);
+  Slot& slot = trees_[key];
+  if (!slot.tree) slot.tree = std::make_shared<WarmTree>();
+  slot.last_used = ++tick_;
+  return slot.tree;
+}
+
+void Server::Account(const std::string& key, size_t footprint) {
+  std::lock_guard<std::mutex> lock(trees_mu_);
+  auto self = trees_.find(key);
+  if (self != trees_.end()) self->second.footprint = footprint;
+  for (;;) {
+    size_t total = 0;
+    auto oldest = trees_.end();
+    for (auto it = trees_.begin(); it != trees_.end(); ++it) {
+      total += it->second.footprint;
+      if (oldest == trees_.end() || it->second.last_used < oldest->second.last_used) oldest = it;
+    }
+    if (total <= opts_.cache_bytes || oldest == trees_.end()) return;
+    // A request still using the tree keeps it alive until it is done.
+    trees_.erase(oldest);
+  }
+}
+
+// The client's side of a reply: lines, then runs of bytes passed on as they
+// arrive.
+class ReplyReader {
+ public:
+  explicit ReplyReader(int fd) : fd_(fd) {}
+
+  bool Line(std::string& line) {
+    line.clear();
+    for (;;) {
+      if (pos_ == len_ && !Fill()) return false;
+      const char* start = buf_ + pos_;
+      const char* nl = static_cast<const char*>(std::memchr(start, '\n', len_ - pos_));
+      const size_t n = nl ? static_cast<size_t>(nl - start) : len_ - pos_;
+      line.append(start, n);
+      pos_ += n;
+      if (nl) {
+        ++pos_;
+        return true;
+      }
+      if (line.size() > kMaxRequest) return false;
+    }
+  }
+
+  bool Copy(uint64_t n, OutputSink& out) {
+    while (n > 0) {
+      if (pos_ == len_ && !Fill()) return false;
+      const size_t take = static_cast<size_t>(std::min<uint64_t>(n, len_ - pos_));
+      out.Write(std::string_view(buf_ + pos_, take));
+      pos_ += take;
+      n -= take;
+    }
+    return true;
+  }
+
+ private:
+  bool Fill() {
+    for (;;) {
+      ssize_t n = ::recv(fd_, buf_, sizeof(buf_), 0);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) return false;
+      pos_ = 0;
+      len_ = static_cast<size_t>(n);
+      return true;
+    }
+  }
+
+  int fd_;
+  char buf_[64 << 10];
+  size_t pos_ = 0, len_ = 0;
+};
+
+}  // namespace
+
+int Serve(const ServeOptions& opts) {
+  Server server(opts);
+  return server.Run();
+}
+
+bool RequestDump(const fs::path& socket, const fs::path& root, const DumpOptions& opts, OutputSink& out,
+                 std::string& error) {
+  std::error_code ec;
+  fs::path abs = fs::weakly_canonical(fs::absolute(root, ec), ec);
+  if (ec || abs.string().find('\n') != std::string::npos) {
+    error = "cannot resolve '" + root.string() + "'";
+    return false;
+  }
+  if (const PathFilter* f = opts.walk.filter) {
+    for (const std::vector<std::string>* list : {&f->includes(), &f->excludes(), &f->extensions()}) {
+      for (const std::string& g : *list) {
+        if (g.find('\n') != std::string::npos) {
+          error = "a filter can't contain a line break";
+          return false;
+        }
+      }
+    }
+  }
+  const std::string path = socket.string();
+  sockaddr_un addr{};
+  if (path.size() >= sizeof(addr.sun_path)) {
+    error = "socket path '" + path + "' is too long";
+    return false;
+  }
+  addr.sun_family = AF_UNIX;
+  std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+  int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+    error = "cannot connect to '" + path + "': " + std::strerror(errno);
+    if (fd >= 0) ::close(fd);
+    return false;
+  }
+  if (!SendAll(fd, FormatRequest(abs, opts)) || ::shutdown(fd, SHUT_WR) != 0) {
+    error = "cannot send the request to '" + path + "'";
+    ::close(fd);
+    return false;
+  }
+
+  ReplyReader in(fd);
+  std::string head;
+  bool done = false;
+  if (in.Line(head)) {
+    char* end = nullptr;
+    if (head.rfind("error ", 0) == 0) {
+      error = head.substr(6);
+      ::close(fd);
+      return false;
+    } else if (head == "ok chunked") {
+      for (std::string size; in.Line(size);) {
+        if (size.rfind("error ", 0) == 0) {
+          error = size.substr(6);
+          ::close(fd);
+          return false;
+        }
+        uint64_t n = std::strtoull(size.c_str(), &end, 10);
+        if (size.empty() || *end != '\0') break;
+        if (n == 0) {
+          done = true;
+          break;
+        }
+        if (!in.Copy(n, out)) break;
+      }
+    } else if (head.rfind("ok ", 0) == 0) {
+      uint64_t n = std::strtoull(head.c_str() + 3, &end, 10);
+      done = *end == '\0' && in.Copy(n, out);
+    }
+  }
+  ::close(fd);
+  if (!done) {
+    error = "the server on '" + path + "' closed the connection mid-reply";
+    return false;
+  }
+  return true;
+}
+
+#else
+
+int Serve(const ServeOptions&) {
+  std::cerr << "Error: serve needs Unix sockets, which this platform lacks\n";
+  return 1;
+}
+
+bool RequestDump(const fs::path&, const fs::path&, const DumpOptions&, OutputSink&, std::string& error) {
+  error = "--server needs Unix sockets, which this platform lacks";
+  return false;
+}
+
+#endif
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <string>
+
+#include "dump.h"
+#include "output.h"
+
+// gitdump serve: a long-running process answering dump requests on a Unix
+// socket, for callers that dump the same trees over and over. Each tree it
+// has dumped stays warm: its compiled .gitignore scopes, its directory
+// listings and, once every directory in it is watched, the dump itself,
+// which answers requests for as long as no change to the tree arrives.
+// Requests can name any tree the server can read, so the socket is private
+// to the server's user: it is created with no group or other access, and
+// peers running as anyone else (root aside) are turned away.
+
+struct ServeOptions {
+  std::filesystem::path socket;
+  unsigned workers = 4;  // requests handled at once
+  DumpOptions dump;      // how every dump is run (jobs, readers, buffers)
+  // Listings and dumps kept, in bytes; the trees used least recently go
+  // first.
+  size_t cache_bytes = size_t{256} << 20;
+  bool keep_output = true;  // reuse a tree's last dump while it is unchanged
+};
+
+// Listens on `opts.socket` and serves until killed; returns non-zero if it
+// cannot listen.
+int Serve(const ServeOptions& opts);
+
+// Asks the server on `socket` for the dump of `root` with the options of
+// `opts` that shape its content (ignore rules, file list, size limits,
+// binary handling, dedup); the server's own settings decide the rest. The
+// dump is written into `out`. On failure `error` says why.
+bool RequestDump(const std::filesystem::path& socket, const std::filesystem::path& root, const DumpOptions& opts,
+                 OutputSink& out, std::string& error);
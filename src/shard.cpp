@@ -0,0 +1,100 @@
+#include "shard.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <system_error>
+#include <tuple>
+#include <vector>
+
+#include "dedup.h"
+
+namespace fs = std::filesystem;
+
+bool ParseShard(std::string_view spec, unsigned& index, unsigned& count) {
+  size_t slash = spec.find('/');
+  if (slash == std::string_view::npos) return false;
+  auto number = [](std::string_view s, unsigned& out) {
+    if (s.empty() || s.size() > 6) return false;
+    unsigned n = 0;
+    for (char c : s) {
+      if (c < '0' || c > '9') return false;
+      n = n * 10 + static_cast<unsigned>(c - '0');
+    }
+    out = n;
+    return true;
+  };
+  if (!number(spec.substr(0, slash), index) || !number(spec.substr(slash + 1), count)) return false;
+  return index >= 1 && index <= count;
+}
+
+bool ShardPlan::LoadSizes(const fs::path& file, std::string& error) {
+  std::error_code ec;
+  if (!fs::exists(file, ec)) return true;
+  std::ifstream in(file, std::ios::binary);
+  if (!in) {
+    error = "cannot read '" + file.string() + "'";
+    return false;
+  }
+  struct Estimate {
+    uint64_t bytes;
+    uint64_t hash;
+    std::string name;
+  };
+  std::vector<Estimate> estimates;
+  size_t line_no = 0;
+  for (std::string line; std::getline(in, line);) {
+    ++line_no;
+    if (line.empty()) continue;
+    size_t tab = line.find('\t');
+    char* end = nullptr;
+    unsigned long long bytes = std::strtoull(line.c_str(), &end, 10);
+    if (tab == std::string::npos || line[0] < '0' || line[0] > '9' || end != line.c_str() + tab ||
+        tab + 1 == line.size()) {
+      error = "'" + file.string() + "' line " + std::to_string(line_no) + ": expected BYTES<TAB>NAME";
+      return false;
+    }
+    std::string name = line.substr(tab + 1);
+    uint64_t hash = HashBytes(name);
+    estimates.push_back(Estimate{bytes, hash, std::move(name)});
+  }
+
+  // Largest first, each onto the lightest shard: within the largest entry's
+  // size of even, and the same on every machine given the same file.
+  std::sort(estimates.begin(), estimates.end(), [](const Estimate& a, const Estimate& b) {
+    return std::tie(b.bytes, a.hash, a.name) < std::tie(a.bytes, b.hash, b.name);
+  });
+  std::vector<uint64_t> load(count_, 0);
+  placed_.clear();
+  for (const Estimate& e : estimates) {
+    size_t lightest = std::min_element(load.begin(), load.end()) - load.begin();
+    load[lightest] += e.bytes;
+    placed_.emplace(e.name, static_cast<unsigned>(lightest) + 1);
+  }
+  return true;
+}
+
+unsigned ShardPlan::ShardOf(std::string_view name) const {
+  if (!placed_.empty()) {
+    auto it = placed_.find(std::string(name));
+    if (it != placed_.end()) return it->second;
+  }
+  return static_cast<unsigned>(HashBytes(name) % count_) + 1;
+}
+
+bool SaveShardSizes(const fs::path& file, const std::map<std::string, uint64_t>& sizes) {
+  fs::path tmp = file;
+  tmp += ".tmp";
+  {
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    if (!out) return false;
+    for (const auto& [name, bytes] : sizes) {
+      if (name.find('\n') != std::string::npos) continue;
+      out << bytes << '\t' << name << '\n';
+    }
+    if (!out.flush()) return false;
+  }
+  std::error_code ec;
+  fs::rename(tmp, file, ec);
+  return !ec;
+}
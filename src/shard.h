@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// --shard I/N: the share of a tree one of N processes dumps. The unit is an
+// entry at the top of the tree, a file or a whole subdirectory, so every
+// process can tell what is its own from the name alone:
+//  - entries named in the size estimates (--shard-sizes, written by
+//    `gitdump merge`) are dealt out largest first, each to the shard with
+//    the fewest bytes so far;
+//  - any other entry goes to the shard picked by a hash of its name.
+// Every shard has to be given the same estimates; the file is a list of
+// "BYTES<TAB>NAME" lines.
+class ShardPlan {
+ public:
+  // `index` counts from 1.
+  ShardPlan(unsigned index, unsigned count) : index_(index), count_(count) {}
+
+  // Reads the estimates; a missing file just leaves every entry to the hash.
+  bool LoadSizes(const std::filesystem::path& file, std::string& error);
+
+  unsigned index() const { return index_; }
+  unsigned count() const { return count_; }
+
+  // The shard, from 1, that dumps the top-level entry `name`.
+  unsigned ShardOf(std::string_view name) const;
+
+  // Whether this shard dumps `rel`, a path from the root.
+  bool Owns(std::string_view rel) const { return ShardOf(rel.substr(0, rel.find('/'))) == index_; }
+
+ private:
+  unsigned index_, count_;
+  std::unordered_map<std::string, unsigned> placed_;  // from the estimates
+};
+
+// Parses "I/N" with 1 <= I <= N.
+bool ParseShard(std::string_view spec, unsigned& index, unsigned& count);
+
+// Writes the estimates next to `file` and renames them over it.
+bool SaveShardSizes(const std::filesystem::path& file, const std::map<std::string, uint64_t>& sizes);
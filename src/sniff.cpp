@@ -0,0 +1,153 @@
+#include "sniff.h"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define GITDUMP_SNIFF_SSE2 1
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define GITDUMP_SNIFF_NEON 1
+#endif
+
+namespace {
+
+struct Magic {
+  size_t offset;
+  std::string_view bytes;
+};
+
+// Formats recognised without scanning. Short signatures that ordinary text
+// could start with (e.g. "MZ") are left to the NUL/UTF-8 checks.
+constexpr Magic kMagics[] = {
+    {0, {"\x89PNG\r\n\x1a\n", 8}},
+    {0, {"\xff\xd8\xff", 3}},                // JPEG
+    {0, {"GIF87a", 6}},
+    {0, {"GIF89a", 6}},
+    {0, {"%PDF-", 5}},
+    {0, {"PK\x03\x04", 4}},                  // zip, jar, docx, wheel
+    {0, {"\x1f\x8b", 2}},                    // gzip
+    {0, {"\xfd" "7zXZ\x00", 6}},
+    {0, {"7z\xbc\xaf\x27\x1c", 6}},
+    {0, {"\x28\xb5\x2f\xfd", 4}},            // zstd
+    {0, {"\x7f" "ELF", 4}},
+    {0, {"\xfe\xed\xfa\xce", 4}},            // Mach-O
+    {0, {"\xfe\xed\xfa\xcf", 4}},
+    {0, {"\xce\xfa\xed\xfe", 4}},
+    {0, {"\xcf\xfa\xed\xfe", 4}},
+    {0, {"\xca\xfe\xba\xbe", 4}},            // Java class, fat Mach-O
+    {0, {"\x00" "asm", 4}},                  // wasm
+    {0, {"SQLite format 3\x00", 16}},
+    {0, {"RIFF", 4}},
+    {0, {"OggS", 4}},
+    {0, {"fLaC", 4}},
+    {0, {"GGUF", 4}},
+    {0, {"\x93NUMPY", 6}},
+    {0, {"\x80\x02", 2}},                    // pickle protocol 2
+    {0, {"!<arch>\n", 8}},                   // ar, .a, .deb
+    {257, {"ustar", 5}},
+};
+
+bool HasMagic(std::string_view head) {
+  for (const Magic& m : kMagics) {
+    if (head.size() >= m.offset + m.bytes.size() &&
+        std::memcmp(head.data() + m.offset, m.bytes.data(), m.bytes.size()) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool HasNul(const char* p, size_t n) {
+  size_t i = 0;
+#if defined(GITDUMP_SNIFF_SSE2)
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) != 0) return true;
+  }
+#elif defined(GITDUMP_SNIFF_NEON)
+  for (; i + 16 <= n; i += 16) {
+    uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t*>(p + i));
+    if (vmaxvq_u8(vceqzq_u8(v)) != 0) return true;
+  }
+#endif
+  for (; i < n; ++i) {
+    if (p[i] == '\0') return true;
+  }
+  return false;
+}
+
+// Length of the run of ASCII bytes starting at p.
+size_t AsciiRun(const unsigned char* p, size_t n) {
+  size_t i = 0;
+#if defined(GITDUMP_SNIFF_SSE2)
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+    if (_mm_movemask_epi8(v) != 0) break;
+  }
+#elif defined(GITDUMP_SNIFF_NEON)
+  for (; i + 16 <= n; i += 16) {
+    uint8x16_t v = vld1q_u8(p + i);
+    if (vmaxvq_u8(v) >= 0x80) break;
+  }
+#endif
+  while (i < n && p[i] < 0x80) ++i;
+  return i;
+}
+
+// Counts bytes that are not part of a well-formed UTF-8 sequence.
+size_t InvalidUtf8Bytes(std::string_view s, bool complete) {
+  const auto* p = reinterpret_cast<const unsigned char*>(s.data());
+  const size_t n = s.size();
+  size_t invalid = 0;
+  size_t i = 0;
+  while (i < n) {
+    i += AsciiRun(p + i, n - i);
+    if (i >= n) break;
+    unsigned char c = p[i];
+    size_t len;
+    uint32_t min;
+    if (c >= 0xc2 && c <= 0xdf) {
+      len = 2; min = 0x80;
+    } else if (c >= 0xe0 && c <= 0xef) {
+      len = 3; min = 0x800;
+    } else if (c >= 0xf0 && c <= 0xf4) {
+      len = 4; min = 0x10000;
+    } else {
+      ++invalid;
+      ++i;
+      continue;
+    }
+    if (i + len > n) {
+      if (!complete) break;  // cut off by the sniff window
+      invalid += n - i;
+      break;
+    }
+    uint32_t cp = c & (0xff >> (len + 1));
+    size_t k = 1;
+    for (; k < len; ++k) {
+      unsigned char cc = p[i + k];
+      if ((cc & 0xc0) != 0x80) break;
+      cp = (cp << 6) | (cc & 0x3f);
+    }
+    if (k < len || cp < min || cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff)) {
+      ++invalid;
+      ++i;
+      continue;
+    }
+    i += len;
+  }
+  return invalid;
+}
+
+}  // namespace
+
+bool LooksBinary(std::string_view head, bool complete) {
+  if (head.empty()) return false;
+  if (HasMagic(head)) return true;
+  if (HasNul(head.data(), head.size())) return true;
+  // Tolerate the odd Latin-1 byte in otherwise textual files.
+  return InvalidUtf8Bytes(head, complete) * 10 > head.size();
+}
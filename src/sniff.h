@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+// How much of a file --skip-binary looks at before deciding.
+constexpr size_t kSniffBytes = size_t{8} << 10;
+
+// Classifies the first bytes of a file. A known binary magic number or any
+// NUL byte means binary; otherwise the head must be mostly valid UTF-8.
+// `complete` says whether `head` is the whole file, so a multi-byte sequence
+// cut off at the end of the window isn't held against it.
+bool LooksBinary(std::string_view head, bool complete);
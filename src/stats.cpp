@@ -0,0 +1,246 @@
+#include "stats.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <functional>
+#include <sstream>
+#include <unordered_map>
+#include <utility>
+
+namespace {
+
+constexpr size_t kPhases = static_cast<size_t>(StatPhase::kCount);
+constexpr size_t kCounters = static_cast<size_t>(StatCounter::kCount);
+
+const char* const kPhaseNames[kPhases] = {"list",  "ignore_files", "match", "canonical",   "open",
+                                          "read",  "write",        "submit_wait", "budget_wait", "writer_wait"};
+const char* const kCounterNames[kCounters] = {"dirs",  "entries",    "matches",    "pattern_evals",
+                                              "files", "cache_hits", "bytes_read", "bytes_written"};
+
+// Tells the runs apart, so a thread's cached block is never one of a run
+// that has since finished.
+std::atomic<uint64_t> next_generation{1};
+
+struct Timed {
+  uint64_t ticks;
+  std::string label;
+};
+
+bool Slower(const Timed& a, const Timed& b) {
+  return a.ticks > b.ticks;
+}
+
+std::string JsonString(std::string_view s) {
+  std::string out = "\"";
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char buf[8];
+      std::snprintf(buf, sizeof(buf), "\\u%04x", static_cast<unsigned>(c));
+      out += buf;
+    } else {
+      out += c;
+    }
+  }
+  return out + "\"";
+}
+
+}  // namespace
+
+struct RunStats::Local {
+  struct PatternCounts {
+    const GitignoreSpec* spec = nullptr;
+    uint64_t evals = 0;
+    uint64_t hits = 0;
+    uint64_t ticks = 0;
+  };
+
+  uint64_t counters[kCounters] = {};
+  uint64_t ticks[kPhases] = {};
+  std::unordered_map<const Pattern*, PatternCounts> patterns;
+  // Min-heaps on ticks, at most `top_` long.
+  std::vector<Timed> slow_files, slow_dirs;
+};
+
+struct RunStats::Merged {
+  struct PatternRow {
+    std::string source;
+    uint32_t line;
+    std::string pattern;
+    uint64_t evals, hits, ticks;
+  };
+
+  uint64_t counters[kCounters] = {};
+  uint64_t ticks[kPhases] = {};
+  std::vector<PatternRow> patterns;  // most time first
+  std::vector<Timed> slow_files, slow_dirs;  // slowest first
+  double ns_per_tick = 1;
+  double wall_ms = 0;
+};
+
+RunStats::RunStats(size_t top) : top_(top), generation_(next_generation.fetch_add(1)) {}
+
+RunStats::~RunStats() {
+  if (active_ == this) Stop();
+}
+
+void RunStats::Start() {
+  start_time_ = std::chrono::steady_clock::now();
+  start_ticks_ = StatTicks();
+  outer_ = active_;
+  active_ = this;
+}
+
+void RunStats::Stop() {
+  stop_ticks_ = StatTicks();
+  stop_time_ = std::chrono::steady_clock::now();
+  active_ = outer_;
+}
+
+RunStats::Local& RunStats::Mine() {
+  struct Cached {
+    uint64_t generation = 0;
+    Local* local = nullptr;
+  };
+  thread_local Cached cached;
+  if (cached.generation != generation_) {
+    std::lock_guard<std::mutex> lock(mu_);
+    locals_.push_back(std::make_unique<Local>());
+    cached.generation = generation_;
+    cached.local = locals_.back().get();
+  }
+  return *cached.local;
+}
+
+void RunStats::Add(StatCounter c, uint64_t n) {
+  Mine().counters[static_cast<size_t>(c)] += n;
+}
+
+void RunStats::AddTime(StatPhase p, uint64_t ticks) {
+  Mine().ticks[static_cast<size_t>(p)] += ticks;
+}
+
+void RunStats::PatternEval(const GitignoreSpec& spec, const Pattern& p, bool matched, uint64_t ticks) {
+  Local& l = Mine();
+  ++l.counters[static_cast<size_t>(StatCounter::kPatternEvals)];
+  Local::PatternCounts& c = l.patterns[&p];
+  c.spec = &spec;
+  ++c.evals;
+  c.hits += matched ? 1 : 0;
+  c.ticks += ticks;
+}
+
+bool RunStats::Qualifies(const Local& l, bool dir, uint64_t ticks) const {
+  const std::vector<Timed>& heap = dir ? l.slow_dirs : l.slow_files;
+  return top_ > 0 && (heap.size() < top_ || ticks > heap.front().ticks);
+}
+
+void RunStats::Keep(Local& l, bool dir, uint64_t ticks, std::string label) {
+  std::vector<Timed>& heap = dir ? l.slow_dirs : l.slow_files;
+  if (heap.size() == top_) {
+    std::pop_heap(heap.begin(), heap.end(), Slower);
+    heap.pop_back();
+  }
+  heap.push_back(Timed{ticks, std::move(label)});
+  std::push_heap(heap.begin(), heap.end(), Slower);
+}
+
+void RunStats::Retain(IgnoreScopePtr scope) {
+  std::lock_guard<std::mutex> lock(mu_);
+  retained_.push_back(std::move(scope));
+}
+
+RunStats::Merged RunStats::Merge() const {
+  Merged m;
+  const auto wall = stop_time_ - start_time_;
+  m.wall_ms = std::chrono::duration<double, std::milli>(wall).count();
+  if (stop_ticks_ > start_ticks_) {
+    m.ns_per_tick = std::chrono::duration<double, std::nano>(wall).count() /
+                    static_cast<double>(stop_ticks_ - start_ticks_);
+  }
+
+  std::lock_guard<std::mutex> lock(mu_);
+  std::unordered_map<const Pattern*, Local::PatternCounts> patterns;
+  for (const auto& l : locals_) {
+    for (size_t i = 0; i < kCounters; ++i) m.counters[i] += l->counters[i];
+    for (size_t i = 0; i < kPhases; ++i) m.ticks[i] += l->ticks[i];
+    for (const auto& [p, c] : l->patterns) {
+      Local::PatternCounts& into = patterns[p];
+      into.spec = c.spec;
+      into.evals += c.evals;
+      into.hits += c.hits;
+      into.ticks += c.ticks;
+    }
+    m.slow_files.insert(m.slow_files.end(), l->slow_files.begin(), l->slow_files.end());
+    m.slow_dirs.insert(m.slow_dirs.end(), l->slow_dirs.begin(), l->slow_dirs.end());
+  }
+  for (const auto& [p, c] : patterns) {
+    m.patterns.push_back({c.spec->source, p->line, p->pattern, c.evals, c.hits, c.ticks});
+  }
+  std::sort(m.patterns.begin(), m.patterns.end(),
+            [](const Merged::PatternRow& a, const Merged::PatternRow& b) { return a.ticks > b.ticks; });
+  for (std::vector<Timed>* v : {&m.slow_files, &m.slow_dirs}) {
+    std::sort(v->begin(), v->end(), Slower);
+    if (v->size() > top_) v->resize(top_);
+  }
+  return m;
+}
+
+std::string RunStats::Report() const {
+  const Merged m = Merge();
+  auto ms = [&](uint64_t ticks) { return static_cast<double>(ticks) * m.ns_per_tick / 1e6; };
+  std::ostringstream o;
+  o.setf(std::ios::fixed);
+  o.precision(3);
+  o << "--- gitdump stats: " << m.wall_ms << " ms wall ---\n";
+  o << "phase times (summed over threads):\n";
+  for (size_t i = 0; i < kPhases; ++i) o << "  " << kPhaseNames[i] << ": " << ms(m.ticks[i]) << " ms\n";
+  o << "counts:\n";
+  for (size_t i = 0; i < kCounters; ++i) o << "  " << kCounterNames[i] << ": " << m.counters[i] << "\n";
+  if (!m.patterns.empty()) {
+    o << "patterns by time spent:\n";
+    for (size_t i = 0; i < m.patterns.size() && i < top_; ++i) {
+      const Merged::PatternRow& p = m.patterns[i];
+      o << "  " << ms(p.ticks) << " ms, " << p.evals << " evals, " << p.hits << " hits: " << p.source << ":"
+        << p.line << ": " << p.pattern << "\n";
+    }
+  }
+  auto slowest = [&](const char* title, const std::vector<Timed>& v) {
+    if (v.empty()) return;
+    o << title << ":\n";
+    for (const Timed& t : v) o << "  " << ms(t.ticks) << " ms: " << t.label << "\n";
+  };
+  slowest("slowest directories", m.slow_dirs);
+  slowest("slowest files", m.slow_files);
+  return o.str();
+}
+
+std::string RunStats::ReportJson() const {
+  const Merged m = Merge();
+  auto ms = [&](uint64_t ticks) { return static_cast<double>(ticks) * m.ns_per_tick / 1e6; };
+  std::ostringstream o;
+  o << "{\"wall_ms\": " << m.wall_ms << ", \"phases_ms\": {";
+  for (size_t i = 0; i < kPhases; ++i) o << (i ? ", " : "") << "\"" << kPhaseNames[i] << "\": " << ms(m.ticks[i]);
+  o << "}, \"counters\": {";
+  for (size_t i = 0; i < kCounters; ++i) o << (i ? ", " : "") << "\"" << kCounterNames[i] << "\": " << m.counters[i];
+  o << "}, \"patterns\": [";
+  for (size_t i = 0; i < m.patterns.size(); ++i) {
+    const Merged::PatternRow& p = m.patterns[i];
+    o << (i ? ", " : "") << "{\"source\": " << JsonString(p.source) << ", \"line\": " << p.line
+      << ", \"pattern\": " << JsonString(p.pattern) << ", \"evals\": " << p.evals << ", \"hits\": " << p.hits
+      << ", \"ms\": " << ms(p.ticks) << "}";
+  }
+  auto slowest = [&](const char* key, const std::vector<Timed>& v) {
+    o << "], \"" << key << "\": [";
+    for (size_t i = 0; i < v.size(); ++i) {
+      o << (i ? ", " : "") << "{\"path\": " << JsonString(v[i].label) << ", \"ms\": " << ms(v[i].ticks) << "}";
+    }
+  };
+  slowest("slowest_dirs", m.slow_dirs);
+  slowest("slowest_files", m.slow_files);
+  o << "]}\n";
+  return o.str();
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "gitignore.h"
+
+// Where the time of a run goes, for --stats. Phases are summed over every
+// thread that spends time in them.
+enum class StatPhase {
+  kList,         // listing directories (or taking the listing from the cache)
+  kIgnoreFiles,  // loading nested .gitignore files and classifying subtrees
+  kMatch,        // matching entries against the ignore rules
+  kCanonical,    // resolving symlinks
+  kOpen,         // opening and stamping files to dump
+  kRead,         // loading and formatting file contents
+  kWrite,        // writing blocks to the output, copies included
+  kSubmitWait,   // traversal blocked on a full pipeline window
+  kBudgetWait,   // readers blocked on the memory budget
+  kWriterWait,   // the writer waiting for the next file to be loaded
+  kCount,
+};
+
+enum class StatCounter {
+  kDirs,          // directories scanned
+  kEntries,       // directory entries listed
+  kMatches,       // entries matched against the rules
+  kPatternEvals,  // single pattern evaluations
+  kFiles,         // files rendered
+  kCacheHits,     // blocks reused from the previous output
+  kBytesRead,     // file bytes loaded into memory
+  kBytesWritten,  // bytes of output
+  kCount,
+};
+
+// A cheap monotonic tick: the time-stamp counter where there is one,
+// nanoseconds elsewhere. Converted to time once, when reporting.
+inline uint64_t StatTicks() {
+#if (defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))) || defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                   std::chrono::steady_clock::now().time_since_epoch())
+                                   .count());
+#endif
+}
+
+// The counters of one run. While a run is Start()ed, probes anywhere in the
+// program report to it through Active(); with --stats off Active() is null
+// and each probe costs a single test. Active() is per thread, so runs on
+// different threads at once (library callers, gitdump serve) keep their
+// counts apart: a thread a run starts joins it with Attach(). Each thread adds to a block of its
+// own, so probes don't contend; the blocks are merged when reporting.
+class RunStats {
+ public:
+  // `top` is how many of the slowest files and directories are kept.
+  explicit RunStats(size_t top);
+  ~RunStats();
+  RunStats(const RunStats&) = delete;
+  RunStats& operator=(const RunStats&) = delete;
+
+  // Called on the thread the run belongs to, while no thread it started is
+  // probing. Stop() puts back whatever run the thread reported to before.
+  void Start();
+  void Stop();
+
+  static RunStats* Active() { return active_; }
+  // Makes the calling thread, one started on behalf of `stats` (which may be
+  // null), report to it.
+  static void Attach(RunStats* stats) { active_ = stats; }
+
+  void Add(StatCounter c, uint64_t n);
+  void AddTime(StatPhase p, uint64_t ticks);
+  // One evaluation of `p`, a pattern of `spec`, that took `ticks`.
+  void PatternEval(const GitignoreSpec& spec, const Pattern& p, bool matched, uint64_t ticks);
+  // A file or directory that took `ticks`; `label` is only called when it
+  // makes the list.
+  template <typename Label>
+  void Slow(bool dir, uint64_t ticks, Label&& label);
+
+  // Keeps a scope's patterns alive until the report, which names them.
+  void Retain(IgnoreScopePtr scope);
+
+  // Multi-line report for stderr, or the same as one JSON object.
+  std::string Report() const;
+  std::string ReportJson() const;
+
+ private:
+  struct Local;
+  struct Merged;
+
+  Local& Mine();
+  bool Qualifies(const Local& l, bool dir, uint64_t ticks) const;
+  void Keep(Local& l, bool dir, uint64_t ticks, std::string label);
+  Merged Merge() const;
+
+  inline static thread_local RunStats* active_ = nullptr;
+
+  size_t top_;
+  uint64_t generation_;
+  RunStats* outer_ = nullptr;  // active on the thread before Start()
+  uint64_t start_ticks_ = 0, stop_ticks_ = 0;
+  std::chrono::steady_clock::time_point start_time_, stop_time_;
+
+  mutable std::mutex mu_;
+  std::vector<std::unique_ptr<Local>> locals_;
+  std::vector<IgnoreScopePtr> retained_;
+};
+
+template <typename Label>
+void RunStats::Slow(bool dir, uint64_t ticks, Label&& label) {
+  Local& l = Mine();
+  if (Qualifies(l, dir, ticks)) Keep(l, dir, ticks, label());
+}
+
+// Adds the time until destruction to `phase`, if stats are on.
+class StatTimer {
+ public:
+  explicit StatTimer(StatPhase phase)
+      : stats_(RunStats::Active()), phase_(phase), start_(stats_ ? StatTicks() : 0) {}
+  ~StatTimer() {
+    if (stats_) stats_->AddTime(phase_, StatTicks() - start_);
+  }
+  StatTimer(const StatTimer&) = delete;
+  StatTimer& operator=(const StatTimer&) = delete;
+
+ private:
+  RunStats* stats_;
+  StatPhase phase_;
+  uint64_t start_;
+};
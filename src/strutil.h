@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cctype>
+#include <string>
+#include <string_view>
+
+#include "bytescan.h"
+
+inline std::string ToLower(std::string s) {
+  for (char& c : s) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+  return s;
+}
+
+inline bool StartsWith(std::string_view s, std::string_view prefix) {
+  return s.size() >= prefix.size() && s.substr(0, prefix.size()) == prefix;
+}
+
+inline bool EndsWith(std::string_view s, std::string_view suffix) {
+  return s.size() >= suffix.size() && s.substr(s.size() - suffix.size()) == suffix;
+}
+
+inline std::string Trim(std::string s) {
+  size_t i = 0;
+  while (i < s.size() && (s[i] == ' ' || s[i] == '\t' || s[i] == '\r' || s[i] == '\n')) ++i;
+  size_t j = s.size();
+  while (j > i && (s[j - 1] == ' ' || s[j - 1] == '\t' || s[j - 1] == '\r' || s[j - 1] == '\n')) --j;
+  return s.substr(i, j - i);
+}
+
+inline std::string NormalizeSlashes(std::string s) {
+  ReplaceBytes(s.data(), s.size(), '\\', '/');
+  return s;
+}
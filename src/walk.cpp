@@ -0,0 +1,396 @@
+#include "walk.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "arena.h"
+#include "stats.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// One directory's scan result. Workers fill `files` and `children` (in the
+// order they are to be visited) and then publish the node through `ready`;
+// the consumer takes over the children.
+struct DirNode {
+  fs::path dir;
+  fs::path canonical;  // `dir` with symlinks resolved
+  std::string rel;     // posix path relative to the root, "" for the root
+  IgnoreScopePtr scope;  // rules in effect for this directory's entries
+  SubtreeVerdict verdict = SubtreeVerdict::kMatch;  // what `scope` says below here
+  bool within = true;  // inside the --include globs
+  int64_t mtime_ns = 0;
+  bool listed = false;
+  std::vector<WalkFile> files;
+  std::vector<std::unique_ptr<DirNode>> children;
+  size_t files_before = 0;  // how many of the parent's files come out first
+  bool ready = false;       // guarded by Scheduler::done_mu_
+};
+
+// The matcher entry points, timed for --stats.
+bool Ignored(const IgnoreScope* scope, std::string_view rel, bool is_dir) {
+  RunStats* stats = RunStats::Active();
+  if (!stats) return IsIgnored(scope, rel, is_dir);
+  StatTimer timer(StatPhase::kMatch);
+  stats->Add(StatCounter::kMatches, 1);
+  return IsIgnored(scope, rel, is_dir);
+}
+
+SubtreeVerdict Classify(const IgnoreScope* scope, std::string_view dir_rel) {
+  StatTimer timer(StatPhase::kIgnoreFiles);
+  return ClassifySubtree(scope, dir_rel);
+}
+
+// Per-worker scratch for ScanDirectory(). The listing's names live in the
+// arena, and entry paths relative to the root are assembled in `rel`, so a
+// directory whose entries are all ignored costs no allocation once the
+// buffers have grown; only survivors get strings of their own.
+struct ScanScratch {
+  struct Entry {
+    const ListedEntry* listed;
+    bool is_dir;
+    bool is_reg;
+  };
+
+  Arena names;
+  std::vector<ListedEntry> listing;
+  std::vector<Entry> entries;
+  std::string rel;
+};
+
+// Byte order of the names, a directory's name counting as if it ended in
+// '/'. Visiting every directory in this order lists files in the byte order
+// of their full paths, which is also git's index order.
+bool SortsBefore(const ScanScratch::Entry& a, const ScanScratch::Entry& b) {
+  std::string_view x = a.listed->name, y = b.listed->name;
+  size_t n = std::min(x.size(), y.size());
+  int c = std::char_traits<char>::compare(x.data(), y.data(), n);
+  if (c != 0) return c < 0;
+  unsigned char cx = x.size() > n ? static_cast<unsigned char>(x[n]) : (a.is_dir ? '/' : 0);
+  unsigned char cy = y.size() > n ? static_cast<unsigned char>(y[n]) : (b.is_dir ? '/' : 0);
+  return cx < cy;
+}
+
+// Relative and canonical paths are extended from the parent's, so the only
+// filesystem calls per entry are the ones the iterator makes itself; a
+// weakly_canonical() lookup is only needed when an entry is a symlink.
+// Entries are collected before any matching so that the directory's own
+// .gitignore, if it has one, can be pushed onto the scope chain first.
+//
+// The verdict handed down by the parent lets most directories avoid matching
+// altogether: a kSkip directory is not even listed unless it has a
+// .gitignore of its own that might re-include something, and below a
+// kIncludeAll directory nothing is matched until another .gitignore appears.
+void ScanEntries(DirNode& node, const WalkOptions& opts) {
+  std::error_code ec;
+  if (node.verdict == SubtreeVerdict::kSkip && !fs::is_regular_file(node.dir / ".gitignore", ec)) {
+    return;
+  }
+
+  thread_local ScanScratch scratch;
+  scratch.names.Clear();
+  std::vector<ListedEntry>& listing = scratch.listing;
+  listing.clear();
+
+  // The raw listing comes from the cache when the directory's mtime says
+  // nothing was added, removed or renamed in it since.
+  {
+    StatTimer timer(StatPhase::kList);
+    bool cached = false;
+    if (opts.cache || opts.record) {
+      FileStamp stamp;
+      if (StampOf(node.dir, stamp)) {
+        node.mtime_ns = stamp.mtime_ns;
+        node.listed = true;
+        cached = opts.cache && opts.cache->FindDir(node.rel, stamp.mtime_ns, listing);
+      }
+    }
+    if (!cached) ListDirectory(node.dir, scratch.names, listing);
+    // The writer copies what it keeps, so the listing can be recycled as
+    // soon as this returns.
+    if (opts.record && node.listed) opts.record->AddDir(node.rel, node.mtime_ns, listing);
+  }
+  if (RunStats* stats = RunStats::Active()) stats->Add(StatCounter::kEntries, listing.size());
+
+  // Paths are only built for the entries that survive the ignore rules.
+  using Entry = ScanScratch::Entry;
+  std::vector<Entry>& entries = scratch.entries;
+  entries.clear();
+  bool has_gitignore = false;
+  for (const ListedEntry& l : listing) {
+    Entry e{&l, l.type == ListedType::kDir, l.type == ListedType::kFile};
+    if (l.type == ListedType::kSymlink) {
+      // A link's target can change without touching this directory, so it
+      // is always looked at afresh.
+      StatTimer timer(StatPhase::kCanonical);
+      fs::file_status st = fs::status(node.dir / fs::path(l.name), ec);
+      e.is_dir = !ec && fs::is_directory(st);
+      e.is_reg = !ec && fs::is_regular_file(st);
+    }
+    if (e.is_reg && l.name == ".gitignore") has_gitignore = true;
+    entries.push_back(e);
+  }
+
+  if (has_gitignore) {
+    StatTimer timer(StatPhase::kIgnoreFiles);
+    const fs::path file = node.dir / ".gitignore";
+    IgnoreScopePtr scope = opts.load_scope ? opts.load_scope(node.scope, node.rel, file)
+                                           : PushScope(node.scope, node.rel, LoadGitignoreFile(file));
+    if (scope != node.scope) {
+      node.scope = std::move(scope);
+      node.verdict = ClassifySubtree(node.scope.get(), node.rel);
+    }
+  }
+  if (node.verdict == SubtreeVerdict::kSkip) return;
+  const bool match = node.verdict == SubtreeVerdict::kMatch;
+  if (opts.sort) std::sort(entries.begin(), entries.end(), SortsBefore);
+
+  std::string& rel = scratch.rel;
+  rel.assign(node.rel);
+  if (!rel.empty()) rel += '/';
+  const size_t base = rel.size();
+  for (const Entry& e : entries) {
+    const ListedEntry& l = *e.listed;
+    if (!e.is_dir && !e.is_reg) continue;
+    rel.resize(base);
+    rel.append(l.name);
+    if (match && Ignored(node.scope.get(), rel, e.is_dir)) continue;
+    if (opts.shard && node.rel.empty() && !opts.shard->Owns(rel)) continue;
+    bool within = node.within;
+    if (opts.filter && !(e.is_dir ? opts.filter->AdmitsDir(rel, node.within, within)
+                                  : opts.filter->AdmitsFile(rel, node.within))) {
+      continue;
+    }
+
+    fs::path name(l.name);
+    fs::path path = node.dir / name;
+    fs::path canonical;
+    if (l.type == ListedType::kSymlink) {
+      StatTimer timer(StatPhase::kCanonical);
+      canonical = fs::weakly_canonical(path, ec);
+      if (ec) canonical = node.canonical / name;
+    } else {
+      canonical = node.canonical / name;
+    }
+
+    if (e.is_dir) {
+      auto child = std::make_unique<DirNode>();
+      child->dir = std::move(path);
+      child->canonical = std::move(canonical);
+      child->rel = rel;
+      child->scope = node.scope;
+      child->verdict = match ? Classify(node.scope.get(), child->rel) : node.verdict;
+      child->within = within;
+      child->files_before = node.files.size();
+      node.children.push_back(std::move(child));
+    } else {
+      node.files.push_back(WalkFile{std::move(path), std::move(canonical), rel});
+    }
+  }
+  if (!opts.sort) {
+    // Files first, then subdirectories last-found-first.
+    for (auto& child : node.children) child->files_before = node.files.size();
+    std::reverse(node.children.begin(), node.children.end());
+  }
+}
+
+// ScanEntries(), counted as one directory and timed whole for the list of
+// the slowest ones.
+void ScanDirectory(DirNode& node, const WalkOptions& opts) {
+  RunStats* stats = RunStats::Active();
+  if (!stats) return ScanEntries(node, opts);
+  const uint64_t start = StatTicks();
+  ScanEntries(node, opts);
+  stats->Add(StatCounter::kDirs, 1);
+  stats->Slow(true, StatTicks() - start, [&] { return node.rel.empty() ? std::string(".") : node.rel; });
+}
+
+// Work-stealing pool: each worker owns a deque, pushes and pops at the back
+// (so it keeps descending into what it just found, which is also what the
+// consumer wants next) and steals from the front of the others when idle.
+class Scheduler {
+ public:
+  explicit Scheduler(const WalkOptions& opts) : opts_(opts), queues_(opts.jobs) {}
+
+  // Also what stops a walk cut short: workers drop whatever is still queued.
+  ~Scheduler() {
+    {
+      std::lock_guard<std::mutex> lock(idle_mu_);
+      stopping_ = true;
+      cancelled_.store(true, std::memory_order_relaxed);
+    }
+    idle_cv_.notify_all();
+    for (auto& t : threads_) t.join();
+  }
+
+  void Start(DirNode* root) {
+    Push(0, root);
+    RunStats* stats = RunStats::Active();
+    for (unsigned i = 0; i < queues_.size(); ++i) {
+      threads_.emplace_back([this, i, stats] {
+        RunStats::Attach(stats);
+        Run(i);
+      });
+    }
+  }
+
+  void WaitReady(DirNode* node) {
+    std::unique_lock<std::mutex> lock(done_mu_);
+    done_cv_.wait(lock, [&] { return node->ready; });
+  }
+
+ private:
+  struct Queue {
+    std::mutex mu;
+    std::deque<DirNode*> items;
+  };
+
+  void Push(unsigned self, DirNode* node) {
+    {
+      // Counted before it can be taken, so a thief's decrement never comes
+      // first and `queued_` can't wrap; at worst it is briefly ahead and a
+      // worker looks once more. Taking idle_mu_ orders this against a worker
+      // that has just checked `queued_` and is about to sleep, so the wakeup
+      // can't be lost.
+      std::lock_guard<std::mutex> lock(idle_mu_);
+      queued_.fetch_add(1, std::memory_order_relaxed);
+    }
+    {
+      std::lock_guard<std::mutex> lock(queues_[self].mu);
+      queues_[self].items.push_back(node);
+    }
+    idle_cv_.notify_one();
+  }
+
+  DirNode* Take(unsigned self) {
+    {
+      Queue& q = queues_[self];
+      std::lock_guard<std::mutex> lock(q.mu);
+      if (!q.items.empty()) {
+        DirNode* n = q.items.back();
+        q.items.pop_back();
+        queued_.fetch_sub(1, std::memory_order_relaxed);
+        return n;
+      }
+    }
+    for (size_t k = 1; k < queues_.size(); ++k) {
+      Queue& q = queues_[(self + k) % queues_.size()];
+      std::lock_guard<std::mutex> lock(q.mu);
+      if (!q.items.empty()) {
+        DirNode* n = q.items.front();
+        q.items.pop_front();
+        queued_.fetch_sub(1, std::memory_order_relaxed);
+        return n;
+      }
+    }
+    return nullptr;
+  }
+
+  void Run(unsigned self) {
+    for (;;) {
+      if (cancelled_.load(std::memory_order_relaxed)) return;
+      DirNode* node = Take(self);
+      if (!node) {
+        std::unique_lock<std::mutex> lock(idle_mu_);
+        idle_cv_.wait(lock, [&] { return stopping_ || queued_.load(std::memory_order_acquire) > 0; });
+        if (stopping_) return;
+        continue;
+      }
+      ScanDirectory(*node, opts_);
+      // Backwards, so the child the consumer visits next is at the back.
+      for (auto it = node->children.rbegin(); it != node->children.rend(); ++it) Push(self, it->get());
+      {
+        std::lock_guard<std::mutex> lock(done_mu_);
+        node->ready = true;
+      }
+      done_cv_.notify_all();
+    }
+  }
+
+  const WalkOptions& opts_;
+  std::vector<Queue> queues_;
+  std::vector<std::thread> threads_;
+  std::atomic<size_t> queued_{0};
+  std::atomic<bool> cancelled_{false};
+
+  std::mutex idle_mu_;
+  std::condition_variable idle_cv_;
+  bool stopping_ = false;
+
+  std::mutex done_mu_;
+  std::condition_variable done_cv_;
+};
+
+}  // namespace
+
+bool VisitTree(const fs::path& root, IgnoreScopePtr scope, const WalkOptions& opts,
+               const std::function<bool(const WalkFile&)>& visit) {
+  auto top = std::make_unique<DirNode>();
+  top->dir = root;
+  top->canonical = root;
+  top->scope = std::move(scope);
+  top->verdict = ClassifySubtree(top->scope.get(), top->rel);
+  top->within = !opts.filter || opts.filter->IncludesAll();
+
+  std::unique_ptr<Scheduler> sched;
+  if (opts.jobs > 1) {
+    sched = std::make_unique<Scheduler>(opts);
+    sched->Start(top.get());
+  }
+
+  // Sequencing stage: replay the tree depth-first, waiting for each node's
+  // scan to land, so the output order is the same for any number of jobs.
+  // A frame stays on the stack while its subdirectories are visited, so its
+  // remaining files can come out after them.
+  struct Frame {
+    std::unique_ptr<DirNode> node;
+    size_t file = 0;   // next file to hand out
+    size_t child = 0;  // next subdirectory to visit
+  };
+  std::vector<Frame> stack;
+  auto enter = [&](std::unique_ptr<DirNode> node) {
+    if (sched) {
+      sched->WaitReady(node.get());
+    } else {
+      ScanDirectory(*node, opts);
+    }
+    if (opts.on_dir) opts.on_dir(node->dir);
+    stack.push_back(Frame{std::move(node)});
+  };
+  enter(std::move(top));
+  while (!stack.empty()) {
+    Frame& frame = stack.back();
+    DirNode& node = *frame.node;
+    const bool more = frame.child < node.children.size();
+    const size_t until = more ? node.children[frame.child]->files_before : node.files.size();
+    for (; frame.file < until; ++frame.file) {
+      if (visit(node.files[frame.file])) continue;
+      // The workers still hold nodes of the tree being unwound here.
+      sched.reset();
+      return false;
+    }
+    if (!more) {
+      stack.pop_back();
+      continue;
+    }
+    enter(std::move(node.children[frame.child++]));
+  }
+  return true;
+}
+
+void WalkTree(const fs::path& root, IgnoreScopePtr scope, const WalkOptions& opts,
+              const std::function<void(const WalkFile&)>& on_file) {
+  VisitTree(root, std::move(scope), opts, [&](const WalkFile& f) {
+    on_file(f);
+    return true;
+  });
+}
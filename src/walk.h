@@ -0,0 +1,59 @@
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <string>
+
+#include "filter.h"
+#include "gitignore.h"
+#include "scancache.h"
+#include "shard.h"
+
+struct WalkOptions {
+  // Number of threads enumerating directories; 1 walks inline on the caller.
+  unsigned jobs = 1;
+  // Listings from a previous run, reused for directories whose mtime hasn't
+  // changed.
+  const ScanCache* cache = nullptr;
+  // Receives every listing this walk makes or reuses, from whichever thread
+  // made it.
+  ScanCacheWriter* record = nullptr;
+  // Called on the calling thread for every directory the walk visits,
+  // including skipped ones whose .gitignore could bring them back.
+  std::function<void(const std::filesystem::path&)> on_dir;
+  // Visit each directory's entries sorted by name, so files come out in the
+  // byte order of their paths no matter what order the filesystem lists
+  // them in.
+  bool sort = false;
+  // --include / --exclude / --ext, applied as entries are listed.
+  const PathFilter* filter = nullptr;
+  // --shard: only the top-level entries this shard owns are walked.
+  const ShardPlan* shard = nullptr;
+  // Compiles the .gitignore of the directory `rel` on top of `parent`, in
+  // place of reading it afresh; lets a caller that walks the same tree again
+  // keep the rules it compiled last time.
+  std::function<IgnoreScopePtr(IgnoreScopePtr parent, const std::string& rel, const std::filesystem::path& file)>
+      load_scope;
+};
+
+struct WalkFile {
+  std::filesystem::path path;       // as enumerated; used to open the file
+  std::filesystem::path canonical;  // with symlinks resolved, for display
+  std::string rel;                  // posix path relative to the walk root
+};
+
+// Calls `on_file` on the calling thread for every regular file under `root`
+// that is not ignored. `scope` holds the rules that apply above the tree
+// (repository excludes); every directory's .gitignore is layered on top as
+// the walk reaches it. `root` is expected to be canonical already. The order
+// is a depth-first walk (a directory's files in enumeration order, then its
+// subdirectories last-found-first, or everything sorted with `opts.sort`)
+// and does not depend on `opts.jobs`.
+void WalkTree(const std::filesystem::path& root, IgnoreScopePtr scope,
+              const WalkOptions& opts,
+              const std::function<void(const WalkFile&)>& on_file);
+
+// WalkTree() that stops as soon as `visit` returns false, leaving the rest of
+// the tree unlisted. Returns false when it was stopped.
+bool VisitTree(const std::filesystem::path& root, IgnoreScopePtr scope, const WalkOptions& opts,
+               const std::function<bool(const WalkFile&)>& visit);
@@ -0,0 +1,138 @@
+#include "watch.h"
+
+#include <thread>
+#include <unordered_set>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+#if defined(__linux__)
+
+namespace {
+
+constexpr uint32_t kWatchMask = IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO |
+                                IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR | IN_EXCL_UNLINK;
+
+}  // namespace
+
+TreeWatcher::TreeWatcher() : fd_(::inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) {}
+
+TreeWatcher::~TreeWatcher() {
+  if (fd_ >= 0) ::close(fd_);
+}
+
+bool TreeWatcher::Sync(const std::vector<fs::path>& dirs) {
+  if (fd_ < 0) return false;
+  bool ok = true;
+  std::unordered_set<std::string> want;
+  for (const fs::path& d : dirs) {
+    std::string key = d.string();
+    if (!want.insert(key).second || by_path_.count(key)) continue;
+    int wd = ::inotify_add_watch(fd_, key.c_str(), kWatchMask);
+    if (wd < 0) {
+      ok = false;
+      continue;
+    }
+    by_path_[key] = wd;
+    by_wd_[wd] = key;
+  }
+  for (auto it = by_path_.begin(); it != by_path_.end();) {
+    if (want.count(it->first)) {
+      ++it;
+      continue;
+    }
+    ::inotify_rm_watch(fd_, it->second);
+    by_wd_.erase(it->second);
+    it = by_path_.erase(it);
+  }
+  return ok;
+}
+
+// Reads whatever events are queued, waiting up to `timeout_ms` (-1: forever)
+// for the first one, and sets `changed` if any of them matters.
+bool TreeWatcher::Drain(const std::vector<fs::path>& ignored, int timeout_ms, bool& changed) {
+  struct pollfd p = {fd_, POLLIN, 0};
+  int r = ::poll(&p, 1, timeout_ms);
+  if (r < 0) return errno == EINTR;
+  if (r == 0) return true;
+
+  alignas(struct inotify_event) char buf[64 << 10];
+  for (;;) {
+    ssize_t n = ::read(fd_, buf, sizeof(buf));
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    for (char* at = buf; at < buf + n;) {
+      const auto* ev = reinterpret_cast<const struct inotify_event*>(at);
+      at += sizeof(struct inotify_event) + ev->len;
+      if (ev->mask & IN_Q_OVERFLOW) {
+        changed = true;
+        continue;
+      }
+      auto it = by_wd_.find(ev->wd);
+      if (ev->mask & IN_IGNORED) {
+        // The kernel dropped the watch (directory gone, or Sync() removed
+        // it); the parent's own event reports the change.
+        if (it != by_wd_.end()) {
+          by_path_.erase(it->second);
+          by_wd_.erase(it);
+        }
+        continue;
+      }
+      if (it == by_wd_.end()) continue;
+      if (ev->len > 0) {
+        fs::path full = fs::path(it->second) / ev->name;
+        bool ours = false;
+        for (const fs::path& ig : ignored) ours = ours || full == ig;
+        if (ours) continue;
+      }
+      changed = true;
+    }
+  }
+}
+
+bool TreeWatcher::Wait(const std::vector<fs::path>& ignored, std::chrono::milliseconds quiet) {
+  if (fd_ < 0) return false;
+  bool changed = false;
+  while (!changed) {
+    if (!Drain(ignored, -1, changed)) return false;
+  }
+  for (;;) {
+    bool more = false;
+    if (!Drain(ignored, static_cast<int>(quiet.count()), more)) return false;
+    if (!more) return true;
+  }
+}
+
+bool TreeWatcher::Poll(const std::vector<fs::path>& ignored, bool& changed) {
+  changed = false;
+  return fd_ >= 0 && Drain(ignored, 0, changed);
+}
+
+#else
+
+TreeWatcher::TreeWatcher() = default;
+TreeWatcher::~TreeWatcher() = default;
+
+bool TreeWatcher::Sync(const std::vector<fs::path>&) {
+  return true;
+}
+
+bool TreeWatcher::Wait(const std::vector<fs::path>&, std::chrono::milliseconds) {
+  std::this_thread::sleep_for(std::chrono::seconds(1));
+  return true;
+}
+
+bool TreeWatcher::Poll(const std::vector<fs::path>&, bool& changed) {
+  changed = true;
+  return true;
+}
+
+#endif
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Waits for changes in a set of directories: their entries being created,
+// removed, renamed, written or touched. Uses inotify on Linux; elsewhere it
+// falls back to waking up periodically, which together with --cache still
+// only re-renders what changed.
+class TreeWatcher {
+ public:
+  TreeWatcher();
+  ~TreeWatcher();
+  TreeWatcher(const TreeWatcher&) = delete;
+  TreeWatcher& operator=(const TreeWatcher&) = delete;
+
+  // Watches exactly `dirs` from now on, keeping the watches already placed.
+  // Returns false when some could not be added (e.g. the per-user inotify
+  // limit); the rest stay in place.
+  bool Sync(const std::vector<std::filesystem::path>& dirs);
+
+  // Blocks until a change arrives and then until `quiet` passes without
+  // another one, so a burst of saves is one wakeup. Changes to `ignored`
+  // paths (our own output) don't count. Returns false if watching failed.
+  bool Wait(const std::vector<std::filesystem::path>& ignored, std::chrono::milliseconds quiet);
+
+  // Takes the changes that arrived since the last call without waiting, and
+  // sets `changed` if there were any. Where nothing can be watched every
+  // call reports a change.
+  bool Poll(const std::vector<std::filesystem::path>& ignored, bool& changed);
+
+ private:
+#if defined(__linux__)
+  bool Drain(const std::vector<std::filesystem::path>& ignored, int timeout_ms, bool& changed);
+
+  int fd_ = -1;
+  std::unordered_map<std::string, int> by_path_;
+  std::unordered_map<int, std::string> by_wd_;
+#endif
+};
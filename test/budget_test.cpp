@@ -0,0 +1,96 @@
+// Checks which files --budget-* keeps, from made-up items.
+//
+//   gitdump_budget_test
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "budget.h"
+
+static int failures = 0;
+
+static void Check(bool ok, const std::string& what) {
+  if (ok) return;
+  std::cerr << "FAIL: " << what << "\n";
+  ++failures;
+}
+
+static BudgetWeight Weight(const std::string& spec) {
+  BudgetWeight w;
+  Check(ParseBudgetWeight(spec, w), "'" + spec + "' parses");
+  return w;
+}
+
+// The names of the kept items, in the order given.
+static std::string Kept(const std::vector<BudgetItem>& items, const BudgetOptions& opts) {
+  std::vector<bool> keep = SelectWithinBudget(items, opts);
+  std::string names;
+  for (size_t i = 0; i < items.size(); ++i) {
+    if (!keep[i]) continue;
+    if (!names.empty()) names += ' ';
+    names += items[i].rel;
+  }
+  return names;
+}
+
+static void Expect(const std::vector<BudgetItem>& items, const BudgetOptions& opts, const std::string& want,
+                   const std::string& what) {
+  const std::string got = Kept(items, opts);
+  Check(got == want, what + ": kept '" + got + "', expected '" + want + "'");
+}
+
+// A weight matches like a gitignore line: a directory pattern takes in
+// every file below it, the way --include and --exclude do.
+static void WeightsMatchDirectories() {
+  const std::vector<BudgetItem> items = {
+      {"a.txt", 10, 0}, {"b.txt", 10, 0}, {"docs/guide.md", 10, 0}, {"docs/api/ref.md", 10, 0},
+  };
+  BudgetOptions opts;
+  opts.bytes = 20;
+  Expect(items, opts, "a.txt b.txt", "no weights, nearest the root first");
+  for (const char* spec : {"docs=5", "docs/=5", "docs/**=5", "/docs=5"}) {
+    opts.weights = {Weight(spec)};
+    Expect(items, opts, "docs/guide.md docs/api/ref.md", std::string("--budget-weight ") + spec);
+  }
+  // Only directories match a trailing slash, so src/docs, a file, doesn't.
+  opts.bytes = 10;
+  opts.weights = {Weight("docs/=5")};
+  opts.order = {BudgetKey::kDepth};
+  Expect({{"src/docs", 10, 0}, {"x", 10, 0}}, opts, "x", "a file is not a directory");
+  opts.weights = {Weight("docs=5")};
+  Expect({{"src/docs", 10, 0}, {"x", 10, 0}}, opts, "src/docs", "an unanchored name matches at any depth");
+}
+
+// The last matching weight wins, negative ones go last, and what no longer
+// fits is passed over for smaller files behind it.
+static void SelectionFollowsWeightsThenOrder() {
+  const std::vector<BudgetItem> items = {
+      {"big.txt", 50, 3}, {"gen/out.c", 5, 1}, {"src/main.c", 20, 2}, {"src/gen/tab.c", 5, 4}, {"z.txt", 5, 5},
+  };
+  BudgetOptions opts;
+  opts.bytes = 30;
+  opts.weights = {Weight("src=2"), Weight("gen/=-1")};
+  Expect(items, opts, "gen/out.c src/main.c z.txt", "src first, gen last");
+  opts.weights = {Weight("gen/=-1"), Weight("src=2")};
+  Expect(items, opts, "src/main.c src/gen/tab.c z.txt", "the later weight wins for src/gen");
+  opts.weights.clear();
+  opts.order = {BudgetKey::kRecent};
+  Expect(items, opts, "src/main.c src/gen/tab.c z.txt", "most recent first, skipping big.txt");
+  opts.order = {BudgetKey::kSize};
+  opts.bytes = 16;
+  Expect(items, opts, "gen/out.c src/gen/tab.c z.txt", "smallest first");
+
+  BudgetWeight w;
+  Check(!ParseBudgetWeight("!docs=1", w), "a negated weight is rejected");
+  Check(!ParseBudgetWeight("docs", w), "a weight needs '='");
+  Check(!ParseBudgetWeight("docs=x", w), "a weight is a number");
+}
+
+int main() {
+  WeightsMatchDirectories();
+  SelectionFollowsWeightsThenOrder();
+  if (failures) return 1;
+  std::cout << "ok\n";
+  return 0;
+}
@@ -0,0 +1,174 @@
+// Dumps small trees built on the spot and checks what comes out.
+//
+//   gitdump_dump_test
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "dump.h"
+#include "fileio.h"
+#include "output.h"
+#include "pipeline.h"
+
+namespace fs = std::filesystem;
+
+static int failures = 0;
+
+static void Check(bool ok, const std::string& what, const std::string& dump) {
+  if (ok) return;
+  std::cerr << "FAIL: " << what << "\n--- dump ---\n" << dump << "------------\n";
+  ++failures;
+}
+
+static void WriteFile(const fs::path& file, const std::string& data) {
+  fs::create_directories(file.parent_path());
+  std::ofstream(file, std::ios::binary) << data;
+}
+
+static bool Contains(const std::string& dump, const std::string& s) {
+  return dump.find(s) != std::string::npos;
+}
+
+static std::string Dump(const fs::path& root, DumpOptions opts) {
+  opts.walk.sort = true;
+  opts.global_excludes = false;
+  StringSink out;
+  if (!DumpTree(root, out, fs::path(), opts)) return "(DumpTree failed)";
+  return out.data();
+}
+
+// --dedup never points at a block that doesn't hold the file: not at one
+// --oversize skip dropped, not at a truncated one, not at a binary one
+// --skip-binary omitted.
+static void DedupOnlyReferencesWholeBlocks(const fs::path& root) {
+  const std::string big(6756, 'x');
+  const std::string small(300, 's');
+  const std::string binary = std::string(2000, 'b') + std::string(1, '\0');
+  WriteFile(root / "a/big.txt", big);
+  WriteFile(root / "b/big.txt", big);
+  WriteFile(root / "a/small.txt", small);
+  WriteFile(root / "b/small.txt", small);
+  WriteFile(root / "a/blob.bin", binary);
+  WriteFile(root / "b/blob.bin", binary);
+  const std::string a = (root / "a").string(), b = (root / "b").string();
+
+  DumpOptions opts;
+  opts.dedup = true;
+  opts.max_file_size = 1024;
+  opts.oversize = OversizePolicy::kSkip;
+  std::string dump = Dump(root, opts);
+  Check(!Contains(dump, "big.txt"), "--oversize skip leaves both copies out", dump);
+  Check(Contains(dump, "[duplicate of " + a + "/small.txt"), "the small copy still becomes a reference", dump);
+
+  opts.oversize = OversizePolicy::kTruncate;
+  dump = Dump(root, opts);
+  Check(Contains(dump, b + "/big.txt\n```\n" + std::string(1024, 'x')), "a truncated file is dumped on its own",
+        dump);
+  Check(!Contains(dump, "[duplicate of " + a + "/big.txt"), "nothing refers to a truncated block", dump);
+
+  opts = DumpOptions();
+  opts.dedup = true;
+  opts.skip_binary = true;
+  dump = Dump(root, opts);
+  Check(!Contains(dump, "[duplicate of " + a + "/blob.bin"), "nothing refers to an omitted binary block", dump);
+  Check(Contains(dump, b + "/blob.bin\n```\n[binary file omitted"), "the binary copy is omitted on its own", dump);
+  Check(Contains(dump, "[duplicate of " + a + "/big.txt"), "whole text copies still become references", dump);
+}
+
+static std::string ReadFile(const fs::path& file) {
+  std::ifstream in(file, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+// Dumps running at once on different threads, each with --stats, count only
+// their own files.
+static void ConcurrentStatsStayApart(const fs::path& root) {
+  constexpr int kTrees = 4;
+  for (int t = 0; t < kTrees; ++t) {
+    for (int i = 0; i < 500 * (t + 1); ++i) {
+      WriteFile(root / std::to_string(t) / std::to_string(i % 7) / (std::to_string(i) + ".txt"), "x\n");
+    }
+  }
+  for (int round = 0; round < 3; ++round) {
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kTrees; ++t) {
+      threads.emplace_back([&root, t] {
+        DumpOptions opts;
+        opts.walk.jobs = 3;
+        opts.pipeline.readers = 2;
+        opts.stats_json = (root / ("stats" + std::to_string(t) + ".json")).string();
+        Dump(root / std::to_string(t), opts);
+      });
+    }
+    for (auto& t : threads) t.join();
+    for (int t = 0; t < kTrees; ++t) {
+      const std::string json = ReadFile(root / ("stats" + std::to_string(t) + ".json"));
+      // Counted by the walk's threads through RunStats::Active().
+      const std::string counts = "\"dirs\": 8, \"entries\": " + std::to_string(500 * (t + 1) + 7) + ",";
+      Check(Contains(json, counts), "tree " + std::to_string(t) + " counts " + counts, json);
+    }
+  }
+}
+
+// A file that shrinks after it was sized is copied only as far as it goes:
+// the sink says how far, and the block ends there saying so instead of with
+// the footer written for the full size.
+static void ShortCopiesAreReported(const fs::path& root) {
+  const fs::path src = root / "shrinks.txt";
+  WriteFile(src, std::string(10000, 'a'));
+  auto file = std::make_shared<SourceFile>();
+  Check(file->Open(src), "the source opens", "");
+  fs::resize_file(src, 4000);
+
+  StringSink string_sink;
+  Check(string_sink.CopyFrom(*file, 0, 10000) == 4000, "a read copy stops at the end of the file", "");
+  const std::string want =
+      "head\n```\n" + std::string(4000, 'a') + "\n[... changed while dumped: 4000 of 10000 bytes shown]\n```\n\n";
+  for (unsigned readers : {0u, 2u}) {
+    const fs::path out = root / ("out" + std::to_string(readers));
+    {
+      auto sink = OpenFileSink(out.string(), 1 << 16);
+      Check(sink->SupportsZeroCopy(), "a file sink copies in the kernel", "");
+      PipelineOptions opts;
+      opts.readers = readers;
+      DumpPipeline pipeline(opts, [&](const WalkFile&, const ReserveFn&) {
+        Rendered r;
+        r.text = "head\n```\n";
+        r.splice = Splice{file, 0, 10000, "\n```\n\n"};
+        return r;
+      }, *sink);
+      pipeline.Submit(WalkFile{src, src, "shrinks.txt"});
+      pipeline.Finish();
+    }
+    const std::string dump = ReadFile(out);
+    Check(dump == want, "the short block is closed where the copy stopped", dump);
+  }
+  auto sink = OpenFileSink((root / "past_end").string(), 1 << 16);
+  Check(sink->CopyFrom(*file, 5000, 100) == 0, "nothing is copied from past the end", "");
+}
+
+int main() {
+  std::error_code ec;
+  const fs::path root = fs::weakly_canonical(fs::temp_directory_path(ec)) /
+                        ("gitdump_dump_test_" + std::to_string(std::random_device()()));
+  fs::remove_all(root, ec);
+  fs::create_directories(root / "dedup");
+  DedupOnlyReferencesWholeBlocks(root / "dedup");
+  fs::create_directories(root / "stats");
+  ConcurrentStatsStayApart(root / "stats");
+  fs::create_directories(root / "short");
+  ShortCopiesAreReported(root / "short");
+  fs::remove_all(root, ec);
+  if (failures) return 1;
+  std::cout << "ok\n";
+  return 0;
+}
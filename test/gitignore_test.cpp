@@ -0,0 +1,220 @@
+// Checks the matcher against git itself. Each case is a set of .gitignore
+// files over one fixed tree; for every path, git check-ignore says whether
+// it is ignored, and for every directory the subtree verdict has to agree
+// with what git says about everything below it. The walk has to list
+// exactly the files git ls-files reports as untracked and not ignored.
+//
+//   gitdump_gitignore_test GIT
+
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <set>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <sys/wait.h>
+
+#include "gitignore.h"
+#include "walk.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+struct Case {
+  const char* name;
+  // (directory relative to the root, contents of its .gitignore)
+  std::vector<std::pair<std::string, std::string>> gitignores;
+};
+
+// The same tree for every case, with names the patterns below pick at.
+const char* const kFiles[] = {
+    "a.txt", "a.log", "b.LOG", "c.a", "d.o", "file1", "file2", "filea", "fileab", "[x].txt", "#hash", "!bang",
+    "with space.txt", "src/main.cpp", "src/main.o", "src/lib/util.cpp", "src/lib/util.o", "src/lib/deep/x.o",
+    "src/lib/deep/x.cpp", "src/file1/inner.txt", "build/out.bin", "build/keep.txt", "build/sub/y.txt",
+    "docs/readme.md", "docs/api/index.md", "docs/api/old/index.md", "foo/bar/baz.txt", "bar/foo", "a/b/c/d.txt",
+    "a/d.txt", "x/foo/y/z.txt", "logs/2024/app.log", "logs/debug.txt", "logs/app.log", "node_modules/pkg/index.js",
+    "sub/node_modules/pkg/i.js", "lib/top.cpp", "deep/deep/deep.txt",
+};
+
+const Case kCases[] = {
+    {"double star", {{"", "**/foo\na/**/d.txt\ndocs/**\n**/old/**\nlogs/**/*.log\n"}}},
+    {"double star prefixes", {{"", "**/lib/**/*.o\nsrc/**\n!src/**/\n!**/*.cpp\n**/deep\n"}}},
+    {"trailing double star", {{"", "!docs/api/index.md\n/docs/**\nsrc/lib/**\nbuild/*\nlogs/**/\n"}}},
+    {"negation", {{"", "*.o\n!src/lib/util.o\nbuild/\n!build/keep.txt\n*.txt\n!a.txt\n!*/\n"}}},
+    {"negation of directories", {{"", "/*\n!/src\nsrc/lib/*\n!src/lib/deep/\n!.gitignore\n"}}},
+    {"whitelist", {{"", "*\n!*/\n!*.cpp\n!.gitignore\n"}}},
+    {"double star whitelist", {{"", "**\n!**/\n!**/*.md\n"}}},
+    {"anchored", {{"", "/a.txt\nsrc/main.cpp\n/build\nlib\n/docs/api\n/foo/\nbar/foo\n"}}},
+    {"trailing slash", {{"", "lib/\nnode_modules/\nfile1/\nbuild/sub/\nfoo/\n"}}},
+    {"character classes", {{"", "file[0-9]\nfile[!0-9]\n*.[oa]\n[a-c].*\n*.[Ll][Oo][Gg]\n\\[x\\].txt\nfile??\n"}}},
+    {"escapes and spaces", {{"", "\\#hash\n\\!bang\nwith space.txt\n# a comment\n\n*.md   \n"}}},
+    {"ranges and wildcards", {{"", "[^a-m]*.txt\n?.log\nfile[1-]\n*/*/*.txt\nd*/\n"}}},
+    {"nested overrides",
+     {{"", "*.o\n*.log\nbuild/\n"}, {"src", "!main.o\n*.cpp\n"}, {"src/lib", "!*.cpp\ndeep/\n"},
+      {"logs", "!app.log\n2024/\n"}}},
+    {"nested anchoring", {{"", "/lib/\n"}, {"src", "/lib/deep\nutil.*\n"}, {"docs", "api/\n!api/index.md\n"}}},
+};
+
+int failures = 0;
+
+void Fail(const Case& c, const std::string& what) {
+  std::cerr << "FAIL [" << c.name << "]: " << what << "\n";
+  ++failures;
+}
+
+std::set<std::string> ReadLines(const fs::path& file) {
+  std::set<std::string> lines;
+  std::ifstream in(file, std::ios::binary);
+  for (std::string line; std::getline(in, line);) lines.insert(line);
+  return lines;
+}
+
+// Runs git in `root`, without any of the user's or the system's settings.
+bool Git(const std::string& git, const fs::path& root, const std::string& args, const fs::path& in,
+         const fs::path& out) {
+  std::string cmd = "cd '" + root.string() + "' && HOME='" + root.string() +
+                    "' XDG_CONFIG_HOME='" + root.string() + "' GIT_CONFIG_NOSYSTEM=1 '" + git + "' " + args;
+  if (!in.empty()) cmd += " < '" + in.string() + "'";
+  cmd += " > '" + out.string() + "'";
+  int status = std::system(cmd.c_str());
+  // check-ignore exits with 1 when nothing is ignored.
+  return status != -1 && WIFEXITED(status) && WEXITSTATUS(status) <= 1;
+}
+
+// The rules in effect inside `dir`: the root's, then each .gitignore on the
+// way down, `dir`'s own included.
+IgnoreScopePtr ScopeAt(const fs::path& root, const IgnoreScopePtr& base, const std::string& dir) {
+  IgnoreScopePtr scope = PushScope(base, "", LoadGitignoreFile(root / ".gitignore"));
+  if (dir.empty()) return scope;
+  for (size_t slash = dir.find('/');; slash = dir.find('/', slash + 1)) {
+    std::string sub = dir.substr(0, slash);
+    scope = PushScope(scope, sub, LoadGitignoreFile(root / sub / ".gitignore"));
+    if (slash == std::string::npos) return scope;
+  }
+}
+
+// Whether git would leave `rel` out: it or a directory above it is ignored.
+bool Ignored(const fs::path& root, const IgnoreScopePtr& base, const std::string& rel, bool is_dir) {
+  std::string parent;
+  for (size_t slash = rel.find('/'); slash != std::string::npos; slash = rel.find('/', slash + 1)) {
+    std::string dir = rel.substr(0, slash);
+    if (IsIgnored(ScopeAt(root, base, parent).get(), dir, true)) return true;
+    parent = dir;
+  }
+  return IsIgnored(ScopeAt(root, base, parent).get(), rel, is_dir);
+}
+
+void RunCase(const Case& c, const fs::path& root, const std::string& git, size_t verdicts[3]) {
+  std::error_code ec;
+  fs::remove_all(root, ec);
+  fs::create_directories(root);
+  std::set<std::string> dirs;
+  for (const char* f : kFiles) {
+    const fs::path file = root / f;
+    fs::create_directories(file.parent_path());
+    std::ofstream(file) << "x\n";
+    std::string rel = f;
+    for (size_t slash = rel.find('/'); slash != std::string::npos; slash = rel.find('/', slash + 1)) {
+      dirs.insert(rel.substr(0, slash));
+    }
+  }
+  for (const auto& [dir, rules] : c.gitignores) std::ofstream(root / dir / ".gitignore") << rules;
+  const fs::path work = root.parent_path();
+  if (!Git(git, root, "init -q", fs::path(), work / "init.out")) {
+    Fail(c, "git init failed");
+    return;
+  }
+  const IgnoreScopePtr base = LoadRepoExcludes(root, false);
+
+  // Every path, one by one.
+  const fs::path list = work / "paths.txt", ignored_out = work / "ignored.txt";
+  {
+    std::ofstream out(list, std::ios::binary);
+    for (const char* f : kFiles) out << f << "\n";
+    for (const std::string& d : dirs) out << d << "\n";
+  }
+  if (!Git(git, root, "check-ignore --no-index --stdin", list, ignored_out)) {
+    Fail(c, "git check-ignore failed");
+    return;
+  }
+  const std::set<std::string> ignored = ReadLines(ignored_out);
+  for (const char* f : kFiles) {
+    const bool want = ignored.count(f) != 0;
+    if (Ignored(root, base, f, false) != want) {
+      Fail(c, std::string(f) + " should " + (want ? "" : "not ") + "be ignored");
+    }
+  }
+  for (const std::string& d : dirs) {
+    const bool want = ignored.count(d) != 0;
+    if (Ignored(root, base, d, true) != want) Fail(c, d + "/ should " + (want ? "" : "not ") + "be ignored");
+  }
+
+  // Every directory the walk would enter, as a whole.
+  for (const std::string& d : dirs) {
+    if (ignored.count(d) || Ignored(root, base, d, true)) continue;
+    const SubtreeVerdict v = ClassifySubtree(ScopeAt(root, base, d).get(), d);
+    ++verdicts[static_cast<int>(v)];
+    if (v == SubtreeVerdict::kMatch) continue;
+    for (const char* f : kFiles) {
+      const std::string rel = f;
+      if (rel.compare(0, d.size() + 1, d + "/") != 0) continue;
+      const bool below = ignored.count(rel) != 0;
+      if (v == SubtreeVerdict::kSkip && !below) Fail(c, d + "/ is skipped but git keeps " + rel);
+      if (v == SubtreeVerdict::kIncludeAll && below) Fail(c, d + "/ includes all but git ignores " + rel);
+    }
+  }
+
+  // The walk, pruning and all, against the files git would add.
+  const fs::path untracked_out = work / "untracked.txt";
+  if (!Git(git, root, "ls-files -o --exclude-standard", fs::path(), untracked_out)) {
+    Fail(c, "git ls-files failed");
+    return;
+  }
+  const std::set<std::string> untracked = ReadLines(untracked_out);
+  for (unsigned jobs : {1u, 3u}) {
+    WalkOptions opts;
+    opts.jobs = jobs;
+    std::set<std::string> walked;
+    WalkTree(root, base, opts, [&](const WalkFile& f) {
+      // git keeps its own directory out of every listing; the walk does not.
+      if (f.rel.compare(0, 5, ".git/") != 0) walked.insert(f.rel);
+    });
+    for (const std::string& rel : untracked) {
+      if (!walked.count(rel)) Fail(c, "the walk misses " + rel);
+    }
+    for (const std::string& rel : walked) {
+      if (!untracked.count(rel)) Fail(c, "the walk lists " + rel + ", which git ignores");
+    }
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc != 2) {
+    std::cerr << "Usage: gitdump_gitignore_test GIT\n";
+    return 2;
+  }
+  std::error_code ec;
+  const fs::path work = fs::weakly_canonical(fs::temp_directory_path(ec)) /
+                        ("gitdump_gitignore_test_" + std::to_string(std::random_device()()));
+  size_t verdicts[3] = {};
+  for (const Case& c : kCases) RunCase(c, work / "tree", argv[1], verdicts);
+  fs::remove_all(work, ec);
+  // Each verdict has to come up, or the checks above prove little.
+  if (!verdicts[0] || !verdicts[1] || !verdicts[2]) {
+    std::cerr << "FAIL: verdicts seen: " << verdicts[0] << " skip, " << verdicts[1] << " match, " << verdicts[2]
+              << " include-all\n";
+    ++failures;
+  }
+  if (failures) return 1;
+  std::cout << "ok (" << verdicts[0] << " skip, " << verdicts[1] << " match, " << verdicts[2]
+            << " include-all)\n";
+  return 0;
+}